@@ -50,6 +50,16 @@ void Channel::update()
     loop_->updateChannel(this);
 }
 
+void Channel::deferEvents(int revents)
+{
+    deferredRevents_ |= revents;
+    if (!deferred_)
+    {
+        deferred_ = true;
+        loop_->deferChannel(this);
+    }
+}
+
 void Channel::handleEvent()
 {
     // LOG_TRACE<<"revents_="<<revents_;
@@ -16,6 +16,7 @@
 
 #include <trantor/utils/Logger.h>
 #include <trantor/utils/NonCopyable.h>
+#include <trantor/net/callbacks.h>
 #include <trantor/exports.h>
 #include <functional>
 #include <assert.h>
@@ -246,6 +247,64 @@ class TRANTOR_EXPORT Channel : NonCopyable
         return events_ & kReadEvent;
     }
 
+    /**
+     * @brief Set the edge-triggered mode of the socket.
+     *
+     * @param on If true, the poller only reports an event when the state of
+     * the socket changes, so the callbacks must read or write until the
+     * socket would block (or defer the rest with deferEvents()).
+     * @note If the mode is changed after some events are enabled, call
+     * updateEvents() to apply it. On Windows the mode is ignored and events
+     * stay level-triggered.
+     */
+    void setEdgeTriggered(bool on)
+    {
+        edgeTriggered_ = on;
+    }
+
+    /**
+     * @brief Check whether the socket is in the edge-triggered mode.
+     *
+     * @return true
+     * @return false
+     */
+    bool isEdgeTriggered() const
+    {
+        return edgeTriggered_;
+    }
+
+    /**
+     * @brief Handle the given events again in the next iteration of the
+     * event loop, whether or not the poller reports them. An edge-triggered
+     * channel uses this when it stops handling an event before the socket
+     * would block.
+     *
+     * @param revents The events to handle.
+     */
+    void deferEvents(int revents);
+
+    /**
+     * @brief Set the priority class of the channel. In each iteration, the
+     * event loop handles the events of the channels of higher classes first.
+     *
+     * @param priority
+     * @note This method must be called in the thread of the event loop.
+     */
+    void setPriority(ChannelPriority priority)
+    {
+        priority_ = priority;
+    }
+
+    /**
+     * @brief Return the priority class of the channel.
+     *
+     * @return ChannelPriority
+     */
+    ChannelPriority priority() const
+    {
+        return priority_;
+    }
+
     /**
      * @brief Set and update the events enabled.
      *
@@ -279,6 +338,7 @@ class TRANTOR_EXPORT Channel : NonCopyable
   private:
     friend class EventLoop;
     friend class EpollPoller;
+    friend class IoUringPoller;
     friend class KQueue;
     void update();
     void handleEvent();
@@ -303,6 +363,16 @@ class TRANTOR_EXPORT Channel : NonCopyable
     int revents_;
     int index_;
     bool addedToLoop_{false};
+    bool edgeTriggered_{false};
+    bool deferred_{false};
+    int deferredRevents_{0};
+    ChannelPriority priority_{ChannelPriority::kInteractive};
+    // Set when the deferred events are handled, so that the channel goes
+    // before the newly ready ones of its class.
+    bool carriedOver_{false};
+    bool dirty_{false};
+    int appliedEvents_{0};
+    bool appliedEdgeTriggered_{false};
     EventCallback readCallback_;
     EventCallback writeCallback_;
     EventCallback errorCallback_;
@@ -129,7 +129,52 @@ void EventLoop::updateChannel(Channel *channel)
 {
     assert(channel->ownerLoop() == this);
     assertInLoopThread();
+    if (!looping_)
+    {
+        applyChannelUpdate(channel);
+        return;
+    }
+    if (channel->dirty_)
+    {
+        savedChannelUpdates_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    channel->dirty_ = true;
+    dirtyChannels_.push_back(channel);
+}
+void EventLoop::applyChannelUpdate(Channel *channel)
+{
+    if (channel->edgeTriggered_ != channel->appliedEdgeTriggered_ &&
+        channel->appliedEvents_ != Channel::kNoneEvent)
+    {
+        // Register the channel again, so that every poller picks up the new
+        // trigger mode.
+        int events = channel->events_;
+        channel->events_ = Channel::kNoneEvent;
+        poller_->updateChannel(channel);
+        channel->events_ = events;
+    }
     poller_->updateChannel(channel);
+    channel->appliedEvents_ = channel->events_;
+    channel->appliedEdgeTriggered_ = channel->edgeTriggered_;
+}
+void EventLoop::flushChannelUpdates()
+{
+    // A callback may change a channel and change it back in the same
+    // iteration, e.g. when the write buffer fills and drains, such updates
+    // don't reach the poller at all.
+    for (auto channel : dirtyChannels_)
+    {
+        channel->dirty_ = false;
+        if (channel->events_ == channel->appliedEvents_ &&
+            channel->edgeTriggered_ == channel->appliedEdgeTriggered_)
+        {
+            savedChannelUpdates_.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        applyChannelUpdate(channel);
+    }
+    dirtyChannels_.clear();
 }
 void EventLoop::removeChannel(Channel *channel)
 {
@@ -142,8 +187,151 @@ void EventLoop::removeChannel(Channel *channel)
                          activeChannels_.end(),
                          channel) == activeChannels_.end());
     }
+    if (channel->deferred_)
+    {
+        channel->deferred_ = false;
+        channel->deferredRevents_ = 0;
+        deferredChannels_.erase(std::find(deferredChannels_.begin(),
+                                          deferredChannels_.end(),
+                                          channel));
+    }
+    if (channel->dirty_)
+    {
+        // The pending update is superseded by the removal.
+        channel->dirty_ = false;
+        dirtyChannels_.erase(std::find(dirtyChannels_.begin(),
+                                       dirtyChannels_.end(),
+                                       channel));
+        savedChannelUpdates_.fetch_add(1, std::memory_order_relaxed);
+    }
+    channel->appliedEvents_ = Channel::kNoneEvent;
+    if (channel->index() < 0)
+    {
+        // The poller has never seen this channel.
+        return;
+    }
     poller_->removeChannel(channel);
 }
+void EventLoop::deferChannel(Channel *channel)
+{
+    assert(channel->ownerLoop() == this);
+    assertInLoopThread();
+    deferredChannels_.push_back(channel);
+}
+void EventLoop::addDeferredChannels()
+{
+    // Channels reported by the poller in this round already have non-zero
+    // revents, merge the deferred events into them instead of adding them to
+    // the active list twice.
+    for (auto channel : deferredChannels_)
+    {
+        // Drop the events disabled since they were deferred.
+        int revents = channel->deferredRevents_ & channel->events();
+        channel->deferred_ = false;
+        channel->deferredRevents_ = 0;
+        if (revents == 0)
+            continue;
+        if (channel->revents_ != 0)
+        {
+            channel->revents_ |= revents;
+        }
+        else
+        {
+            channel->revents_ = revents;
+            activeChannels_.push_back(channel);
+        }
+        channel->carriedOver_ = true;
+    }
+    deferredChannels_.clear();
+}
+void EventLoop::sortActiveChannels()
+{
+    // Each class is split into the channels carried over from the last
+    // iteration and the newly ready ones, the former go first so that
+    // deferred channels are not overtaken forever.
+    const int kKeys = 6;
+    auto key = [](const Channel *channel) {
+        return static_cast<int>(channel->priority_) * 2 +
+               (channel->carriedOver_ ? 0 : 1);
+    };
+    size_t counts[kKeys] = {0};
+    for (auto channel : activeChannels_)
+    {
+        ++counts[key(channel)];
+    }
+    int usedKeys = 0;
+    for (int i = 0; i < kKeys; ++i)
+    {
+        if (counts[i] > 0)
+            ++usedKeys;
+    }
+    if (usedKeys > 1)
+    {
+        // A stable counting sort.
+        size_t starts[kKeys];
+        size_t start = 0;
+        for (int i = 0; i < kKeys; ++i)
+        {
+            starts[i] = start;
+            start += counts[i];
+        }
+        sortedChannels_.resize(activeChannels_.size());
+        for (auto channel : activeChannels_)
+        {
+            sortedChannels_[starts[key(channel)]++] = channel;
+        }
+        activeChannels_.swap(sortedChannels_);
+    }
+    for (auto channel : activeChannels_)
+    {
+        channel->carriedOver_ = false;
+    }
+}
+void EventLoop::handleActiveChannels(EventLoopStats *stats)
+{
+    const bool hasBudget = iterationBudget_.count() > 0;
+    std::chrono::steady_clock::time_point start;
+    if (hasBudget)
+        start = std::chrono::steady_clock::now();
+    bool bulkHandled = false;
+    for (size_t i = 0; i < activeChannels_.size(); ++i)
+    {
+        Channel *channel = activeChannels_[i];
+        if (hasBudget && channel->priority_ == ChannelPriority::kBulk)
+        {
+            // At least one bulk channel is handled in each iteration.
+            if (bulkHandled &&
+                std::chrono::steady_clock::now() - start > iterationBudget_)
+            {
+                // The bulk channels are sorted to the end of the list.
+                for (size_t j = i; j < activeChannels_.size(); ++j)
+                {
+                    activeChannels_[j]->deferEvents(
+                        activeChannels_[j]->revents_);
+                }
+                deferredBulkChannels_.fetch_add(activeChannels_.size() - i,
+                                                std::memory_order_relaxed);
+                break;
+            }
+            bulkHandled = true;
+        }
+        currentActiveChannel_ = channel;
+        activeFd_.store(channel->fd(), std::memory_order_relaxed);
+        if (stats)
+        {
+            auto handleStart = std::chrono::steady_clock::now();
+            currentActiveChannel_->handleEvent();
+            stats->handleEventTime_.recordDuration(
+                std::chrono::steady_clock::now() - handleStart);
+        }
+        else
+        {
+            currentActiveChannel_->handleEvent();
+        }
+    }
+    currentActiveChannel_ = NULL;
+    activeFd_.store(-1, std::memory_order_relaxed);
+}
 void EventLoop::quit()
 {
     quit_ = true;
@@ -161,88 +349,315 @@ void EventLoop::loop()
     assertInLoopThread();
     looping_ = true;
     quit_ = false;
+#ifndef _WIN32
+    nativeThread_ = pthread_self();
+#endif
 
     while (!quit_)
     {
+        // The only cost of the statistics when they are disabled is checking
+        // this pointer.
+        EventLoopStats *stats = stats_.load(std::memory_order_relaxed);
+        ++iteration_;
+        ioBytes_ = 0;
+        ioCallbacks_ = 0;
         activeChannels_.clear();
+        // Don't block in the poller when some channels have deferred events.
+        for (auto channel : deferredChannels_)
+        {
+            channel->revents_ = 0;
+        }
+        if (!dirtyChannels_.empty())
+            flushChannelUpdates();
+        int64_t timeoutNs = 0;
+        if (deferredChannels_.empty())
+        {
+#ifdef __linux__
+            timeoutNs = kPollTimeMs * 1000000LL;
+            if (!timerfdEnabled_)
+                timeoutNs = timerQueue_->getTimeoutNs(timeoutNs);
+#else
+            timeoutNs = timerQueue_->getTimeout() * 1000000;
+#endif
+        }
+        std::chrono::steady_clock::time_point pollStart;
+        if (stats)
+            pollStart = std::chrono::steady_clock::now();
+        activity_.store(kPolling, std::memory_order_release);
+        if (maxSpinTime_.count() > 0 && timeoutNs != 0)
+            pollWithSpinning(timeoutNs);
+        else
+            poller_->pollNs(timeoutNs, &activeChannels_);
+        // A new heartbeat each time the loop leaves the poller, the watchdog
+        // reports the loop when it doesn't come back in time.
+        heartbeat_.store(heartbeat_.load(std::memory_order_relaxed) + 1,
+                         std::memory_order_relaxed);
+        activity_.store(kHandlingEvents, std::memory_order_release);
+        std::chrono::steady_clock::time_point busyStart;
+        if (trackLoad_)
+            busyStart = std::chrono::steady_clock::now();
+        if (stats)
+        {
+            stats->iterations_.store(
+                stats->iterations_.load(std::memory_order_relaxed) + 1,
+                std::memory_order_relaxed);
+            stats->pollTime_.recordDuration(std::chrono::steady_clock::now() -
+                                            pollStart);
+            stats->activeChannels_.record(activeChannels_.size());
+        }
 #ifdef __linux__
-        poller_->poll(kPollTimeMs, &activeChannels_);
+        if (!timerfdEnabled_)
+            timerQueue_->processTimers();
 #else
-        poller_->poll(static_cast<int>(timerQueue_->getTimeout()),
-                      &activeChannels_);
         timerQueue_->processTimers();
 #endif
-        // TODO sort channel by priority
+        if (!deferredChannels_.empty())
+            addDeferredChannels();
+        if (activeChannels_.size() > 1)
+            sortActiveChannels();
+        else if (!activeChannels_.empty())
+            activeChannels_[0]->carriedOver_ = false;
         // std::cout<<"after ->poll()"<<std::endl;
         eventHandling_ = true;
-        for (auto it = activeChannels_.begin(); it != activeChannels_.end();
-             ++it)
-        {
-            currentActiveChannel_ = *it;
-            currentActiveChannel_->handleEvent();
-        }
-        currentActiveChannel_ = NULL;
+        handleActiveChannels(stats);
         eventHandling_ = false;
         // std::cout << "looping" << endl;
-        doRunInLoopFuncs();
+        activity_.store(kCallingFuncs, std::memory_order_release);
+        if (stats)
+        {
+            auto start = std::chrono::steady_clock::now();
+            stats->funcsQueueDepth_.record(doRunInLoopFuncs());
+            stats->funcsTime_.recordDuration(std::chrono::steady_clock::now() -
+                                             start);
+        }
+        else
+        {
+            doRunInLoopFuncs();
+        }
+        if (trackLoad_)
+            updateLoad(busyStart);
     }
+    activity_.store(kNotLooping, std::memory_order_release);
     looping_ = false;
+    flushChannelUpdates();
 }
-void EventLoop::abortNotInLoopThread()
-{
-    LOG_FATAL << "It is forbidden to run loop on threads other than event-loop "
-                 "thread";
-    exit(1);
-}
-void EventLoop::runInLoop(const Func &cb)
+void EventLoop::pollWithSpinning(int64_t timeoutNs)
 {
-    if (isInLoopThread())
+    auto start = std::chrono::steady_clock::now();
+    auto now = start;
+    bool spun = false;
+    bool cutByTimer = false;
+    if (spinTime_.count() > 0 && funcsEmpty())
     {
-        cb();
+        spun = true;
+        // Stop spinning when the next timer is due, the timers only run once
+        // the loop leaves the poller.
+        auto spinTime = std::chrono::nanoseconds(
+            timerQueue_->getTimeoutNs(std::chrono::nanoseconds(spinTime_)
+                                          .count()));
+        cutByTimer = spinTime < spinTime_;
+        auto deadline = start + spinTime;
+        do
+        {
+            poller_->poll(0, &activeChannels_);
+            now = std::chrono::steady_clock::now();
+        } while (activeChannels_.empty() && funcsEmpty() && now < deadline);
     }
-    else
+    bool hit = !activeChannels_.empty() || !funcsEmpty();
+    if (!hit)
+    {
+        poller_->pollNs(timeoutNs, &activeChannels_);
+        now = std::chrono::steady_clock::now();
+    }
+    // Spin for about twice the average idle time when it is short enough,
+    // otherwise spinning only burns CPU time. Long idle times are capped so
+    // that the average follows a rising event rate quickly.
+    auto idleTime = std::min(
+        std::chrono::duration_cast<std::chrono::microseconds>(now - start),
+        2 * maxSpinTime_);
+    avgIdleTime_ = (avgIdleTime_ * 7 + idleTime) / 8;
+    // Each spin that ends without work halves the next one, e.g. when the
+    // peers only get the CPU after this thread blocks. A spin cut short by a
+    // timer isn't a miss.
+    if (spun)
     {
-        queueInLoop(cb);
+        if (hit)
+            spinMisses_ = 0;
+        else if (!cutByTimer)
+            spinMisses_ = std::min(spinMisses_ + 1, 16);
     }
+    else if (spinMisses_ > 0)
+    {
+        --spinMisses_;
+    }
+    if (avgIdleTime_ <= maxSpinTime_)
+        spinTime_ =
+            std::min(2 * avgIdleTime_, maxSpinTime_) / (1 << spinMisses_);
+    else
+        spinTime_ = std::chrono::microseconds(0);
 }
-void EventLoop::runInLoop(Func &&cb)
+void EventLoop::enableBusyPolling(const std::chrono::microseconds &maxSpinTime)
 {
-    if (isInLoopThread())
+    assert(maxSpinTime.count() > 0);
+    runInLoop([this, maxSpinTime]() {
+        maxSpinTime_ = maxSpinTime;
+        spinTime_ = maxSpinTime;
+        avgIdleTime_ = std::chrono::microseconds(0);
+        spinMisses_ = 0;
+    });
+}
+void EventLoop::setIterationBudget(const std::chrono::microseconds &budget)
+{
+    runInLoop([this, budget]() { iterationBudget_ = budget; });
+}
+void EventLoop::setIoBudget(size_t maxBytes, size_t maxCallbacks)
+{
+    runInLoop([this, maxBytes, maxCallbacks]() {
+        maxIoBytes_ = maxBytes;
+        maxIoCallbacks_ = maxCallbacks;
+    });
+}
+void EventLoop::enableLoadTracking()
+{
+    runInLoop([this]() {
+        if (trackLoad_)
+            return;
+        trackLoad_ = true;
+        loadWindowStart_ = std::chrono::steady_clock::now();
+        loadWindowBusy_ = std::chrono::steady_clock::duration(0);
+        loadUpdateTime_.store(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                loadWindowStart_.time_since_epoch())
+                .count(),
+            std::memory_order_relaxed);
+    });
+}
+const std::chrono::milliseconds kLoadWindow(100);
+void EventLoop::updateLoad(std::chrono::steady_clock::time_point busyStart)
+{
+    auto now = std::chrono::steady_clock::now();
+    loadWindowBusy_ += now - busyStart;
+    auto window = now - loadWindowStart_;
+    if (window < kLoadWindow)
+        return;
+    recentLoad_.store(static_cast<uint32_t>(loadWindowBusy_ * 1000 / window),
+                      std::memory_order_relaxed);
+    loadUpdateTime_.store(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            now.time_since_epoch())
+            .count(),
+        std::memory_order_relaxed);
+    loadWindowStart_ = now;
+    loadWindowBusy_ = std::chrono::steady_clock::duration(0);
+}
+double EventLoop::recentLoad() const
+{
+    auto updateTime = loadUpdateTime_.load(std::memory_order_relaxed);
+    if (updateTime == 0)
+        return 0;
+    auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+                   .count();
+    if (std::chrono::nanoseconds(now - updateTime) > 2 * kLoadWindow)
     {
-        cb();
+        // The loop has been in one iteration for a while, it is either
+        // waiting in the poller or stuck in a callback.
+        int activity = activity_.load(std::memory_order_relaxed);
+        return activity == kPolling || activity == kNotLooping ? 0 : 1;
     }
-    else
+    return recentLoad_.load(std::memory_order_relaxed) / 1000.0;
+}
+void EventLoop::enableStats()
+{
+    runInLoop([this]() {
+        if (statsPtr_)
+            return;
+        statsPtr_.reset(new EventLoopStats);
+        stats_.store(statsPtr_.get(), std::memory_order_release);
+    });
+}
+EventLoopStatsSnapshot EventLoop::getStats() const
+{
+    EventLoopStatsSnapshot snapshot;
+    auto stats = stats_.load(std::memory_order_acquire);
+    if (stats)
+        snapshot = stats->snapshot();
+    snapshot.wakeups = wakeupCount();
+    if (timerQueue_)
     {
-        queueInLoop(std::move(cb));
+        snapshot.timerArms = timerQueue_->arms();
+        snapshot.timerArmsSaved = timerQueue_->armsSaved();
     }
+    return snapshot;
+}
+void EventLoop::disableBusyPolling()
+{
+    runInLoop([this]() { maxSpinTime_ = std::chrono::microseconds(0); });
+}
+void EventLoop::abortNotInLoopThread()
+{
+    LOG_FATAL << "It is forbidden to run loop on threads other than event-loop "
+                 "thread";
+    exit(1);
 }
-void EventLoop::queueInLoop(const Func &cb)
+void EventLoop::queueInLoop(Task &&cb)
 {
-    funcs_.enqueue(cb);
+    if (boundedFuncs_)
+        enqueueFunc(std::move(cb));
+    else
+        funcs_.enqueue(std::move(cb));
     if (!isInLoopThread() || !looping_)
     {
         wakeup();
     }
 }
-void EventLoop::queueInLoop(Func &&cb)
+void EventLoop::queueInLoopBatch(std::vector<Task> &&funcs)
 {
-    funcs_.enqueue(std::move(cb));
-    if (!isInLoopThread() || !looping_)
+    if (funcs.empty())
+        return;
+    if (funcs.size() == 1)
     {
+        queueInLoop(std::move(funcs[0]));
+        funcs.clear();
+        return;
+    }
+    // The vector fits in the inline storage of the task.
+    queueInLoop([funcs = std::move(funcs)]() {
+        for (auto &func : funcs)
+        {
+            func();
+        }
+    });
+}
+void EventLoop::enqueueFunc(Task &&cb)
+{
+    if (isInLoopThread())
+    {
+        // The loop thread can't wait for itself to make room in the ring.
+        localFuncs_.push_back(std::move(cb));
+        return;
+    }
+    while (!boundedFuncs_->enqueue(std::move(cb)))
+    {
+        // The ring is full, let the loop catch up.
         wakeup();
+        std::this_thread::yield();
     }
 }
-
-TimerId EventLoop::runAt(const Date &time, const Func &cb)
+bool EventLoop::funcsEmpty()
 {
-    auto microSeconds =
-        time.microSecondsSinceEpoch() - Date::now().microSecondsSinceEpoch();
-    std::chrono::steady_clock::time_point tp =
-        std::chrono::steady_clock::now() +
-        std::chrono::microseconds(microSeconds);
-    return timerQueue_->addTimer(cb, tp, std::chrono::microseconds(0));
+    return funcs_.empty() &&
+           (!boundedFuncs_ ||
+            (boundedFuncs_->empty() && localFuncs_.empty()));
+}
+void EventLoop::enableBoundedQueue(size_t capacity)
+{
+    assert(!looping_);
+    assert(capacity > 0);
+    boundedFuncs_.reset(new BoundedMpscQueue<Task>(capacity));
 }
-TimerId EventLoop::runAt(const Date &time, Func &&cb)
+
+TimerId EventLoop::runAt(const Date &time, Task &&cb)
 {
     auto microSeconds =
         time.microSecondsSinceEpoch() - Date::now().microSecondsSinceEpoch();
@@ -253,54 +668,167 @@ TimerId EventLoop::runAt(const Date &time, Func &&cb)
                                  tp,
                                  std::chrono::microseconds(0));
 }
-TimerId EventLoop::runAfter(double delay, const Func &cb)
+TimerId EventLoop::runAt(const std::chrono::steady_clock::time_point &time,
+                         Task &&cb)
 {
-    return runAt(Date::date().after(delay), cb);
-}
-TimerId EventLoop::runAfter(double delay, Func &&cb)
-{
-    return runAt(Date::date().after(delay), std::move(cb));
+    return timerQueue_->addTimer(std::move(cb),
+                                 time,
+                                 std::chrono::steady_clock::duration::zero());
 }
-TimerId EventLoop::runEvery(double interval, const Func &cb)
+TimerId EventLoop::runAfter(double delay, Task &&cb)
 {
     std::chrono::microseconds dur(
-        static_cast<std::chrono::microseconds::rep>(interval * 1000000));
-    auto tp = std::chrono::steady_clock::now() + dur;
-    return timerQueue_->addTimer(cb, tp, dur);
+        static_cast<std::chrono::microseconds::rep>(delay * 1000000));
+    return timerQueue_->addTimer(std::move(cb),
+                                 std::chrono::steady_clock::now() + dur,
+                                 std::chrono::microseconds(0));
 }
-TimerId EventLoop::runEvery(double interval, Func &&cb)
+TimerId EventLoop::runEvery(double interval, Task &&cb)
 {
     std::chrono::microseconds dur(
         static_cast<std::chrono::microseconds::rep>(interval * 1000000));
     auto tp = std::chrono::steady_clock::now() + dur;
     return timerQueue_->addTimer(std::move(cb), tp, dur);
 }
+TimerId EventLoop::runEvery(const std::chrono::steady_clock::duration &interval,
+                            Task &&cb)
+{
+    assert(interval.count() > 0);
+    return timerQueue_->addTimer(std::move(cb),
+                                 std::chrono::steady_clock::now() + interval,
+                                 interval);
+}
+TimerId EventLoop::runAtFixedRate(
+    const std::chrono::steady_clock::duration &interval,
+    Task &&cb,
+    const std::chrono::steady_clock::duration &spin)
+{
+    assert(interval.count() > 0);
+    assert(spin.count() >= 0);
+    return timerQueue_->addTimer(std::move(cb),
+                                 std::chrono::steady_clock::now() + interval,
+                                 interval,
+                                 spin,
+                                 true);
+}
+void EventLoop::disableTimerfd()
+{
+#ifdef __linux__
+    runInLoop([this]() {
+        timerfdEnabled_ = false;
+        timerQueue_->disableTimerfd();
+    });
+#endif
+}
+void EventLoop::setTimerSlack(const std::chrono::microseconds &slack)
+{
+    runInLoop([this, slack]() { timerQueue_->setSlack(slack); });
+}
 void EventLoop::invalidateTimer(TimerId id)
 {
-    if (isRunning() && timerQueue_)
+    // The timer queue is safe to use from any thread, before the loop runs
+    // too.
+    if (timerQueue_)
         timerQueue_->invalidateTimer(id);
 }
-void EventLoop::doRunInLoopFuncs()
+size_t EventLoop::doRunInLoopFuncs()
 {
     callingFuncs_ = true;
+    // Functions queued from now on need a new wakeup. This synchronizes with
+    // the producers that saw a pending wakeup, so their functions are visible
+    // below.
+    wakeupPending_.exchange(false, std::memory_order_acq_rel);
+    if (!iterationHooks_.empty())
+        runIterationHooks();
+    size_t count = 0;
     {
-        // the destructor for the Func may itself insert a new entry into the
+        auto call = [](Task &&func) { func(); };
+        // the destructor for the Task may itself insert a new entry into the
         // queue
-        while (!funcs_.empty())
+        while (!funcsEmpty())
         {
-            Func func;
-            while (funcs_.dequeue(func))
+            count += funcs_.dequeueAll(call);
+            if (boundedFuncs_)
             {
-                func();
+                count += boundedFuncs_->dequeueAll(call);
+                if (!localFuncs_.empty())
+                {
+                    // Keep the capacity of both vectors to avoid allocating.
+                    runningFuncs_.swap(localFuncs_);
+                    for (auto &func : runningFuncs_)
+                    {
+                        func();
+                    }
+                    count += runningFuncs_.size();
+                    runningFuncs_.clear();
+                }
             }
         }
     }
     callingFuncs_ = false;
+    return count;
+}
+uint64_t EventLoop::addIterationHook(std::function<void()> hook)
+{
+    assertInLoopThread();
+    iterationHooks_.emplace_back(
+        ++nextHookId_, std::unique_ptr<std::function<void()>>(
+                           new std::function<void()>(std::move(hook))));
+    return nextHookId_;
+}
+void EventLoop::removeIterationHook(uint64_t id)
+{
+    assertInLoopThread();
+    for (auto iter = iterationHooks_.begin(); iter != iterationHooks_.end();
+         ++iter)
+    {
+        if (iter->first != id)
+            continue;
+        if (callingHooks_)
+        {
+            // The hook may be running, erase it after the hooks are called.
+            iter->first = 0;
+            hooksRemoved_ = true;
+        }
+        else
+        {
+            iterationHooks_.erase(iter);
+        }
+        return;
+    }
+}
+void EventLoop::runIterationHooks()
+{
+    callingHooks_ = true;
+    // Hooks added by hooks are called from the next iteration on.
+    for (size_t i = 0, n = iterationHooks_.size(); i < n; ++i)
+    {
+        if (iterationHooks_[i].first == 0)
+            continue;
+        auto hook = iterationHooks_[i].second.get();
+        (*hook)();
+    }
+    callingHooks_ = false;
+    if (hooksRemoved_)
+    {
+        hooksRemoved_ = false;
+        iterationHooks_.erase(
+            std::remove_if(iterationHooks_.begin(),
+                           iterationHooks_.end(),
+                           [](const decltype(iterationHooks_)::value_type
+                                  &hook) { return hook.first == 0; }),
+            iterationHooks_.end());
+    }
 }
 void EventLoop::wakeup()
 {
     // if (!looping_)
     //     return;
+    // A burst of functions queued before the loop handles them needs only
+    // one write.
+    if (wakeupPending_.exchange(true, std::memory_order_acq_rel))
+        return;
+    wakeupCount_.fetch_add(1, std::memory_order_relaxed);
     uint64_t tmp = 1;
 #ifdef __linux__
     write(wakeupFd_, &tmp, sizeof(tmp));
@@ -19,8 +19,11 @@
 #include <trantor/utils/NonCopyable.h>
 #include <trantor/utils/Date.h>
 #include <trantor/utils/LockFreeQueue.h>
+#include <trantor/utils/Task.h>
+#include <trantor/net/EventLoopStats.h>
 #include <trantor/exports.h>
 #include <thread>
+#include <atomic>
 #include <memory>
 #include <vector>
 #include <mutex>
@@ -28,6 +31,9 @@
 #include <functional>
 #include <chrono>
 #include <limits>
+#ifndef _WIN32
+#include <pthread.h>
+#endif
 
 namespace trantor
 {
@@ -117,12 +123,23 @@ class TRANTOR_EXPORT EventLoop : NonCopyable
     /**
      * @brief Run the function f in the thread of the event loop.
      *
-     * @param f
+     * @param f Any callable object, including std::function objects and
+     * move-only lambdas.
      * @note If the current thread is the thread of the event loop, the function
      * f is executed directly before the method exiting.
      */
-    void runInLoop(const Func &f);
-    void runInLoop(Func &&f);
+    template <typename F>
+    void runInLoop(F &&f)
+    {
+        if (isInLoopThread())
+        {
+            f();
+        }
+        else
+        {
+            queueInLoop(std::forward<F>(f));
+        }
+    }
 
     /**
      * @brief Run the function f in the thread of the event loop.
@@ -132,8 +149,17 @@ class TRANTOR_EXPORT EventLoop : NonCopyable
      * that the function f is executed after the method exiting no matter if the
      * current thread is the thread of the event loop.
      */
-    void queueInLoop(const Func &f);
-    void queueInLoop(Func &&f);
+    void queueInLoop(Task &&f);
+
+    /**
+     * @brief Queue some functions as one entry of the queue of the loop, with
+     * at most one wakeup. The functions are run in order in the thread of the
+     * loop.
+     *
+     * @param funcs The functions, the vector is moved away.
+     * @note The functions are counted as one in the statistics of the loop.
+     */
+    void queueInLoopBatch(std::vector<Task> &&funcs);
 
     /**
      * @brief Run a function at a time point.
@@ -142,8 +168,17 @@ class TRANTOR_EXPORT EventLoop : NonCopyable
      * @param cb The function to run.
      * @return TimerId The ID of the timer.
      */
-    TimerId runAt(const Date &time, const Func &cb);
-    TimerId runAt(const Date &time, Func &&cb);
+    TimerId runAt(const Date &time, Task &&cb);
+
+    /**
+     * @brief Run a function at a time point of the steady clock.
+     *
+     * @param time The time to run the function.
+     * @param cb The function to run.
+     * @return TimerId The ID of the timer.
+     */
+    TimerId runAt(const std::chrono::steady_clock::time_point &time,
+                  Task &&cb);
 
     /**
      * @brief Run a function after a period of time.
@@ -152,8 +187,7 @@ class TRANTOR_EXPORT EventLoop : NonCopyable
      * @param cb The function to run.
      * @return TimerId The ID of the timer.
      */
-    TimerId runAfter(double delay, const Func &cb);
-    TimerId runAfter(double delay, Func &&cb);
+    TimerId runAfter(double delay, Task &&cb);
 
     /**
      * @brief Run a function after a period of time.
@@ -162,16 +196,18 @@ class TRANTOR_EXPORT EventLoop : NonCopyable
      * @code
        runAfter(5s, task);
        runAfter(10min, task);
+       runAfter(250us, task);
        @endcode
+     * Integer durations are kept exact, without floating-point arithmetic.
      */
-    TimerId runAfter(const std::chrono::duration<long double> &delay,
-                     const Func &cb)
-    {
-        return runAfter(delay.count(), cb);
-    }
-    TimerId runAfter(const std::chrono::duration<long double> &delay, Func &&cb)
+    template <typename Rep, typename Period>
+    TimerId runAfter(const std::chrono::duration<Rep, Period> &delay,
+                     Task &&cb)
     {
-        return runAfter(delay.count(), std::move(cb));
+        return runAt(std::chrono::steady_clock::now() +
+                         std::chrono::duration_cast<
+                             std::chrono::steady_clock::duration>(delay),
+                     std::move(cb));
     }
 
     /**
@@ -181,8 +217,7 @@ class TRANTOR_EXPORT EventLoop : NonCopyable
      * @param cb The function to run.
      * @return TimerId The ID of the timer.
      */
-    TimerId runEvery(double interval, const Func &cb);
-    TimerId runEvery(double interval, Func &&cb);
+    TimerId runEvery(double interval, Task &&cb);
 
     /**
      * @brief Repeatedly run a function every period of time.
@@ -194,16 +229,40 @@ class TRANTOR_EXPORT EventLoop : NonCopyable
        runEvery(0.1h, task);
        @endcode
      */
-    TimerId runEvery(const std::chrono::duration<long double> &interval,
-                     const Func &cb)
+    template <typename Rep, typename Period>
+    TimerId runEvery(const std::chrono::duration<Rep, Period> &interval,
+                     Task &&cb)
     {
-        return runEvery(interval.count(), cb);
-    }
-    TimerId runEvery(const std::chrono::duration<long double> &interval,
-                     Func &&cb)
-    {
-        return runEvery(interval.count(), std::move(cb));
+        return runEvery(
+            std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                interval),
+            std::move(cb));
     }
+    TimerId runEvery(const std::chrono::steady_clock::duration &interval,
+                     Task &&cb);
+
+    /**
+     * @brief Repeatedly run a function at a fixed rate. The n-th run is
+     * scheduled at the first one plus n intervals rather than one interval
+     * after the previous run, so the timer doesn't drift when the runs are
+     * late. Runs missed while the loop was blocked for more than an interval
+     * are skipped, the next run keeps the phase of the timer.
+     *
+     * @param interval The interval, an integer duration.
+     * @param cb The function to run.
+     * @param spin If positive, the loop wakes up this much before each run and
+     * busy-waits for the deadline, which gives a precision finer than the
+     * wakeup latency of the thread. The loop doesn't handle other events
+     * while it spins, so the spin should be short, e.g. 20 to 100 us.
+     * @return TimerId The ID of the timer.
+     * @note The timer slack of the loop (see setTimerSlack()) doesn't apply
+     * while the loop has such timers.
+     */
+    TimerId runAtFixedRate(
+        const std::chrono::steady_clock::duration &interval,
+        Task &&cb,
+        const std::chrono::steady_clock::duration &spin =
+            std::chrono::steady_clock::duration::zero());
 
     /**
      * @brief Invalidate the timer identified by the given ID.
@@ -212,6 +271,33 @@ class TRANTOR_EXPORT EventLoop : NonCopyable
      */
     void invalidateTimer(TimerId id);
 
+    /**
+     * @brief Let the timers of the loop fire up to the given slack after their
+     * deadlines, zero by default. A new earliest timer only re-arms the
+     * timerfd if it is earlier than the armed deadline by more than the slack,
+     * which saves a syscall per timer when many timeouts are set a few
+     * microseconds apart, and the timers whose deadlines are within the slack
+     * of the earliest one fire in the same wakeup.
+     *
+     * @param slack
+     * @note Timers never fire before their deadlines. The number of re-arms
+     * saved is in the statistics of the loop, see getStats().
+     */
+    void setTimerSlack(const std::chrono::microseconds &slack);
+
+    /**
+     * @brief Run the timers of the loop without a timerfd. The loop waits in
+     * the poller until the earliest deadline, with the nanosecond timeout of
+     * epoll_pwait2() or io_uring, and runs the expired timers after each
+     * poll, which saves the read() of the timerfd and the timerfd_settime()
+     * of each re-arm.
+     *
+     * @note Before Linux 5.11, the epoll poller rounds the timeout up to
+     * milliseconds. On other systems than Linux, the timers always work this
+     * way and this method has no effect.
+     */
+    void disableTimerfd();
+
     /**
      * @brief Move the EventLoop to the current thread, this method must be
      * called before the loop is running.
@@ -223,6 +309,9 @@ class TRANTOR_EXPORT EventLoop : NonCopyable
      * @brief Update channel status. This method is usually used internally.
      *
      * @param chl
+     * @note While the loop is running, the update is recorded and applied to
+     * the poller once before the next poll, so several updates of the same
+     * channel in one iteration cost at most one call to the poller.
      */
     void updateChannel(Channel *chl);
 
@@ -234,6 +323,15 @@ class TRANTOR_EXPORT EventLoop : NonCopyable
      */
     void removeChannel(Channel *chl);
 
+    /**
+     * @brief Handle the deferred events of a channel in the next iteration of
+     * the loop. This method is usually used internally, see
+     * Channel::deferEvents().
+     *
+     * @param chl
+     */
+    void deferChannel(Channel *chl);
+
     /**
      * @brief Return the index of the event loop.
      *
@@ -276,9 +374,270 @@ class TRANTOR_EXPORT EventLoop : NonCopyable
         return callingFuncs_;
     }
 
+    /**
+     * @brief Put the functions queued by runInLoop() and queueInLoop() into a
+     * bounded ring buffer instead of the unbounded queue. The ring never
+     * allocates memory, and producers in other threads wait for free space
+     * when it is full, which bounds the memory used by a loop that can't keep
+     * up. Functions queued in the loop thread never wait, they are kept in a
+     * local queue of the loop.
+     *
+     * @param capacity The capacity of the ring, rounded up to a power of 2.
+     * @note This method must be called before the loop runs and before any
+     * function is queued from other threads. A thread that waits for free
+     * space must not be one that the loop waits for.
+     */
+    void enableBoundedQueue(size_t capacity);
+
+    /**
+     * @brief Return the number of times the loop was woken up to run queued
+     * functions. Functions queued while a wakeup is pending don't wake the
+     * loop again, so this is usually much smaller than the number of
+     * functions queued from other threads.
+     *
+     * @return size_t
+     */
+    size_t wakeupCount() const
+    {
+        return wakeupCount_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Enable the busy polling mode. Before blocking in the poller, the
+     * loop polls without waiting and checks the queue of functions for a
+     * while, which saves the cost of the thread sleeping and being woken up
+     * when the next event comes soon. The spin time adapts to the observed
+     * idle time between events: it is about twice the average idle time, and
+     * it drops to zero when the average idle time exceeds the maximum. The
+     * spin never runs past the deadline of the next timer.
+     *
+     * @param maxSpinTime The maximum time to spin before blocking.
+     * @note This trades CPU time for latency, it is only useful when the loop
+     * thread has a CPU core of its own.
+     */
+    void enableBusyPolling(
+        const std::chrono::microseconds &maxSpinTime =
+            std::chrono::microseconds(200));
+
+    /**
+     * @brief Disable the busy polling mode.
+     *
+     */
+    void disableBusyPolling();
+
+    /**
+     * @brief Set the time budget for handling the events of an iteration. When
+     * handling the events takes longer, the events of the remaining channels
+     * of the kBulk class are deferred to the next iteration, so that a burst
+     * on bulk channels doesn't delay the channels of higher classes for long.
+     * At least one bulk channel is handled in each iteration.
+     *
+     * @param budget The time budget, zero (the default) disables the deferral.
+     * @note Only the channels of the kBulk class are deferred, see
+     * Channel::setPriority().
+     */
+    void setIterationBudget(const std::chrono::microseconds &budget);
+
+    /**
+     * @brief Return the number of times the events of a bulk channel were
+     * deferred to the next iteration because the time budget of an iteration
+     * was exceeded.
+     *
+     * @return size_t
+     */
+    size_t deferredBulkChannels() const
+    {
+        return deferredBulkChannels_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Set the I/O budget of an iteration for the connections of the
+     * loop. When the bytes read and written or the message callbacks called
+     * for the connections in an iteration reach the budget, the I/O events of
+     * the remaining connections are deferred to the next iteration.
+     *
+     * @param maxBytes The maximum number of bytes per iteration, zero means no
+     * limit.
+     * @param maxCallbacks The maximum number of message callbacks per
+     * iteration, zero means no limit.
+     * @note See TcpConnection::setIoBudget() for the budget of a single
+     * connection.
+     */
+    void setIoBudget(size_t maxBytes, size_t maxCallbacks = 0);
+
+    /**
+     * @brief Check whether the I/O budget of the current iteration is left.
+     * This method is usually used internally.
+     *
+     * @return true
+     * @return false
+     */
+    bool hasIoBudget() const
+    {
+        return (maxIoBytes_ == 0 || ioBytes_ < maxIoBytes_) &&
+               (maxIoCallbacks_ == 0 || ioCallbacks_ < maxIoCallbacks_);
+    }
+
+    /**
+     * @brief Return the number of bytes left in the I/O budget of the current
+     * iteration. This method is usually used internally.
+     *
+     * @return size_t
+     */
+    size_t ioBytesLeft() const
+    {
+        if (maxIoBytes_ == 0)
+            return std::numeric_limits<size_t>::max();
+        return ioBytes_ < maxIoBytes_ ? maxIoBytes_ - ioBytes_ : 0;
+    }
+
+    /**
+     * @brief Charge the I/O of a connection to the budget of the current
+     * iteration. This method is usually used internally.
+     *
+     * @param bytes The number of bytes read or written.
+     * @param callbacks The number of message callbacks called.
+     */
+    void consumeIoBudget(size_t bytes, size_t callbacks)
+    {
+        ioBytes_ += bytes;
+        ioCallbacks_ += callbacks;
+    }
+
+    /**
+     * @brief Return the number of iterations the loop has run.
+     *
+     * @return uint64_t
+     */
+    uint64_t iteration() const
+    {
+        return iteration_;
+    }
+
+    /**
+     * @brief Enable the statistics of the loop: the number of iterations, the
+     * histograms of the time spent in the poller, in handling the events of
+     * channels, in running queued functions and timers, the number of active
+     * channels per poll and the number of queued functions run per iteration.
+     * When the statistics are disabled, they cost one predictable branch at
+     * each point they would be recorded.
+     *
+     * @note The statistics can't be disabled once enabled.
+     */
+    void enableStats();
+
+    /**
+     * @brief Take a snapshot of the statistics of the loop. This method can be
+     * called in any thread, it doesn't lock or block the loop.
+     *
+     * @return EventLoopStatsSnapshot All the histograms are empty if the
+     * statistics are not enabled, the number of wakeups is always counted.
+     */
+    EventLoopStatsSnapshot getStats() const;
+
+    /**
+     * @brief Return the statistics object of the loop, or nullptr if the
+     * statistics are not enabled. This method is usually used internally.
+     *
+     * @return EventLoopStats*
+     */
+    EventLoopStats *stats() const
+    {
+        return stats_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Enable the tracking of the recent load of the loop, see
+     * recentLoad(). It costs two clock readings per iteration.
+     */
+    void enableLoadTracking();
+
+    /**
+     * @brief Return the fraction of time the loop was busy, out of the poller,
+     * in the last window of about 100 ms. This method can be called in any
+     * thread.
+     *
+     * @return double A value in [0, 1], always 0 if the load tracking is not
+     * enabled.
+     */
+    double recentLoad() const;
+
+    /**
+     * @brief Return the number of connections of TcpServer objects handled by
+     * the loop. This method can be called in any thread.
+     *
+     * @return size_t
+     */
+    size_t connectionCount() const
+    {
+        return connectionCount_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Change the number of connections handled by the loop. This
+     * method is usually used internally, it can be called in any thread.
+     *
+     * @param delta
+     */
+    void addConnectionCount(long delta)
+    {
+        connectionCount_.fetch_add(static_cast<size_t>(delta),
+                                   std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Wake up the loop if it is waiting in the poller. The wakeups are
+     * coalesced until the loop runs its iteration hooks and queued functions.
+     * This method is usually used internally, by the producers of the queues
+     * drained by iteration hooks.
+     */
+    void wakeup();
+
+    /**
+     * @brief Add a function which the loop calls once in each iteration,
+     * before the queued functions. It is usually used internally to drain
+     * queues filled by other threads, which call wakeup() after filling them.
+     *
+     * @param hook The function, it must not block.
+     * @return uint64_t The id of the hook.
+     * @note This method must be called in the thread of the loop.
+     */
+    uint64_t addIterationHook(std::function<void()> hook);
+
+    /**
+     * @brief Remove an iteration hook. A hook can remove itself.
+     *
+     * @param id The id returned by addIterationHook().
+     * @note This method must be called in the thread of the loop.
+     */
+    void removeIterationHook(uint64_t id);
+
+    /**
+     * @brief Return the number of channel updates that were not passed to the
+     * poller because they were coalesced with other updates of the same
+     * channel in one iteration. With epoll, each one is an epoll_ctl() call
+     * saved.
+     *
+     * @return size_t
+     */
+    size_t savedChannelUpdates() const
+    {
+        return savedChannelUpdates_.load(std::memory_order_relaxed);
+    }
+
   private:
+    friend class EventLoopWatchdog;
+    friend class TimerQueue;
+    // What the loop is doing, published for EventLoopWatchdog.
+    enum Activity
+    {
+        kNotLooping = 0,
+        kPolling,
+        kHandlingEvents,
+        kCallingFuncs,
+        kRunningTimers
+    };
     void abortNotInLoopThread();
-    void wakeup();
     void wakeupRead();
     bool looping_;
     std::thread::id threadId_;
@@ -286,12 +645,63 @@ class TRANTOR_EXPORT EventLoop : NonCopyable
     std::unique_ptr<Poller> poller_;
 
     ChannelList activeChannels_;
+    ChannelList deferredChannels_;
+    ChannelList dirtyChannels_;
+    ChannelList sortedChannels_;
+    std::chrono::microseconds iterationBudget_{0};
+    uint64_t iteration_{0};
+    size_t maxIoBytes_{0};
+    size_t maxIoCallbacks_{0};
+    size_t ioBytes_{0};
+    size_t ioCallbacks_{0};
+    std::atomic<size_t> deferredBulkChannels_{0};
+    std::atomic<EventLoopStats *> stats_{nullptr};
+    std::unique_ptr<EventLoopStats> statsPtr_;
+    std::atomic<size_t> savedChannelUpdates_{0};
+    std::atomic<size_t> connectionCount_{0};
+    bool trackLoad_{false};
+    std::chrono::steady_clock::time_point loadWindowStart_;
+    std::chrono::steady_clock::duration loadWindowBusy_{0};
+    // The recent load in 1/1000, and the time it was computed, in nanoseconds
+    // of the steady clock.
+    std::atomic<uint32_t> recentLoad_{0};
+    std::atomic<int64_t> loadUpdateTime_{0};
+    std::chrono::microseconds maxSpinTime_{0};
+    std::chrono::microseconds spinTime_{0};
+    std::chrono::microseconds avgIdleTime_{0};
+    int spinMisses_{0};
+#ifdef __linux__
+    bool timerfdEnabled_{true};
+#endif
     Channel *currentActiveChannel_;
 
     bool eventHandling_;
-    MpscQueue<Func> funcs_;
+    MpscQueue<Task> funcs_;
+    std::unique_ptr<BoundedMpscQueue<Task>> boundedFuncs_;
+    std::vector<Task> localFuncs_;
+    std::vector<Task> runningFuncs_;
     std::unique_ptr<TimerQueue> timerQueue_;
     bool callingFuncs_{false};
+    // The hooks stay in place when hooks add other hooks.
+    std::vector<std::pair<uint64_t, std::unique_ptr<std::function<void()>>>>
+        iterationHooks_;
+    uint64_t nextHookId_{0};
+    bool callingHooks_{false};
+    bool hooksRemoved_{false};
+    // Written only by the loop thread and read by the watchdog thread.
+    std::atomic<uint64_t> heartbeat_{0};
+    std::atomic<int> activity_{kNotLooping};
+    std::atomic<int> activeFd_{-1};
+    // The timer being run, its deadline in nanoseconds of the steady clock
+    // and its interval in nanoseconds, published before the timer id.
+    std::atomic<TimerId> activeTimer_{InvalidTimerId};
+    std::atomic<int64_t> activeTimerWhen_{0};
+    std::atomic<int64_t> activeTimerInterval_{0};
+#ifndef _WIN32
+    pthread_t nativeThread_;
+#endif
+    std::atomic<bool> wakeupPending_{false};
+    std::atomic<size_t> wakeupCount_{0};
 #ifdef __linux__
     int wakeupFd_;
     std::unique_ptr<Channel> wakeupChannelPtr_;
@@ -301,7 +711,17 @@ class TRANTOR_EXPORT EventLoop : NonCopyable
     std::unique_ptr<Channel> wakeupChannelPtr_;
 #endif
 
-    void doRunInLoopFuncs();
+    size_t doRunInLoopFuncs();
+    void runIterationHooks();
+    void updateLoad(std::chrono::steady_clock::time_point busyStart);
+    void enqueueFunc(Task &&f);
+    bool funcsEmpty();
+    void addDeferredChannels();
+    void sortActiveChannels();
+    void handleActiveChannels(EventLoopStats *stats);
+    void applyChannelUpdate(Channel *chl);
+    void pollWithSpinning(int64_t timeoutNs);
+    void flushChannelUpdates();
 #ifdef _WIN32
     size_t index_{size_t(-1)};
 #else
@@ -0,0 +1,104 @@
+/**
+ *
+ *  EventLoopStats.cc
+ *  An Tao
+ *
+ *  Public header file in trantor lib.
+ *
+ *  Copyright 2018, An Tao.  All rights reserved.
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the License file.
+ *
+ *
+ */
+
+#include <trantor/net/EventLoopStats.h>
+#include <algorithm>
+
+using namespace trantor;
+
+double HistogramSnapshot::mean() const
+{
+    if (count == 0)
+        return 0;
+    return static_cast<double>(sum) / count;
+}
+
+uint64_t HistogramSnapshot::percentile(double p) const
+{
+    if (count == 0)
+        return 0;
+    p = std::min(std::max(p, 0.0), 1.0);
+    // The rank of the percentile, counted from 1.
+    uint64_t rank = static_cast<uint64_t>(p * (count - 1)) + 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kBuckets; ++i)
+    {
+        seen += buckets[i];
+        if (seen >= rank)
+        {
+            if (i == 0)
+                return 0;
+            if (i == kBuckets - 1 || i >= 64)
+                return max;
+            // The largest value in the bucket.
+            uint64_t upper = (static_cast<uint64_t>(1) << i) - 1;
+            return std::min(upper, max);
+        }
+    }
+    return max;
+}
+
+HistogramSnapshot &HistogramSnapshot::operator+=(const HistogramSnapshot &other)
+{
+    count += other.count;
+    sum += other.sum;
+    max = std::max(max, other.max);
+    for (size_t i = 0; i < kBuckets; ++i)
+    {
+        buckets[i] += other.buckets[i];
+    }
+    return *this;
+}
+
+EventLoopStatsSnapshot &EventLoopStatsSnapshot::operator+=(
+    const EventLoopStatsSnapshot &other)
+{
+    iterations += other.iterations;
+    wakeups += other.wakeups;
+    timerArms += other.timerArms;
+    timerArmsSaved += other.timerArmsSaved;
+    pollTime += other.pollTime;
+    handleEventTime += other.handleEventTime;
+    funcsTime += other.funcsTime;
+    timersTime += other.timersTime;
+    activeChannels += other.activeChannels;
+    funcsQueueDepth += other.funcsQueueDepth;
+    return *this;
+}
+
+HistogramSnapshot EventLoopStats::Histogram::snapshot() const
+{
+    HistogramSnapshot snapshot;
+    snapshot.count = count_.load(std::memory_order_relaxed);
+    snapshot.sum = sum_.load(std::memory_order_relaxed);
+    snapshot.max = max_.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < HistogramSnapshot::kBuckets; ++i)
+    {
+        snapshot.buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+    }
+    return snapshot;
+}
+
+EventLoopStatsSnapshot EventLoopStats::snapshot() const
+{
+    EventLoopStatsSnapshot snapshot;
+    snapshot.iterations = iterations_.load(std::memory_order_relaxed);
+    snapshot.pollTime = pollTime_.snapshot();
+    snapshot.handleEventTime = handleEventTime_.snapshot();
+    snapshot.funcsTime = funcsTime_.snapshot();
+    snapshot.timersTime = timersTime_.snapshot();
+    snapshot.activeChannels = activeChannels_.snapshot();
+    snapshot.funcsQueueDepth = funcsQueueDepth_.snapshot();
+    return snapshot;
+}
@@ -0,0 +1,175 @@
+/**
+ *
+ *  @file EventLoopStats.h
+ *  @author An Tao
+ *
+ *  Public header file in trantor lib.
+ *
+ *  Copyright 2018, An Tao.  All rights reserved.
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the License file.
+ *
+ *
+ */
+
+#pragma once
+
+#include <trantor/utils/NonCopyable.h>
+#include <trantor/exports.h>
+#include <atomic>
+#include <chrono>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace trantor
+{
+/**
+ * @brief A copy of a histogram with power-of-two buckets. The bucket i counts
+ * the values in [2^(i-1), 2^i), the bucket 0 counts zeros and the last bucket
+ * counts all the larger values.
+ */
+struct TRANTOR_EXPORT HistogramSnapshot
+{
+    static constexpr size_t kBuckets = 40;
+    uint64_t count{0};
+    uint64_t sum{0};
+    uint64_t max{0};
+    uint64_t buckets[kBuckets] = {};
+
+    /**
+     * @brief Return the mean of the values, or 0 if there is no value.
+     */
+    double mean() const;
+
+    /**
+     * @brief Return an upper bound of the given percentile of the values.
+     *
+     * @param p The percentile in [0, 1], e.g. 0.99.
+     * @return uint64_t The upper end of the bucket which contains the
+     * percentile, not more than the maximum value.
+     */
+    uint64_t percentile(double p) const;
+
+    HistogramSnapshot &operator+=(const HistogramSnapshot &other);
+};
+
+/**
+ * @brief A copy of the statistics of an event loop, or the sum of those of
+ * several loops. The times are in nanoseconds.
+ */
+struct TRANTOR_EXPORT EventLoopStatsSnapshot
+{
+    // The number of iterations of the loop.
+    uint64_t iterations{0};
+    // The number of times the loop was woken up by other threads.
+    uint64_t wakeups{0};
+    // The number of times the timerfd was armed, and the number of new
+    // earliest timers which didn't re-arm it thanks to the timer slack, see
+    // EventLoop::setTimerSlack(). Both are zero on other systems than Linux.
+    uint64_t timerArms{0};
+    uint64_t timerArmsSaved{0};
+    // The time spent in the poller, including the time waiting for events.
+    HistogramSnapshot pollTime;
+    // The time spent in handling the events of each channel.
+    HistogramSnapshot handleEventTime;
+    // The time spent in running the queued functions in an iteration.
+    HistogramSnapshot funcsTime;
+    // The time spent in running the expired timers at once. On Linux, timers
+    // run in the event handler of the timerfd channel, so this time is also
+    // counted in handleEventTime.
+    HistogramSnapshot timersTime;
+    // The number of active channels returned by each poll.
+    HistogramSnapshot activeChannels;
+    // The number of queued functions run in an iteration.
+    HistogramSnapshot funcsQueueDepth;
+
+    EventLoopStatsSnapshot &operator+=(const EventLoopStatsSnapshot &other);
+};
+
+/**
+ * @brief This class holds the statistics of an event loop, see
+ * EventLoop::enableStats(). It is only written by the thread of the loop, and
+ * any thread can take a snapshot without locking.
+ */
+class TRANTOR_EXPORT EventLoopStats : NonCopyable
+{
+  public:
+    /**
+     * @brief A histogram with power-of-two buckets. It has a single writer,
+     * so the counters are updated without read-modify-write operations.
+     */
+    class TRANTOR_EXPORT Histogram : NonCopyable
+    {
+      public:
+        Histogram()
+        {
+            for (auto &bucket : buckets_)
+                bucket.store(0, std::memory_order_relaxed);
+        }
+        void record(uint64_t value)
+        {
+            add(count_, 1);
+            add(sum_, value);
+            if (value > max_.load(std::memory_order_relaxed))
+                max_.store(value, std::memory_order_relaxed);
+            add(buckets_[bucketOf(value)], 1);
+        }
+        void recordDuration(std::chrono::steady_clock::duration duration)
+        {
+            auto ns =
+                std::chrono::duration_cast<std::chrono::nanoseconds>(duration)
+                    .count();
+            record(ns > 0 ? static_cast<uint64_t>(ns) : 0);
+        }
+        HistogramSnapshot snapshot() const;
+
+      private:
+        static void add(std::atomic<uint64_t> &counter, uint64_t value)
+        {
+            counter.store(counter.load(std::memory_order_relaxed) + value,
+                          std::memory_order_relaxed);
+        }
+        static size_t bucketOf(uint64_t value)
+        {
+            if (value == 0)
+                return 0;
+#if defined(__GNUC__) || defined(__clang__)
+            size_t bucket = 64 - __builtin_clzll(value);
+#else
+            size_t bucket = 0;
+            while (value != 0)
+            {
+                value >>= 1;
+                ++bucket;
+            }
+#endif
+            return bucket < HistogramSnapshot::kBuckets
+                       ? bucket
+                       : HistogramSnapshot::kBuckets - 1;
+        }
+        std::atomic<uint64_t> count_{0};
+        std::atomic<uint64_t> sum_{0};
+        std::atomic<uint64_t> max_{0};
+        std::atomic<uint64_t> buckets_[HistogramSnapshot::kBuckets];
+    };
+
+    /**
+     * @brief Take a snapshot of the statistics. The counters are read one by
+     * one, so a snapshot taken while the loop is running may mix values from
+     * slightly different moments.
+     */
+    EventLoopStatsSnapshot snapshot() const;
+
+  private:
+    friend class EventLoop;
+    friend class TimerQueue;
+    std::atomic<uint64_t> iterations_{0};
+    Histogram pollTime_;
+    Histogram handleEventTime_;
+    Histogram funcsTime_;
+    Histogram timersTime_;
+    Histogram activeChannels_;
+    Histogram funcsQueueDepth_;
+};
+
+}  // namespace trantor
@@ -13,6 +13,9 @@
  */
 
 #include <trantor/net/EventLoopThreadPool.h>
+#include <algorithm>
+#include <atomic>
+#include <string>
 using namespace trantor;
 EventLoopThreadPool::EventLoopThreadPool(size_t threadNum,
                                          const std::string &name)
@@ -47,14 +50,118 @@ EventLoop *EventLoopThreadPool::getNextLoop()
 {
     if (loopThreadVector_.size() > 0)
     {
-        EventLoop *loop = loopThreadVector_[loopIndex_]->getLoop();
-        ++loopIndex_;
-        if (loopIndex_ >= loopThreadVector_.size())
-            loopIndex_ = 0;
-        return loop;
+        size_t index = loopIndex_.fetch_add(1, std::memory_order_relaxed);
+        return loopThreadVector_[index % loopThreadVector_.size()]->getLoop();
     }
     return nullptr;
 }
+EventLoop *EventLoopThreadPool::selectLoop(const InetAddress &peer)
+{
+    if (loopThreadVector_.empty())
+        return nullptr;
+    size_t index;
+    if (selector_)
+    {
+        index = selector_(peer) % loopThreadVector_.size();
+    }
+    else
+    {
+        switch (selection_)
+        {
+            case LoopSelection::kLeastConnections:
+                index = leastLoadedLoop(false);
+                break;
+            case LoopSelection::kLeastLoad:
+                index = leastLoadedLoop(true);
+                break;
+            case LoopSelection::kConsistentHash:
+                index = hashedLoop(peer);
+                break;
+            default:
+                return getNextLoop();
+        }
+    }
+    return loopThreadVector_[index]->getLoop();
+}
+size_t EventLoopThreadPool::leastLoadedLoop(bool byLoad)
+{
+    // Start from a different loop each time, so that ties are spread.
+    size_t size = loopThreadVector_.size();
+    size_t start = loopIndex_.fetch_add(1, std::memory_order_relaxed) % size;
+    size_t best = start;
+    double bestLoad = 0;
+    size_t bestConnections = 0;
+    for (size_t i = 0; i < size; ++i)
+    {
+        size_t index = (start + i) % size;
+        auto loop = loopThreadVector_[index]->getLoop();
+        double load = byLoad ? loop->recentLoad() : 0;
+        size_t connections = loop->connectionCount();
+        // Loads within 5% are considered equal.
+        if (i == 0 || load < bestLoad - 0.05 ||
+            (load <= bestLoad + 0.05 && connections < bestConnections))
+        {
+            best = index;
+            bestLoad = load;
+            bestConnections = connections;
+        }
+    }
+    return best;
+}
+static uint32_t fnv1a(const char *data, size_t len, uint32_t hash = 2166136261u)
+{
+    for (size_t i = 0; i < len; ++i)
+    {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 16777619u;
+    }
+    // Mix the bits, FNV alone spreads short keys poorly over the ring.
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    return hash;
+}
+size_t EventLoopThreadPool::hashedLoop(const InetAddress &peer) const
+{
+    auto ip = peer.toIp();
+    uint32_t hash = fnv1a(ip.data(), ip.size());
+    auto iter = std::lower_bound(hashRing_.begin(),
+                                 hashRing_.end(),
+                                 std::make_pair(hash, size_t(0)));
+    if (iter == hashRing_.end())
+        iter = hashRing_.begin();
+    return iter->second;
+}
+void EventLoopThreadPool::setLoopSelection(LoopSelection selection)
+{
+    selection_ = selection;
+    selector_ = nullptr;
+    hashRing_.clear();
+    if (selection == LoopSelection::kLeastLoad)
+    {
+        for (auto &loopThread : loopThreadVector_)
+            loopThread->getLoop()->enableLoadTracking();
+    }
+    else if (selection == LoopSelection::kConsistentHash)
+    {
+        // Many points per loop even out the parts of the ring, and adding a
+        // loop only moves the peers of the parts it takes.
+        const size_t kPoints = 160;
+        for (size_t i = 0; i < loopThreadVector_.size(); ++i)
+        {
+            for (size_t point = 0; point < kPoints; ++point)
+            {
+                auto key = std::to_string(i) + "#" + std::to_string(point);
+                hashRing_.emplace_back(fnv1a(key.data(), key.size()), i);
+            }
+        }
+        std::sort(hashRing_.begin(), hashRing_.end());
+    }
+}
+void EventLoopThreadPool::setLoopSelector(LoopSelector selector)
+{
+    selector_ = std::move(selector);
+}
 EventLoop *EventLoopThreadPool::getLoop(size_t id)
 {
     if (id < loopThreadVector_.size())
@@ -69,4 +176,80 @@ std::vector<EventLoop *> EventLoopThreadPool::getLoops() const
         ret.push_back(loopThread->getLoop());
     }
     return ret;
-}
\ No newline at end of file
+}
+void EventLoopThreadPool::runOnAllLoops(std::function<void()> func,
+                                        std::function<void()> completion)
+{
+    if (loopThreadVector_.empty())
+    {
+        if (completion)
+            completion();
+        return;
+    }
+    struct FanOut
+    {
+        std::function<void()> func;
+        std::function<void()> completion;
+        std::atomic<size_t> remaining;
+    };
+    auto fanOut = std::make_shared<FanOut>();
+    fanOut->func = std::move(func);
+    fanOut->completion = std::move(completion);
+    fanOut->remaining.store(loopThreadVector_.size(),
+                            std::memory_order_relaxed);
+    for (auto &loopThread : loopThreadVector_)
+    {
+        loopThread->getLoop()->runInLoop([fanOut]() {
+            if (fanOut->func)
+                fanOut->func();
+            if (fanOut->remaining.fetch_sub(1, std::memory_order_acq_rel) ==
+                    1 &&
+                fanOut->completion)
+                fanOut->completion();
+        });
+    }
+}
+void EventLoopThreadPool::setCpuAffinity(const CpuAffinity &affinity)
+{
+    affinity_ = affinity;
+    cpuLoops_.clear();
+    for (size_t i = 0; i < loopThreadVector_.size(); ++i)
+    {
+        for (auto cpu : affinity.cpusOf(i))
+        {
+            if (cpu < 0)
+                continue;
+            if (static_cast<size_t>(cpu) >= cpuLoops_.size())
+                cpuLoops_.resize(cpu + 1, -1);
+            if (cpuLoops_[cpu] < 0)
+                cpuLoops_[cpu] = static_cast<int>(i);
+        }
+    }
+    for (size_t i = 0; i < loopThreadVector_.size(); ++i)
+    {
+        loopThreadVector_[i]->getLoop()->runInLoop(
+            [affinity, i]() { affinity.apply(i); });
+    }
+}
+int EventLoopThreadPool::loopOfCpu(int cpu) const
+{
+    if (cpu < 0 || static_cast<size_t>(cpu) >= cpuLoops_.size())
+        return -1;
+    return cpuLoops_[cpu];
+}
+void EventLoopThreadPool::enableStats()
+{
+    for (auto &loopThread : loopThreadVector_)
+    {
+        loopThread->getLoop()->enableStats();
+    }
+}
+EventLoopStatsSnapshot EventLoopThreadPool::getStats() const
+{
+    EventLoopStatsSnapshot snapshot;
+    for (auto &loopThread : loopThreadVector_)
+    {
+        snapshot += loopThread->getLoop()->getStats();
+    }
+    return snapshot;
+}
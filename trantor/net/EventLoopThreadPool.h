@@ -15,12 +15,40 @@
 #pragma once
 
 #include <trantor/net/EventLoopThread.h>
+#include <trantor/net/InetAddress.h>
+#include <trantor/utils/CpuAffinity.h>
 #include <trantor/exports.h>
+#include <atomic>
+#include <functional>
 #include <vector>
 #include <memory>
+#include <utility>
 
 namespace trantor
 {
+/**
+ * @brief The strategies to select an event loop for a new connection.
+ */
+enum class LoopSelection
+{
+    // Each loop in turn.
+    kRoundRobin = 0,
+    // The loop with the fewest connections, see EventLoop::connectionCount().
+    kLeastConnections,
+    // The loop which was the least busy recently, see
+    // EventLoop::recentLoad().
+    kLeastLoad,
+    // A loop chosen by a consistent hash of the peer IP, so that a client
+    // stays on the same loop.
+    kConsistentHash
+};
+
+/**
+ * @brief A custom strategy, it returns the index of the loop in the pool for
+ * a connection from the peer. It may be called in several threads at once.
+ */
+using LoopSelector = std::function<size_t(const InetAddress &peer)>;
+
 /**
  * @brief This class represents a pool of EventLoopThread objects
  *
@@ -63,12 +91,40 @@ class TRANTOR_EXPORT EventLoopThreadPool : NonCopyable
     }
 
     /**
-     * @brief Get the next event loop in the pool.
+     * @brief Get the next event loop in the pool. This method can be called
+     * in several threads at once.
      *
      * @return EventLoop*
      */
     EventLoop *getNextLoop();
 
+    /**
+     * @brief Select an event loop for a connection from the peer with the
+     * strategy of the pool. This method can be called in several threads at
+     * once.
+     *
+     * @param peer
+     * @return EventLoop* nullptr if the pool is empty.
+     */
+    EventLoop *selectLoop(const InetAddress &peer);
+
+    /**
+     * @brief Set the strategy of selectLoop(), the default is round-robin.
+     *
+     * @param selection
+     * @note This method must not be called while selectLoop() may be running.
+     * The kLeastLoad strategy enables the load tracking of the loops.
+     */
+    void setLoopSelection(LoopSelection selection);
+
+    /**
+     * @brief Set a custom strategy of selectLoop().
+     *
+     * @param selector
+     * @note This method must not be called while selectLoop() may be running.
+     */
+    void setLoopSelector(LoopSelector selector);
+
     /**
      * @brief Get the event loop in the `id` position in the pool.
      *
@@ -85,8 +141,75 @@ class TRANTOR_EXPORT EventLoopThreadPool : NonCopyable
      */
     std::vector<EventLoop *> getLoops() const;
 
+    /**
+     * @brief Run a function in all event loops in the pool, and then a
+     * completion callback once all the loops have run it.
+     *
+     * @param func The function, it is shared by the loops.
+     * @param completion The callback, it is called in the thread of the last
+     * loop which runs the function, or in the current thread if the pool is
+     * empty.
+     * @note This method doesn't block the current thread.
+     */
+    void runOnAllLoops(std::function<void()> func,
+                       std::function<void()> completion = nullptr);
+
+    /**
+     * @brief Pin the threads of the event loops in the pool, the loop of the
+     * id i is the thread i of the affinity. Each loop pins its own thread, so
+     * this method can be called before or after start().
+     *
+     * @param affinity
+     */
+    void setCpuAffinity(const CpuAffinity &affinity);
+
+    /**
+     * @brief Return the affinity set by setCpuAffinity(), it is empty if the
+     * threads are not pinned.
+     *
+     * @return const CpuAffinity&
+     */
+    const CpuAffinity &cpuAffinity() const
+    {
+        return affinity_;
+    }
+
+    /**
+     * @brief Return the index of the loop whose thread is pinned to the CPU,
+     * or -1 if there is none. When several loops share the CPU, the first one
+     * is returned.
+     *
+     * @param cpu
+     * @return int
+     */
+    int loopOfCpu(int cpu) const;
+
+    /**
+     * @brief Enable the statistics of all event loops in the pool, see
+     * EventLoop::enableStats().
+     */
+    void enableStats();
+
+    /**
+     * @brief Return the sum of the statistics of all event loops in the pool.
+     * Use EventLoop::getStats() on each loop to find an overloaded one.
+     *
+     * @return EventLoopStatsSnapshot
+     */
+    EventLoopStatsSnapshot getStats() const;
+
   private:
+    size_t leastLoadedLoop(bool byLoad);
+    size_t hashedLoop(const InetAddress &peer) const;
+
     std::vector<std::shared_ptr<EventLoopThread>> loopThreadVector_;
-    size_t loopIndex_;
+    std::atomic<size_t> loopIndex_;
+    LoopSelection selection_{LoopSelection::kRoundRobin};
+    LoopSelector selector_;
+    // The points of the loops on the hash ring, sorted by hash.
+    std::vector<std::pair<uint32_t, size_t>> hashRing_;
+    CpuAffinity affinity_;
+    // The index of the loop pinned to each CPU, or -1.
+    std::vector<int> cpuLoops_;
 };
 }  // namespace trantor
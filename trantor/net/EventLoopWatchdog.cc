@@ -0,0 +1,335 @@
+/**
+ *
+ *  EventLoopWatchdog.cc
+ *  An Tao
+ *
+ *  Public header file in trantor lib.
+ *
+ *  Copyright 2018, An Tao.  All rights reserved.
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the License file.
+ *
+ *
+ */
+
+#include <trantor/net/EventLoopWatchdog.h>
+#include <trantor/utils/Logger.h>
+#include <algorithm>
+#include <assert.h>
+#include <stdio.h>
+#if defined(__linux__) && defined(__GLIBC__)
+#define TRANTOR_STACK_TRACE
+#include <execinfo.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#endif
+
+using namespace trantor;
+
+namespace
+{
+#ifdef TRANTOR_STACK_TRACE
+const int kMaxFrames = 64;
+void *g_frames[kMaxFrames];
+// The thread whose stack is requested, set before g_capturing.
+pthread_t g_target;
+std::atomic<bool> g_capturing{false};
+std::atomic<int> g_frameCount{0};
+// Only one stack is captured at a time, by any watchdog.
+std::mutex g_captureMutex;
+
+void captureStack(int)
+{
+    // Ignore the signal when it is not ours, e.g. out-of-band data.
+    if (!g_capturing.load(std::memory_order_acquire) ||
+        !pthread_equal(pthread_self(), g_target))
+        return;
+    int savedErrno = errno;
+    int count = ::backtrace(g_frames, kMaxFrames);
+    g_frameCount.store(count, std::memory_order_release);
+    g_capturing.store(false, std::memory_order_release);
+    errno = savedErrno;
+}
+
+void installStackHandler()
+{
+    static std::once_flag once;
+    std::call_once(once, []() {
+        // The first call of backtrace() loads libgcc, which is not safe in a
+        // signal handler.
+        void *frame;
+        ::backtrace(&frame, 1);
+        struct sigaction sa;
+        sa.sa_handler = captureStack;
+        sigemptyset(&sa.sa_mask);
+        sa.sa_flags = SA_RESTART;
+        if (sigaction(SIGURG, &sa, nullptr) < 0)
+            LOG_SYSERR << "EventLoopWatchdog: sigaction";
+    });
+}
+
+std::vector<std::string> stackOf(pthread_t thread)
+{
+    std::vector<std::string> stackTrace;
+    std::lock_guard<std::mutex> guard(g_captureMutex);
+    g_target = thread;
+    g_frameCount.store(0, std::memory_order_relaxed);
+    g_capturing.store(true, std::memory_order_release);
+    if (pthread_kill(thread, SIGURG) != 0)
+    {
+        g_capturing.store(false, std::memory_order_relaxed);
+        return stackTrace;
+    }
+    // The thread may be blocked in the kernel and unable to handle the signal
+    // for a while.
+    auto deadline =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+    while (g_capturing.load(std::memory_order_acquire) &&
+           std::chrono::steady_clock::now() < deadline)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (g_capturing.exchange(false, std::memory_order_acq_rel))
+        return stackTrace;
+    int count = g_frameCount.load(std::memory_order_acquire);
+    // Skip the frame of the signal handler.
+    if (count <= 1)
+        return stackTrace;
+    char **symbols = ::backtrace_symbols(g_frames + 1, count - 1);
+    if (!symbols)
+        return stackTrace;
+    for (int i = 0; i < count - 1; ++i)
+    {
+        stackTrace.emplace_back(symbols[i]);
+    }
+    free(symbols);
+    return stackTrace;
+}
+#endif
+}  // namespace
+
+EventLoopWatchdog::EventLoopWatchdog(const std::chrono::milliseconds &threshold,
+                                     bool captureStackTrace)
+    : threshold_(threshold), captureStackTrace_(captureStackTrace)
+{
+    assert(threshold_.count() > 0);
+#ifdef TRANTOR_STACK_TRACE
+    if (captureStackTrace_)
+        installStackHandler();
+#endif
+    thread_ = std::thread([this]() { run(); });
+}
+
+EventLoopWatchdog::~EventLoopWatchdog()
+{
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        stop_ = true;
+    }
+    cond_.notify_all();
+    thread_.join();
+}
+
+void EventLoopWatchdog::watch(EventLoop *loop)
+{
+    std::lock_guard<std::mutex> guard(mutex_);
+    WatchedLoop watched;
+    watched.loop = loop;
+    watched.heartbeat = loop->heartbeat_.load(std::memory_order_acquire);
+    watched.since = std::chrono::steady_clock::now();
+    watched.reported = false;
+    loops_.push_back(watched);
+}
+
+void EventLoopWatchdog::unwatch(EventLoop *loop)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    loops_.erase(std::remove_if(loops_.begin(),
+                                loops_.end(),
+                                [loop](const WatchedLoop &watched) {
+                                    return watched.loop == loop;
+                                }),
+                 loops_.end());
+    // The capture of the stack gives up after 100 ms.
+    while (capturing_ == loop)
+        captured_.wait_for(lock, std::chrono::milliseconds(10));
+}
+
+void EventLoopWatchdog::setStallCallback(const LoopStallCallback &cb)
+{
+    std::lock_guard<std::mutex> guard(mutex_);
+    stallCallback_ = cb;
+}
+
+void EventLoopWatchdog::run()
+{
+    // A stall is detected at most one interval after the threshold.
+    auto interval = std::max(threshold_ / 8, std::chrono::milliseconds(1));
+    std::vector<LoopStallReport> reports;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stop_)
+    {
+        cond_.wait_for(lock, interval);
+        if (stop_)
+            break;
+        check(reports);
+        if (reports.empty())
+            continue;
+        auto cb = stallCallback_;
+        // Capturing a stack takes up to 100 ms, and the callback may watch or
+        // unwatch loops.
+        lock.unlock();
+        for (auto &report : reports)
+        {
+            if (captureStackTrace_)
+                report.stackTrace = stackOfLoop(report.loop);
+            stalls_.fetch_add(1, std::memory_order_relaxed);
+            if (cb)
+                cb(report);
+            else
+                logStall(report);
+        }
+        reports.clear();
+        lock.lock();
+    }
+}
+
+void EventLoopWatchdog::check(std::vector<LoopStallReport> &reports)
+{
+    auto now = std::chrono::steady_clock::now();
+    for (auto &watched : loops_)
+    {
+        auto loop = watched.loop;
+        int activity = loop->activity_.load(std::memory_order_acquire);
+        uint64_t heartbeat = loop->heartbeat_.load(std::memory_order_relaxed);
+        if (activity == EventLoop::kNotLooping ||
+            activity == EventLoop::kPolling || heartbeat != watched.heartbeat)
+        {
+            watched.heartbeat = heartbeat;
+            watched.since = now;
+            watched.reported = false;
+            continue;
+        }
+        if (watched.reported || now - watched.since < threshold_)
+            continue;
+        watched.reported = true;
+        LoopStallReport report;
+        report.loop = loop;
+        report.loopIndex = loop->index();
+        report.duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+            now - watched.since);
+        report.activity = activityName(activity);
+        if (activity != EventLoop::kCallingFuncs)
+            report.fd = loop->activeFd_.load(std::memory_order_relaxed);
+        if (activity == EventLoop::kRunningTimers)
+            readActiveTimer(loop, report);
+        reports.push_back(std::move(report));
+    }
+}
+
+std::vector<std::string> EventLoopWatchdog::stackOfLoop(EventLoop *loop)
+{
+#ifdef TRANTOR_STACK_TRACE
+    pthread_t thread;
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        // The loop may have been unwatched since it was reported.
+        if (std::none_of(loops_.begin(),
+                         loops_.end(),
+                         [loop](const WatchedLoop &watched) {
+                             return watched.loop == loop;
+                         }))
+            return {};
+        thread = loop->nativeThread_;
+        capturing_ = loop;
+    }
+    auto stackTrace = stackOf(thread);
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        capturing_ = nullptr;
+    }
+    captured_.notify_all();
+    return stackTrace;
+#else
+    (void)loop;
+    return {};
+#endif
+}
+
+void EventLoopWatchdog::readActiveTimer(EventLoop *loop,
+                                        LoopStallReport &report)
+{
+    auto id = loop->activeTimer_.load(std::memory_order_acquire);
+    if (id == InvalidTimerId)
+        return;
+    auto when = loop->activeTimerWhen_.load(std::memory_order_relaxed);
+    auto interval = loop->activeTimerInterval_.load(std::memory_order_relaxed);
+    // The deadline and the interval belong to the id if it hasn't changed
+    // meanwhile, which is the case for a timer that really is stuck.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (loop->activeTimer_.load(std::memory_order_relaxed) != id)
+        return;
+    report.timerId = id;
+    report.timerDeadline = std::chrono::steady_clock::time_point(
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::nanoseconds(when)));
+    report.timerInterval = std::chrono::nanoseconds(interval);
+}
+
+const char *EventLoopWatchdog::activityName(int activity)
+{
+    switch (activity)
+    {
+        case EventLoop::kHandlingEvents:
+            return "handling events";
+        case EventLoop::kCallingFuncs:
+            return "calling queued functions";
+        case EventLoop::kRunningTimers:
+            return "running timers";
+        default:
+            return "";
+    }
+}
+
+void EventLoopWatchdog::logStall(const LoopStallReport &report)
+{
+    std::string stack;
+    for (auto &frame : report.stackTrace)
+    {
+        stack.append("\n    ");
+        stack.append(frame);
+    }
+    std::string timer;
+    if (report.timerId != InvalidTimerId)
+    {
+        auto late = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - report.timerDeadline);
+        timer = ", timer " + std::to_string(report.timerId) + " due " +
+                std::to_string(late.count()) + " ms ago";
+        if (report.timerInterval.count() > 0)
+        {
+            auto interval =
+                std::chrono::duration_cast<std::chrono::milliseconds>(
+                    report.timerInterval);
+            timer += " every " + std::to_string(interval.count()) + " ms";
+        }
+    }
+    std::string loop;
+    if (report.loopIndex != size_t(-1))
+    {
+        loop = std::to_string(report.loopIndex);
+    }
+    else
+    {
+        // No index was set for the loop.
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%p", static_cast<void *>(report.loop));
+        loop = buf;
+    }
+    LOG_WARN << "EventLoop " << loop << " is stuck for "
+             << report.duration.count() << " ms " << report.activity
+             << (report.fd >= 0 ? " of fd " + std::to_string(report.fd)
+                                : std::string())
+             << timer << stack;
+}
@@ -0,0 +1,155 @@
+/**
+ *
+ *  @file EventLoopWatchdog.h
+ *  @author An Tao
+ *
+ *  Public header file in trantor lib.
+ *
+ *  Copyright 2018, An Tao.  All rights reserved.
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the License file.
+ *
+ *
+ */
+
+#pragma once
+
+#include <trantor/net/EventLoop.h>
+#include <trantor/utils/NonCopyable.h>
+#include <trantor/exports.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace trantor
+{
+/**
+ * @brief The report of an event loop that stays out of its poller for longer
+ * than the threshold of the watchdog.
+ */
+struct LoopStallReport
+{
+    // The loop and its index, see EventLoop::index().
+    EventLoop *loop{nullptr};
+    size_t loopIndex{0};
+    // How long the loop has been stuck when it is reported, this is a lower
+    // bound, up to one check interval shorter than the real stall.
+    std::chrono::milliseconds duration{0};
+    // "handling events", "calling queued functions" or "running timers".
+    const char *activity{""};
+    // The file descriptor of the channel whose events are handled, or -1.
+    int fd{-1};
+    // When the loop is running timers, the timer being run, its deadline and
+    // its interval (zero if it runs once). InvalidTimerId otherwise.
+    TimerId timerId{InvalidTimerId};
+    std::chrono::steady_clock::time_point timerDeadline;
+    std::chrono::nanoseconds timerInterval{0};
+    // The stack of the loop thread, empty if it could not be captured.
+    std::vector<std::string> stackTrace;
+};
+
+using LoopStallCallback = std::function<void(const LoopStallReport &)>;
+
+/**
+ * @brief This class watches some event loops in its own thread and reports
+ * each loop that doesn't get back to its poller within a threshold, e.g.
+ * because a callback blocks on a synchronous DNS lookup or disk read. Each
+ * stall is reported once, by default with LOG_WARN.
+ *
+ * The loops publish a heartbeat each time they leave the poller and what they
+ * are doing, which costs a few relaxed stores per iteration whether they are
+ * watched or not.
+ *
+ * @note On Linux with glibc, the stack of a stalled loop thread is captured
+ * by sending it SIGURG, and the watchdog installs a handler for that signal
+ * when it is constructed with stack traces enabled. Don't enable them if the
+ * application uses SIGURG for out-of-band data.
+ */
+class TRANTOR_EXPORT EventLoopWatchdog : NonCopyable
+{
+  public:
+    /**
+     * @brief Construct a new watchdog and start its thread.
+     *
+     * @param threshold The time a loop can stay out of its poller before it is
+     * reported.
+     * @param captureStackTrace Capture the stack of the stalled loop thread
+     * when it is supported.
+     */
+    explicit EventLoopWatchdog(
+        const std::chrono::milliseconds &threshold =
+            std::chrono::milliseconds(1000),
+        bool captureStackTrace = true);
+    ~EventLoopWatchdog();
+
+    /**
+     * @brief Watch an event loop. The loop must be unwatched or outlive the
+     * watchdog.
+     *
+     * @param loop
+     */
+    void watch(EventLoop *loop);
+
+    /**
+     * @brief Stop watching an event loop. When this method returns, the
+     * watchdog doesn't access the loop anymore, it may wait for the stack of
+     * the loop thread being captured.
+     *
+     * @param loop
+     */
+    void unwatch(EventLoop *loop);
+
+    /**
+     * @brief Set the callback which is called in the thread of the watchdog
+     * for each stall, instead of logging it.
+     *
+     * @param cb
+     */
+    void setStallCallback(const LoopStallCallback &cb);
+
+    /**
+     * @brief Return the number of stalls reported.
+     *
+     * @return size_t
+     */
+    size_t stalls() const
+    {
+        return stalls_.load(std::memory_order_relaxed);
+    }
+
+  private:
+    struct WatchedLoop
+    {
+        EventLoop *loop;
+        uint64_t heartbeat;
+        std::chrono::steady_clock::time_point since;
+        bool reported;
+    };
+    void run();
+    void check(std::vector<LoopStallReport> &reports);
+    std::vector<std::string> stackOfLoop(EventLoop *loop);
+    static void readActiveTimer(EventLoop *loop, LoopStallReport &report);
+    static const char *activityName(int activity);
+    static void logStall(const LoopStallReport &report);
+
+    const std::chrono::milliseconds threshold_;
+    const bool captureStackTrace_;
+    std::vector<WatchedLoop> loops_;
+    LoopStallCallback stallCallback_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    // The loop whose stack is captured without the lock, unwatch() waits for
+    // the capture to finish.
+    EventLoop *capturing_{nullptr};
+    std::condition_variable captured_;
+    bool stop_{false};
+    std::atomic<size_t> stalls_{0};
+    std::thread thread_;
+};
+
+}  // namespace trantor
@@ -0,0 +1,260 @@
+/**
+ *
+ *  @file LoopChannels.h
+ *  @author An Tao
+ *
+ *  Public header file in trantor lib.
+ *
+ *  Copyright 2018, An Tao.  All rights reserved.
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the License file.
+ *
+ *
+ */
+
+#pragma once
+
+#include <trantor/net/EventLoopThreadPool.h>
+#include <trantor/utils/LockFreeQueue.h>
+#include <trantor/utils/NonCopyable.h>
+#include <assert.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace trantor
+{
+/**
+ * @brief This class template represents a mesh of single producer single
+ * consumer rings between every pair of a group of event loops, to pass
+ * messages from loop to loop without the contention of queueInLoop() and with
+ * at most one wakeup per iteration of the receiving loop. Each loop drains
+ * its inbound rings once per iteration, before its queued functions.
+ *
+ * @tparam T The type of the messages. Use Task to send functions, with a
+ * handler which calls them.
+ * @note The messages must be sent in the threads of the loops.
+ */
+template <typename T>
+class LoopChannels : NonCopyable
+{
+  public:
+    /**
+     * @brief The handler is called in the thread of the receiving loop, with
+     * the index of the sending loop.
+     */
+    using MessageHandler = std::function<void(size_t from, T &&message)>;
+
+    /**
+     * @brief Construct a new mesh between the given loops.
+     *
+     * @param loops The loops, the index of a loop is its position.
+     * @param capacity The capacity of each ring.
+     * @param handler
+     */
+    LoopChannels(const std::vector<EventLoop *> &loops,
+                 size_t capacity,
+                 MessageHandler handler)
+        : loops_(loops), mesh_(std::make_shared<Mesh>())
+    {
+        const size_t n = loops_.size();
+        mesh_->size = n;
+        mesh_->handler = std::move(handler);
+        mesh_->rings.resize(n * n);
+        mesh_->hookIds.resize(n, 0);
+        for (size_t from = 0; from < n; ++from)
+        {
+            for (size_t to = 0; to < n; ++to)
+            {
+                if (from != to)
+                    mesh_->rings[to * n + from].reset(
+                        new SpscQueue<T>(capacity));
+            }
+        }
+        for (size_t to = 0; to < n; ++to)
+        {
+            auto mesh = mesh_;
+            auto loop = loops_[to];
+            loop->runInLoop([mesh, loop, to]() {
+                if (mesh->closed.load(std::memory_order_acquire))
+                    return;
+                mesh->hookIds[to] = loop->addIterationHook([mesh, loop, to]() {
+                    if (!mesh->drain(to))
+                        loop->wakeup();
+                });
+                // Drain the messages sent before the hook was added.
+                loop->wakeup();
+            });
+        }
+    }
+
+    /**
+     * @brief Construct a new mesh between the loops of a started pool.
+     */
+    LoopChannels(EventLoopThreadPool &pool,
+                 size_t capacity,
+                 MessageHandler handler)
+        : LoopChannels(pool.getLoops(), capacity, std::move(handler))
+    {
+    }
+
+    /**
+     * @brief The loops stop draining the rings once they run the removal of
+     * their hooks, until then the handler may still be called. The loops must
+     * outlive this object.
+     */
+    ~LoopChannels()
+    {
+        mesh_->closed.store(true, std::memory_order_release);
+        for (size_t to = 0; to < loops_.size(); ++to)
+        {
+            auto mesh = mesh_;
+            auto loop = loops_[to];
+            loop->runInLoop([mesh, loop, to]() {
+                if (mesh->hookIds[to] != 0)
+                    loop->removeIterationHook(mesh->hookIds[to]);
+                mesh->hookIds[to] = 0;
+            });
+        }
+    }
+
+    /**
+     * @brief Send a message from the loop of the current thread to a loop.
+     *
+     * @param to The index of the receiving loop.
+     * @param message
+     * @return false if the ring to the loop is full, the message is left
+     * untouched then. A message to the current loop is handled at once.
+     */
+    bool send(size_t to, T &&message)
+    {
+        size_t from = currentIndex();
+        assert(to < mesh_->size);
+        if (from == to)
+        {
+            mesh_->handler(from, std::move(message));
+            return true;
+        }
+        if (!mesh_->ring(from, to)->enqueue(std::move(message)))
+            return false;
+        loops_[to]->wakeup();
+        return true;
+    }
+
+    /**
+     * @brief Send some messages from the loop of the current thread to a loop
+     * with one wakeup.
+     *
+     * @param to The index of the receiving loop.
+     * @param messages The messages sent are erased from the front of the
+     * vector, those left didn't fit in the ring.
+     * @return size_t The number of messages sent.
+     */
+    size_t send(size_t to, std::vector<T> &messages)
+    {
+        size_t from = currentIndex();
+        assert(to < mesh_->size);
+        size_t count = 0;
+        if (from == to)
+        {
+            for (auto &message : messages)
+                mesh_->handler(from, std::move(message));
+            count = messages.size();
+        }
+        else
+        {
+            auto ring = mesh_->ring(from, to);
+            while (count < messages.size() &&
+                   ring->enqueue(std::move(messages[count])))
+            {
+                ++count;
+            }
+            if (count > 0)
+                loops_[to]->wakeup();
+        }
+        messages.erase(messages.begin(), messages.begin() + count);
+        return count;
+    }
+
+    /**
+     * @brief Return the index of the loop of the current thread in the mesh.
+     * The current thread must be the thread of one of the loops.
+     *
+     * @return size_t
+     */
+    size_t currentIndex() const
+    {
+        // The index is cached in each thread for the last mesh it used, so
+        // the loops are only scanned when a thread switches between meshes.
+        thread_local uint64_t cachedMesh = 0;
+        thread_local size_t cachedIndex = 0;
+        if (cachedMesh == mesh_->id)
+            return cachedIndex;
+        auto loop = EventLoop::getEventLoopOfCurrentThread();
+        size_t i = 0;
+        while (i < loops_.size() && loops_[i] != loop)
+            ++i;
+        assert(i < loops_.size());
+        cachedMesh = mesh_->id;
+        cachedIndex = i;
+        return i;
+    }
+
+    /**
+     * @brief Return the number of loops in the mesh.
+     */
+    size_t size() const
+    {
+        return loops_.size();
+    }
+
+  private:
+    // Shared with the iteration hooks, which may run after the destruction of
+    // the LoopChannels object.
+    struct Mesh
+    {
+        static uint64_t newId()
+        {
+            static std::atomic<uint64_t> lastId{0};
+            return lastId.fetch_add(1, std::memory_order_relaxed) + 1;
+        }
+        SpscQueue<T> *ring(size_t from, size_t to)
+        {
+            return rings[to * size + from].get();
+        }
+        // Return false if some messages are left for the next iteration.
+        bool drain(size_t to)
+        {
+            bool drained = true;
+            for (size_t from = 0; from < size; ++from)
+            {
+                if (from == to)
+                    continue;
+                auto r = ring(from, to);
+                r->dequeueAll([this, from](T &&message) {
+                    handler(from, std::move(message));
+                });
+                if (!r->empty())
+                    drained = false;
+            }
+            return drained;
+        }
+        // Unique among the meshes of the same message type, unlike the
+        // address of the mesh.
+        const uint64_t id{newId()};
+        size_t size{0};
+        MessageHandler handler;
+        // The ring from i to j is at j * size + i, so that the inbound rings
+        // of a loop are together.
+        std::vector<std::unique_ptr<SpscQueue<T>>> rings;
+        // Only accessed in the thread of each loop.
+        std::vector<uint64_t> hookIds;
+        std::atomic<bool> closed{false};
+    };
+
+    std::vector<EventLoop *> loops_;
+    std::shared_ptr<Mesh> mesh_;
+};
+
+}  // namespace trantor
@@ -61,8 +61,10 @@ TcpClient::TcpClient(EventLoop *loop,
       connectionCallback_(defaultConnectionCallback),
       messageCallback_(defaultMessageCallback),
       retry_(false),
-      connect_(true)
+      connect_(true),
+      handle_(std::make_shared<Handle>())
 {
+    handle_->client = this;
     connector_->setNewConnectionCallback(
         std::bind(&TcpClient::newConnection, this, _1));
     connector_->setErrorCallback([this]() {
@@ -77,6 +79,12 @@ TcpClient::TcpClient(EventLoop *loop,
 TcpClient::~TcpClient()
 {
     LOG_TRACE << "TcpClient::~TcpClient[" << name_ << "] - connector ";
+    {
+        // Wait for a callback of the connection running in the loop, the
+        // next ones don't reach the client.
+        std::lock_guard<std::mutex> lock(handle_->mutex);
+        handle_->client = nullptr;
+    }
     TcpConnectionImplPtr conn;
     {
         std::lock_guard<std::mutex> lock(mutex_);
@@ -85,16 +93,6 @@ TcpClient::~TcpClient()
     if (conn)
     {
         assert(loop_ == conn->getLoop());
-        // TODO: not 100% safe, if we are in different thread
-        auto loop = loop_;
-        loop_->runInLoop([conn, loop]() {
-            conn->setCloseCallback([loop](const TcpConnectionPtr &connPtr) {
-                loop->queueInLoop([connPtr]() {
-                    static_cast<TcpConnectionImpl *>(connPtr.get())
-                        ->connectDestroyed();
-                });
-            });
-        });
         conn->forceClose();
     }
     else
@@ -163,18 +161,42 @@ void TcpClient::newConnection(int sockfd)
                                                    localAddr,
                                                    peerAddr);
     }
+    if (maxBytesPerEvent_ > 0)
+    {
+        conn->enableEdgeTriggered(maxBytesPerEvent_);
+    }
     conn->setConnectionCallback(connectionCallback_);
     conn->setRecvMsgCallback(messageCallback_);
     conn->setWriteCompleteCallback(writeCompleteCallback_);
-    conn->setCloseCallback(std::bind(&TcpClient::removeConnection, this, _1));
+    auto handle = handle_;
+    conn->setCloseCallback([handle](const TcpConnectionPtr &connPtr) {
+        std::lock_guard<std::mutex> lock(handle->mutex);
+        if (handle->client)
+        {
+            handle->client->removeConnection(connPtr);
+            return;
+        }
+        // The client is destroyed, only the connection is left to destroy.
+        connPtr->getLoop()->queueInLoop([connPtr]() {
+            static_cast<TcpConnectionImpl *>(connPtr.get())
+                ->connectDestroyed();
+        });
+    });
     {
         std::lock_guard<std::mutex> lock(mutex_);
         connection_ = conn;
     }
-    conn->setSSLErrorCallback([this](SSLError err) {
-        if (sslErrorCallback_)
+    conn->setSSLErrorCallback([handle](SSLError err) {
+        SSLErrorCallback callback;
+        {
+            std::lock_guard<std::mutex> lock(handle->mutex);
+            if (handle->client)
+                callback = handle->client->sslErrorCallback_;
+        }
+        // The callback may destroy the client.
+        if (callback)
         {
-            sslErrorCallback_(err);
+            callback(err);
         }
     });
     conn->connectEstablished();
@@ -204,6 +204,22 @@ class TRANTOR_EXPORT TcpClient : NonCopyable
                    bool validateCert = true,
                    std::string hostname = "");
 
+    /**
+     * @brief Use the edge-triggered mode for the socket of the connection.
+     * Each read or write event is then handled until the socket would block.
+     *
+     * @param maxBytesPerEvent The maximum number of bytes read or written per
+     * event, the rest is handled in the next iteration of the event loop.
+     * @note Encrypted connections always use the level-triggered mode. This
+     * method must be called before connecting to the server. On Windows it has
+     * no effect.
+     */
+    void enableEdgeTriggered(size_t maxBytesPerEvent = 256 * 1024)
+    {
+        assert(maxBytesPerEvent > 0);
+        maxBytesPerEvent_ = maxBytesPerEvent;
+    }
+
   private:
     /// Not thread safe, but in loop
     void newConnection(int sockfd);
@@ -226,6 +242,15 @@ class TRANTOR_EXPORT TcpClient : NonCopyable
     std::shared_ptr<SSLContext> sslCtxPtr_;
     bool validateCert_{false};
     std::string SSLHostName_;
+    std::atomic<size_t> maxBytesPerEvent_{0};
+    // The callbacks of the connection reach the client through this, the
+    // destructor clears it while they may run in the loop thread.
+    struct Handle
+    {
+        std::mutex mutex;
+        TcpClient *client;
+    };
+    std::shared_ptr<Handle> handle_;
 #ifndef _WIN32
     class IgnoreSigPipe
     {
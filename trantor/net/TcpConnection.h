@@ -245,6 +245,84 @@ class TRANTOR_EXPORT TcpConnection
     virtual void startServerEncryption(const std::shared_ptr<SSLContext> &ctx,
                                        std::function<void()> callback) = 0;
 
+    /**
+     * @brief Set the priority class of the connection. In each iteration, the
+     * event loop handles the I/O events of connections of higher classes
+     * first, and it may defer the events of bulk connections to the next
+     * iteration, see EventLoop::setIterationBudget().
+     *
+     * @param priority
+     * @note The default implementation does nothing.
+     */
+    virtual void setPriority(ChannelPriority priority)
+    {
+        (void)priority;
+    }
+
+    /**
+     * @brief Set the I/O budget of the connection for an iteration of its
+     * event loop. When the connection has read and written the given number
+     * of bytes or called the message callback the given number of times in
+     * an iteration, the rest of its I/O is deferred to the next iteration, so
+     * that a fast peer can't monopolize the loop.
+     *
+     * @param maxBytes The maximum number of bytes per iteration, zero means no
+     * limit.
+     * @param maxCallbacks The maximum number of message callbacks per
+     * iteration, zero means no limit.
+     * @note The budget applies to the I/O done when handling the events of the
+     * socket, data sent directly by the send() methods is not deferred. See
+     * EventLoop::setIoBudget() for the budget shared by all the connections
+     * of a loop. Encrypted connections are not limited. The default
+     * implementation does nothing.
+     */
+    virtual void setIoBudget(size_t maxBytes, size_t maxCallbacks = 0)
+    {
+        (void)maxBytes;
+        (void)maxCallbacks;
+    }
+
+    /**
+     * @brief Return the number of bytes read and written when handling the
+     * events of the connection in the last iteration of the event loop in
+     * which it was served.
+     *
+     * @return size_t
+     * @note Any thread may call this method. The default implementation
+     * returns 0.
+     */
+    virtual size_t lastIterationBytes() const
+    {
+        return 0;
+    }
+
+    /**
+     * @brief Return the maximum number of bytes read and written when
+     * handling the events of the connection in one iteration of the event
+     * loop.
+     *
+     * @return size_t
+     * @note Any thread may call this method. The default implementation
+     * returns 0.
+     */
+    virtual size_t maxIterationBytes() const
+    {
+        return 0;
+    }
+
+    /**
+     * @brief Return the number of times the I/O of the connection was
+     * deferred to the next iteration because a budget was used up.
+     *
+     * @return size_t
+     * @note Any thread may call this method. The default implementation
+     * returns 0.
+     */
+    virtual size_t budgetDeferrals() const
+    {
+        return 0;
+    }
+
   protected:
     bool validateCert_ = false;
 
@@ -16,7 +16,9 @@
 #include "inner/TcpConnectionImpl.h"
 #include <trantor/net/TcpServer.h>
 #include <trantor/utils/Logger.h>
+#include <atomic>
 #include <functional>
+#include <future>
 #include <vector>
 using namespace trantor;
 using namespace std::placeholders;
@@ -29,6 +31,7 @@ TcpServer::TcpServer(EventLoop *loop,
     : loop_(loop),
       acceptorPtr_(new Acceptor(loop, address, reUseAddr, reUsePort)),
       serverName_(name),
+      reUsePort_(reUsePort),
       recvMessageCallback_([](const TcpConnectionPtr &, MsgBuffer *buffer) {
           LOG_ERROR << "unhandled recv message [" << buffer->readableBytes()
                     << " bytes]";
@@ -36,7 +39,7 @@ TcpServer::TcpServer(EventLoop *loop,
       })
 {
     acceptorPtr_->setNewConnectionCallback(
-        std::bind(&TcpServer::newConnection, this, _1, _2));
+        std::bind(&TcpServer::newConnection, this, _1, _2, -1));
 }
 
 TcpServer::~TcpServer()
@@ -45,7 +48,7 @@ TcpServer::~TcpServer()
     LOG_TRACE << "TcpServer::~TcpServer [" << serverName_ << "] destructing";
 }
 
-void TcpServer::newConnection(int sockfd, const InetAddress &peer)
+void TcpServer::newConnection(int sockfd, const InetAddress &peer, int cpu)
 {
     LOG_TRACE << "new connection:fd=" << sockfd
               << " address=" << peer.toIpPort();
@@ -60,10 +63,50 @@ void TcpServer::newConnection(int sockfd, const InetAddress &peer)
     EventLoop *ioLoop = NULL;
     if (loopPoolPtr_ && loopPoolPtr_->size() > 0)
     {
-        ioLoop = loopPoolPtr_->getNextLoop();
+        int index = loopPoolPtr_->loopOfCpu(cpu);
+        if (index >= 0)
+            ioLoop = loopPoolPtr_->getLoop(index);
+        else
+            ioLoop = loopPoolPtr_->selectLoop(peer);
     }
     if (ioLoop == NULL)
         ioLoop = loop_;
+    // The connection is counted at once for the selection of the next loop,
+    // it is created and registered in its own loop.
+    ioLoop->addConnectionCount(1);
+    ioLoop->runInLoop([this, ioLoop, sockfd, peer]() {
+        establishConnection(ioLoop, sockfd, peer);
+    });
+}
+
+void TcpServer::establishConnection(EventLoop *ioLoop,
+                                    int sockfd,
+                                    const InetAddress &peer)
+{
+    ioLoop->assertInLoopThread();
+    auto &shard = loopShards_.find(ioLoop)->second;
+    if (shard.stopped)
+    {
+        // Accepted just before the server stopped.
+        ioLoop->addConnectionCount(-1);
+#ifndef _WIN32
+        ::close(sockfd);
+#else
+        closesocket(sockfd);
+#endif
+        return;
+    }
+    auto newPtr = createConnection(ioLoop, sockfd, peer);
+    newPtr->setCloseCallback(std::bind(&TcpServer::connectionClosed, this, _1));
+    shard.connections.insert(newPtr);
+    newPtr->connectEstablished();
+}
+
+std::shared_ptr<TcpConnectionImpl> TcpServer::createConnection(
+    EventLoop *ioLoop,
+    int sockfd,
+    const InetAddress &peer)
+{
     std::shared_ptr<TcpConnectionImpl> newPtr;
     if (sslCtxPtr_)
     {
@@ -87,8 +130,20 @@ void TcpServer::newConnection(int sockfd, const InetAddress &peer)
 
     if (idleTimeout_ > 0)
     {
-        assert(timingWheelMap_[ioLoop]);
-        newPtr->enableKickingOff(idleTimeout_, timingWheelMap_[ioLoop]);
+        // The wheels are created before the acceptors listen, and the map is
+        // not changed until the server stops.
+        auto iter = timingWheelMap_.find(ioLoop);
+        assert(iter != timingWheelMap_.end());
+        newPtr->enableKickingOff(idleTimeout_, iter->second);
+    }
+    if (maxBytesPerEvent_ > 0)
+    {
+        newPtr->enableEdgeTriggered(maxBytesPerEvent_);
+    }
+    if (connectionBudgetBytes_ > 0 || connectionBudgetCallbacks_ > 0)
+    {
+        newPtr->setIoBudget(connectionBudgetBytes_,
+                            connectionBudgetCallbacks_);
     }
     newPtr->setRecvMsgCallback(recvMessageCallback_);
 
@@ -102,9 +157,7 @@ void TcpServer::newConnection(int sockfd, const InetAddress &peer)
             if (writeCompleteCallback_)
                 writeCompleteCallback_(connectionPtr);
         });
-    newPtr->setCloseCallback(std::bind(&TcpServer::connectionClosed, this, _1));
-    connSet_.insert(newPtr);
-    newPtr->connectEstablished();
+    return newPtr;
 }
 
 void TcpServer::start()
@@ -140,41 +193,161 @@ void TcpServer::start()
             }
         }
         LOG_TRACE << "map size=" << timingWheelMap_.size();
+        if (incomingCpuPlacement_ &&
+            (!loopPoolPtr_ || loopPoolPtr_->cpuAffinity().empty()))
+        {
+            LOG_WARN << "The I/O loops are not pinned, the connections are "
+                        "not placed by their CPU";
+            incomingCpuPlacement_ = false;
+        }
+        if (loopPoolPtr_ && loopPoolPtr_->size() > 0)
+        {
+            for (auto ioLoop : loopPoolPtr_->getLoops())
+                loopShards_[ioLoop];
+        }
+        else
+        {
+            loopShards_[loop_];
+        }
+        acceptorPtr_->setMaxAcceptsPerWakeup(maxAcceptsPerWakeup_);
+        if (acceptorPerLoop_)
+        {
+            startLoopAcceptors();
+            return;
+        }
+        if (incomingCpuPlacement_)
+        {
+            acceptorPtr_->setNewConnectionCpuCallback(
+                [this](int fd, const InetAddress &peer, int cpu) {
+                    newConnection(fd, peer, cpu);
+                });
+        }
         acceptorPtr_->listen();
     });
 }
-void TcpServer::stop()
+void TcpServer::startLoopAcceptors()
 {
-    loop_->runInLoop([this]() { acceptorPtr_.reset(); });
-    for (auto connection : connSet_)
+    // The base acceptor keeps the address bound without listening, the
+    // sockets of the loops are bound to the same address.
+    auto loops = loopPoolPtr_->getLoops();
+    for (auto ioLoop : loops)
     {
-        connection->forceClose();
+        auto &acceptor = loopShards_[ioLoop].acceptor;
+        acceptor.reset(new Acceptor(ioLoop, acceptorPtr_->addr(), true, true));
+        acceptor->setMaxAcceptsPerWakeup(maxAcceptsPerWakeup_);
+        acceptor->setNewConnectionCallback(
+            [this, ioLoop](int fd, const InetAddress &peer) {
+                LOG_TRACE << "new connection:fd=" << fd
+                          << " address=" << peer.toIpPort();
+                ioLoop->addConnectionCount(1);
+                establishConnection(ioLoop, fd, peer);
+            });
     }
-    loopPoolPtr_.reset();
-    for (auto &iter : timingWheelMap_)
+    if (!incomingCpuPlacement_)
+    {
+        // The loops listen at once, the address accepts connections once
+        // all of them have.
+        std::promise<void> pro;
+        auto f = pro.get_future();
+        std::atomic<size_t> remaining{loops.size()};
+        for (auto ioLoop : loops)
+        {
+            auto acceptor = loopShards_[ioLoop].acceptor.get();
+            ioLoop->runInLoop([acceptor, &pro, &remaining]() {
+                acceptor->listen();
+                if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                    pro.set_value();
+            });
+        }
+        f.get();
+        return;
+    }
+    // The BPF program selects a socket by its index in the SO_REUSEPORT
+    // group, which is the order in which the sockets listened, so the loops
+    // listen one after another.
+    std::vector<int> socketOfCpu;
+    for (size_t i = 0; i < loops.size(); ++i)
     {
-        std::promise<int> pro;
+        auto acceptor = loopShards_[loops[i]].acceptor.get();
+        std::promise<void> pro;
         auto f = pro.get_future();
-        iter.second->getLoop()->runInLoop([&iter, &pro]() mutable {
-            iter.second.reset();
-            pro.set_value(1);
+        loops[i]->runInLoop([acceptor, &pro]() {
+            acceptor->listen();
+            pro.set_value();
         });
         f.get();
+        for (auto cpu : loopPoolPtr_->cpuAffinity().cpusOf(i))
+        {
+            if (cpu < 0)
+                continue;
+            if (static_cast<size_t>(cpu) >= socketOfCpu.size())
+                socketOfCpu.resize(cpu + 1, -1);
+            socketOfCpu[cpu] = loopPoolPtr_->loopOfCpu(cpu);
+        }
     }
+    loopShards_[loops[0]].acceptor->attachCpuSteering(socketOfCpu,
+                                                         loops.size());
+}
+void TcpServer::stop()
+{
+    loop_->runInLoop([this]() { acceptorPtr_.reset(); });
+    if (!loopShards_.empty())
+        stopLoops();
+    if (!timingWheelMap_.empty())
+    {
+        // Destroy the timing wheels in their loops at once and wait for all
+        // of them, before the loops of an owned pool quit with it.
+        std::promise<void> pro;
+        auto f = pro.get_future();
+        std::atomic<size_t> remaining{timingWheelMap_.size()};
+        for (auto &iter : timingWheelMap_)
+        {
+            iter.second->getLoop()->runInLoop([&iter, &pro, &remaining]() {
+                iter.second.reset();
+                if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                    pro.set_value();
+            });
+        }
+        f.get();
+    }
+    loopPoolPtr_.reset();
 }
 void TcpServer::connectionClosed(const TcpConnectionPtr &connectionPtr)
 {
     LOG_TRACE << "connectionClosed";
-    // loop_->assertInLoopThread();
-    loop_->runInLoop([this, connectionPtr]() {
-        size_t n = connSet_.erase(connectionPtr);
-        (void)n;
-        assert(n == 1);
-    });
-
+    auto ioLoop = connectionPtr->getLoop();
+    ioLoop->assertInLoopThread();
+    ioLoop->addConnectionCount(-1);
+    loopShards_.find(ioLoop)->second.connections.erase(connectionPtr);
     static_cast<TcpConnectionImpl *>(connectionPtr.get())->connectDestroyed();
 }
 
+void TcpServer::stopLoops()
+{
+    // Each loop destroys its acceptor and closes its connections, the server
+    // waits for all of them.
+    std::promise<void> pro;
+    auto f = pro.get_future();
+    std::atomic<size_t> remaining{loopShards_.size()};
+    for (auto &iter : loopShards_)
+    {
+        auto shard = &iter.second;
+        iter.first->runInLoop([shard, &pro, &remaining]() {
+            shard->stopped = true;
+            shard->acceptor.reset();
+            decltype(shard->connections) connections;
+            connections.swap(shard->connections);
+            for (auto &connection : connections)
+            {
+                connection->forceClose();
+            }
+            if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                pro.set_value();
+        });
+    }
+    f.get();
+}
+
 const std::string TcpServer::ipPort() const
 {
     return acceptorPtr_->addr().toIpPort();
@@ -23,12 +23,14 @@
 #include <trantor/exports.h>
 #include <string>
 #include <memory>
-#include <set>
+#include <map>
+#include <unordered_set>
 #include <signal.h>
 namespace trantor
 {
 class Acceptor;
 class SSLContext;
+class TcpConnectionImpl;
 /**
  * @brief This class represents a TCP server.
  *
@@ -92,6 +94,69 @@ class TRANTOR_EXPORT TcpServer : NonCopyable
         loopPoolPtr_->start();
     }
 
+    /**
+     * @brief Give each I/O loop its own acceptor, with its own SO_REUSEPORT
+     * socket bound to the address of the server, so that connections are
+     * accepted and handled in the same loop and the kernel spreads them over
+     * the loops. This method must be called after setIoLoopNum() or
+     * setIoLoopThreadPool() and before start().
+     *
+     * @note The server must be constructed with the reUsePort option. The
+     * mode is only supported on Linux, where the kernel balances the
+     * connections over the sockets, it is ignored elsewhere. The loop
+     * selection strategy doesn't apply in this mode.
+     */
+    void enableAcceptorPerLoop()
+    {
+        assert(loopPoolPtr_);
+        assert(!started_);
+        assert(reUsePort_);
+#ifdef __linux__
+        acceptorPerLoop_ = true;
+#else
+        LOG_WARN << "One acceptor per loop is only supported on Linux";
+#endif
+    }
+
+    /**
+     * @brief Place each connection on the I/O loop pinned to the CPU which
+     * received it, so that the packets of a connection are handled on the
+     * same core from the NIC queue to the loop. The threads of the loops must
+     * be pinned with EventLoopThreadPool::setCpuAffinity() before start().
+     * With one acceptor per loop, a BPF program attached to the SO_REUSEPORT
+     * group sends each connection to the socket of that loop, otherwise the
+     * acceptor reads the SO_INCOMING_CPU of each connection. Connections from
+     * a CPU no loop is pinned to are placed as usual. This method must be
+     * called after setIoLoopNum() or setIoLoopThreadPool() and before start().
+     *
+     * @note The mode is only supported on Linux. On loopback, a connection is
+     * received on the CPU of the client thread.
+     */
+    void enableIncomingCpuPlacement()
+    {
+        assert(loopPoolPtr_);
+        assert(!started_);
+#ifdef __linux__
+        incomingCpuPlacement_ = true;
+#else
+        LOG_WARN << "Incoming CPU placement is only supported on Linux";
+#endif
+    }
+
+    /**
+     * @brief Set the strategy to select the I/O loop of each new connection,
+     * see EventLoopThreadPool::setLoopSelection(). This method must be called
+     * after setIoLoopNum() or setIoLoopThreadPool() and before start().
+     *
+     * @param selection
+     */
+    void setLoopSelection(LoopSelection selection)
+    {
+        assert(loopPoolPtr_);
+        assert(!started_);
+        loopPoolPtr_->setLoopSelection(selection);
+    }
+
     /**
      * @brief Set the message callback.
      *
@@ -195,6 +260,67 @@ class TRANTOR_EXPORT TcpServer : NonCopyable
         });
     }
 
+    /**
+     * @brief Use the edge-triggered mode for the sockets of new connections.
+     * Each read or write event is then handled until the socket would block,
+     * which saves the extra poll round trips of the level-triggered mode.
+     *
+     * @param maxBytesPerEvent The maximum number of bytes read or written for
+     * a connection per event. When it is reached, the rest is handled in the
+     * next iteration of the event loop, so one busy connection can't starve
+     * the others in the same loop.
+     * @note Encrypted connections always use the level-triggered mode. This
+     * method must be called before the server starts. On Windows it has no
+     * effect.
+     */
+    void enableEdgeTriggered(size_t maxBytesPerEvent = 256 * 1024)
+    {
+        loop_->runInLoop([this, maxBytesPerEvent]() {
+            assert(!started_);
+            assert(maxBytesPerEvent > 0);
+            maxBytesPerEvent_ = maxBytesPerEvent;
+        });
+    }
+
+    /**
+     * @brief Set the I/O budget per iteration of the event loop for new
+     * connections, see TcpConnection::setIoBudget().
+     *
+     * @param maxBytes The maximum number of bytes read and written for a
+     * connection in an iteration, zero means no limit.
+     * @param maxCallbacks The maximum number of message callbacks called for a
+     * connection in an iteration, zero means no limit.
+     * @note This method must be called before the server starts. Use
+     * EventLoop::setIoBudget() on the I/O loops (see getIoLoops()) to limit
+     * all the connections of a loop together.
+     */
+    void setConnectionIoBudget(size_t maxBytes, size_t maxCallbacks = 0)
+    {
+        loop_->runInLoop([this, maxBytes, maxCallbacks]() {
+            assert(!started_);
+            connectionBudgetBytes_ = maxBytes;
+            connectionBudgetCallbacks_ = maxCallbacks;
+        });
+    }
+
+    /**
+     * @brief Set the maximum number of connections accepted each time the
+     * listening socket becomes readable, 64 by default. A larger batch saves
+     * round trips through the poller when many clients connect at once, a
+     * smaller one lets the loop serve its other events between the accepts.
+     *
+     * @param maxAccepts
+     * @note This method must be called before the server starts.
+     */
+    void setMaxAcceptsPerWakeup(size_t maxAccepts)
+    {
+        assert(maxAccepts > 0);
+        loop_->runInLoop([this, maxAccepts]() {
+            assert(!started_);
+            maxAcceptsPerWakeup_ = maxAccepts;
+        });
+    }
+
     /**
      * @brief Enable SSL encryption.
      *
@@ -212,17 +338,42 @@ class TRANTOR_EXPORT TcpServer : NonCopyable
   private:
     EventLoop *loop_;
     std::unique_ptr<Acceptor> acceptorPtr_;
-    void newConnection(int fd, const InetAddress &peer);
+    void newConnection(int fd, const InetAddress &peer, int cpu);
+    void establishConnection(EventLoop *ioLoop,
+                             int fd,
+                             const InetAddress &peer);
+    std::shared_ptr<TcpConnectionImpl> createConnection(
+        EventLoop *ioLoop,
+        int fd,
+        const InetAddress &peer);
     std::string serverName_;
-    std::set<TcpConnectionPtr> connSet_;
+    bool reUsePort_;
+    bool acceptorPerLoop_{false};
+    bool incomingCpuPlacement_{false};
+    // The connections of each I/O loop and, in the acceptor-per-loop mode,
+    // its acceptor, which are only accessed in the loop. The map is filled
+    // when the server starts and isn't changed afterwards.
+    struct LoopShard
+    {
+        std::unique_ptr<Acceptor> acceptor;
+        std::unordered_set<TcpConnectionPtr> connections;
+        bool stopped{false};
+    };
+    std::map<EventLoop *, LoopShard> loopShards_;
 
     RecvMessageCallback recvMessageCallback_;
     ConnectionCallback connectionCallback_;
     WriteCompleteCallback writeCompleteCallback_;
 
     size_t idleTimeout_{0};
+    size_t maxBytesPerEvent_{0};
+    size_t connectionBudgetBytes_{0};
+    size_t connectionBudgetCallbacks_{0};
+    size_t maxAcceptsPerWakeup_{64};
     std::map<EventLoop *, std::shared_ptr<TimingWheel>> timingWheelMap_;
     void connectionClosed(const TcpConnectionPtr &connectionPtr);
+    void startLoopAcceptors();
+    void stopLoops();
     std::shared_ptr<EventLoopThreadPool> loopPoolPtr_;
 #ifndef _WIN32
     class IgnoreSigPipe
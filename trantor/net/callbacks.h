@@ -23,6 +23,23 @@ enum class SSLError
     kSSLHandshakeError,
     kSSLInvalidCertificate
 };
+
+/**
+ * @brief The priority class of a channel. In each iteration, an event loop
+ * handles the events of the channels with a higher priority (a smaller value)
+ * first.
+ */
+enum class ChannelPriority
+{
+    // Heartbeats, admin connections and other control-plane traffic.
+    kControl = 0,
+    // The default class.
+    kInteractive,
+    // Bulk transfers. Their events can be deferred to the next iteration when
+    // the time budget of an iteration is exceeded, see
+    // EventLoop::setIterationBudget().
+    kBulk
+};
 using TimerCallback = std::function<void()>;
 
 // the data has been read to (buf, len)
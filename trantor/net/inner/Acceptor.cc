@@ -60,26 +60,42 @@ void Acceptor::listen()
 
 void Acceptor::readCallback()
 {
-    InetAddress peer;
-    int newsock = sock_.accept(&peer);
-    if (newsock >= 0)
+    // Accept the pending connections until the queue is empty, which saves a
+    // round trip through the poller per connection in a connection storm.
+    for (size_t i = 0; i < maxAcceptsPerWakeup_; ++i)
     {
-        if (newConnectionCallback_)
-        {
-            newConnectionCallback_(newsock, peer);
-        }
-        else
+        InetAddress peer;
+        int newsock = sock_.accept(&peer, acceptFlags_);
+        if (newsock >= 0)
         {
+            if (newConnectionCpuCallback_)
+            {
+                newConnectionCpuCallback_(newsock,
+                                          peer,
+                                          Socket::getIncomingCpu(newsock));
+            }
+            else if (newConnectionCallback_)
+            {
+                newConnectionCallback_(newsock, peer);
+            }
+            else
+            {
 #ifndef _WIN32
-            ::close(newsock);
+                ::close(newsock);
 #else
-            closesocket(newsock);
+                closesocket(newsock);
 #endif
+            }
+            continue;
         }
-    }
-    else
-    {
-        LOG_SYSERR << "Accpetor::readCallback";
+#ifndef _WIN32
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return;
+#else
+        if (WSAGetLastError() == WSAEWOULDBLOCK)
+            return;
+#endif
+        LOG_SYSERR << "Acceptor::readCallback";
 // Read the section named "The special problem of
 // accept()ing when you can't" in libev's doc.
 // By Marc Lehmann, author of libev.
@@ -93,5 +109,6 @@ void Acceptor::readCallback()
             idleFd_ = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
         }
 #endif
+        return;
     }
 }
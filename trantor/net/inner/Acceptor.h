@@ -20,10 +20,14 @@
 #include <trantor/net/InetAddress.h>
 #include "Channel.h"
 #include <functional>
+#include <assert.h>
 
 namespace trantor
 {
 using NewConnectionCallback = std::function<void(int fd, const InetAddress &)>;
+// The cpu is the CPU which received the connection, or -1 if it is unknown.
+using NewConnectionCpuCallback =
+    std::function<void(int fd, const InetAddress &, int cpu)>;
 class Acceptor : NonCopyable
 {
   public:
@@ -40,7 +44,30 @@ class Acceptor : NonCopyable
     {
         newConnectionCallback_ = cb;
     };
+    // Read the SO_INCOMING_CPU option of each accepted socket and pass it to
+    // the callback, which replaces the one without the CPU.
+    void setNewConnectionCpuCallback(const NewConnectionCpuCallback &cb)
+    {
+        newConnectionCpuCallback_ = cb;
+    }
+    // The maximum number of connections accepted each time the listening
+    // socket is readable, the others are accepted in the next iteration.
+    void setMaxAcceptsPerWakeup(size_t maxAccepts)
+    {
+        assert(maxAccepts > 0);
+        maxAcceptsPerWakeup_ = maxAccepts;
+    }
+    // The flags of accept4() on Linux, see Socket::accept().
+    void setAcceptFlags(int flags)
+    {
+        acceptFlags_ = flags;
+    }
     void listen();
+    // See Socket::attachCpuSteering().
+    bool attachCpuSteering(const std::vector<int> &socketOfCpu, size_t sockets)
+    {
+        return sock_.attachCpuSteering(socketOfCpu, sockets);
+    }
 
   protected:
 #ifndef _WIN32
@@ -50,6 +77,9 @@ class Acceptor : NonCopyable
     InetAddress addr_;
     EventLoop *loop_;
     NewConnectionCallback newConnectionCallback_;
+    NewConnectionCpuCallback newConnectionCpuCallback_;
+    size_t maxAcceptsPerWakeup_{64};
+    int acceptFlags_{Socket::kDefaultAcceptFlags};
     Channel acceptChannel_;
     void readCallback();
 };
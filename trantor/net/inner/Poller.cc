@@ -15,6 +15,8 @@
 #include "Poller.h"
 #ifdef __linux__
 #include "poller/EpollPoller.h"
+#include "poller/IoUringPoller.h"
+#include <trantor/utils/Logger.h>
 #elif defined _WIN32
 #include "Wepoll.h"
 #include "poller/EpollPoller.h"
@@ -24,7 +26,18 @@
 using namespace trantor;
 Poller *Poller::newPoller(EventLoop *loop)
 {
-#if defined __linux__ || defined _WIN32
+#if defined __linux__ && defined USE_IO_URING
+    if (IoUringPoller::isSupported())
+    {
+        return new IoUringPoller(loop);
+    }
+    static std::once_flag once;
+    std::call_once(once, []() {
+        LOG_WARN << "io_uring is not supported by the kernel, fall back to "
+                    "epoll";
+    });
+    return new EpollPoller(loop);
+#elif defined __linux__ || defined _WIN32
     return new EpollPoller(loop);
 #else
     return new KQueue(loop);
@@ -37,6 +37,15 @@ class Poller : NonCopyable
         ownerLoop_->assertInLoopThread();
     }
     virtual void poll(int timeoutMs, ChannelList *activeChannels) = 0;
+    // Wait for at most timeoutNs nanoseconds, or until an event comes if it
+    // is negative. The pollers without a finer timeout round it up to
+    // milliseconds.
+    virtual void pollNs(int64_t timeoutNs, ChannelList *activeChannels)
+    {
+        poll(timeoutNs < 0 ? -1
+                           : static_cast<int>((timeoutNs + 999999) / 1000000),
+             activeChannels);
+    }
     virtual void updateChannel(Channel *channel) = 0;
     virtual void removeChannel(Channel *channel) = 0;
 #ifdef _WIN32
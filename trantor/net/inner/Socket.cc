@@ -22,6 +22,9 @@
 #include <sys/socket.h>
 #include <netinet/tcp.h>
 #endif
+#ifdef __linux__
+#include <linux/filter.h>
+#endif
 
 using namespace trantor;
 
@@ -78,7 +81,7 @@ void Socket::listen()
         exit(1);
     }
 }
-int Socket::accept(InetAddress *peeraddr)
+int Socket::accept(InetAddress *peeraddr, int flags)
 {
     struct sockaddr_in6 addr6;
     memset(&addr6, 0, sizeof(addr6));
@@ -87,14 +90,19 @@ int Socket::accept(InetAddress *peeraddr)
     int connfd = ::accept4(sockFd_,
                            (struct sockaddr *)&addr6,
                            &size,
-                           SOCK_NONBLOCK | SOCK_CLOEXEC);
+                           SOCK_NONBLOCK | flags);
 #else
+    (void)flags;
     int connfd =
         static_cast<int>(::accept(sockFd_, (struct sockaddr *)&addr6, &size));
-    setNonBlockAndCloseOnExec(connfd);
 #endif
     if (connfd >= 0)
     {
+#ifndef __linux__
+        // Only on success, so that the errno of a failed accept() still tells
+        // the caller whether the queue has been drained.
+        setNonBlockAndCloseOnExec(connfd);
+#endif
         peeraddr->setSockAddrInet6(addr6);
     }
     return connfd;
@@ -119,6 +127,20 @@ int Socket::read(char *buffer, uint64_t len)
 #endif
 }
 
+int Socket::getIncomingCpu(int sockfd)
+{
+#ifdef SO_INCOMING_CPU
+    int cpu = -1;
+    socklen_t len = static_cast<socklen_t>(sizeof cpu);
+    if (::getsockopt(sockfd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) < 0)
+        return -1;
+    return cpu;
+#else
+    (void)sockfd;
+    return -1;
+#endif
+}
+
 struct sockaddr_in6 Socket::getLocalAddr(int sockfd)
 {
     struct sockaddr_in6 localaddr;
@@ -202,6 +224,50 @@ void Socket::setReusePort(bool on)
 #endif
 }
 
+bool Socket::attachCpuSteering(const std::vector<int> &socketOfCpu,
+                               size_t sockets)
+{
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+    assert(sockets > 0);
+    std::vector<sock_filter> code;
+    const auto cpuOffset = static_cast<uint32_t>(SKF_AD_OFF + SKF_AD_CPU);
+    code.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, cpuOffset));
+    for (size_t cpu = 0; cpu < socketOfCpu.size(); ++cpu)
+    {
+        if (socketOfCpu[cpu] < 0)
+            continue;
+        // A program has at most BPF_MAXINSNS instructions.
+        if (code.size() + 4 > BPF_MAXINSNS)
+            break;
+        code.push_back(BPF_JUMP(
+            BPF_JMP | BPF_JEQ | BPF_K, static_cast<uint32_t>(cpu), 0, 1));
+        code.push_back(BPF_STMT(BPF_RET | BPF_K,
+                                static_cast<uint32_t>(socketOfCpu[cpu])));
+    }
+    code.push_back(
+        BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, static_cast<uint32_t>(sockets)));
+    code.push_back(BPF_STMT(BPF_RET | BPF_A, 0));
+    sock_fprog prog;
+    prog.len = static_cast<unsigned short>(code.size());
+    prog.filter = code.data();
+    if (::setsockopt(sockFd_,
+                     SOL_SOCKET,
+                     SO_ATTACH_REUSEPORT_CBPF,
+                     &prog,
+                     static_cast<socklen_t>(sizeof prog)) < 0)
+    {
+        LOG_SYSERR << "SO_ATTACH_REUSEPORT_CBPF failed.";
+        return false;
+    }
+    return true;
+#else
+    (void)socketOfCpu;
+    (void)sockets;
+    LOG_ERROR << "SO_ATTACH_REUSEPORT_CBPF is not supported.";
+    return false;
+#endif
+}
+
 void Socket::setKeepAlive(bool on)
 {
 #ifdef _WIN32
@@ -18,6 +18,7 @@
 #include <trantor/net/InetAddress.h>
 #include <trantor/utils/Logger.h>
 #include <string>
+#include <vector>
 #ifndef _WIN32
 #include <unistd.h>
 #endif
@@ -90,7 +91,14 @@ class Socket : NonCopyable
     void bindAddress(const InetAddress &localaddr);
     /// abort if address in use
     void listen();
-    int accept(InetAddress *peeraddr);
+    /// The accepted socket is always non-blocking, the flags are passed to
+    /// accept4() on Linux, e.g. SOCK_CLOEXEC, and are ignored elsewhere.
+    int accept(InetAddress *peeraddr, int flags = kDefaultAcceptFlags);
+#ifdef __linux__
+    static constexpr int kDefaultAcceptFlags = SOCK_CLOEXEC;
+#else
+    static constexpr int kDefaultAcceptFlags = 0;
+#endif
     void closeWrite();
     int read(char *buffer, uint64_t len);
     int fd()
@@ -99,6 +107,9 @@ class Socket : NonCopyable
     }
     static struct sockaddr_in6 getLocalAddr(int sockfd);
     static struct sockaddr_in6 getPeerAddr(int sockfd);
+    /// Return the CPU which received the packets of the socket (the
+    /// SO_INCOMING_CPU option), or -1 if it is unknown.
+    static int getIncomingCpu(int sockfd);
 
     ///
     /// Enable/disable TCP_NODELAY (disable/enable Nagle's algorithm).
@@ -115,6 +126,16 @@ class Socket : NonCopyable
     ///
     void setReusePort(bool on);
 
+    ///
+    /// Attach a classic BPF program to the SO_REUSEPORT group of the socket,
+    /// which sends the connections received on the CPU c to the socket
+    /// socketOfCpu[c] in the order the sockets of the group listened, and
+    /// the others by their CPU modulo the number of sockets. Linux only,
+    /// return false if it fails.
+    ///
+    bool attachCpuSteering(const std::vector<int> &socketOfCpu,
+                           size_t sockets);
+
     ///
     /// Enable/disable SO_KEEPALIVE
     ///
@@ -35,6 +35,7 @@
 #ifdef _WIN32
 #define stat _stati64
 #endif
+#include <algorithm>
 #include <regex>
 
 using namespace trantor;
@@ -388,6 +389,7 @@ void TcpConnectionImpl::startClientEncryptionInLoop(
     }
     isEncrypted_ = true;
     sslEncryptionPtr_->isUpgrade_ = true;
+    disableEdgeTriggered();
     auto r = SSL_set_fd(sslEncryptionPtr_->sslPtr_->get(), socketPtr_->fd());
     (void)r;
     assert(r);
@@ -415,6 +417,7 @@ void TcpConnectionImpl::startServerEncryptionInLoop(
         std::make_unique<SSLConn>(sslEncryptionPtr_->sslCtxPtr_->get());
     isEncrypted_ = true;
     sslEncryptionPtr_->isUpgrade_ = true;
+    disableEdgeTriggered();
     if (sslEncryptionPtr_->isServer_ == false)
         SSL_set_verify(sslEncryptionPtr_->sslPtr_->get(),
                        SSL_VERIFY_NONE,
@@ -499,6 +502,13 @@ void TcpConnectionImpl::readCallback()
     {
 #endif
         loop_->assertInLoopThread();
+        if (!checkIoBudget(Channel::kReadEvent))
+            return;
+        if (edgeTriggered_)
+        {
+            readUntilWouldBlock();
+            return;
+        }
         int ret = 0;
 
         ssize_t n = readBuffer_.readFd(socketPtr_->fd(), &ret);
@@ -531,6 +541,7 @@ void TcpConnectionImpl::readCallback()
         if (n > 0)
         {
             bytesReceived_ += n;
+            consumeIoBudget(n, recvMsgCallback_ ? 1 : 0);
             if (recvMsgCallback_)
             {
                 recvMsgCallback_(shared_from_this(), &readBuffer_);
@@ -589,6 +600,99 @@ void TcpConnectionImpl::readCallback()
     }
 #endif
 }
+void TcpConnectionImpl::readUntilWouldBlock()
+{
+    if (status_ == ConnStatus::Disconnected)
+        return;
+    size_t bytesRead = 0;
+    size_t limit = std::min(maxBytesPerEvent_, ioBytesLeft());
+    bool closed = false;
+    while (true)
+    {
+        int ret = 0;
+        ssize_t n = readBuffer_.readFd(socketPtr_->fd(), &ret);
+        if (n > 0)
+        {
+            bytesRead += n;
+            // Even a short read doesn't drain the socket for sure, e.g. the
+            // FIN of the peer may be queued behind the data with no new edge
+            // to report it, so read until EAGAIN or the end of the stream.
+            if (bytesRead >= limit)
+            {
+                // Give other connections on this loop a chance.
+                ioChannelPtr_->deferEvents(Channel::kReadEvent);
+                if (limit < maxBytesPerEvent_)
+                    increase(budgetDeferrals_);
+                break;
+            }
+            continue;
+        }
+        if (n == 0)
+        {
+            // socket closed by peer
+            closed = true;
+            break;
+        }
+        if (ret == EINTR)
+            continue;
+#ifdef _WIN32
+        if (ret == EWOULDBLOCK || ret == WSAEWOULDBLOCK)
+            break;
+#else
+        if (ret == EAGAIN || ret == EWOULDBLOCK)
+            break;
+#endif
+        // No more events are reported for this socket in the edge-triggered
+        // mode, so close the connection on any other error.
+        errno = ret;
+        if (ret == EPIPE || ret == ECONNRESET)
+        {
+            LOG_DEBUG << "EPIPE or ECONNRESET, errno=" << ret;
+        }
+        else
+        {
+            LOG_SYSERR << "read socket error";
+        }
+        closed = true;
+        break;
+    }
+    if (bytesRead > 0)
+    {
+        extendLife();
+        bytesReceived_ += bytesRead;
+        consumeIoBudget(bytesRead, recvMsgCallback_ ? 1 : 0);
+        if (recvMsgCallback_)
+        {
+            recvMsgCallback_(shared_from_this(), &readBuffer_);
+        }
+    }
+    if (closed && status_ != ConnStatus::Disconnected)
+    {
+        handleClose();
+    }
+}
+void TcpConnectionImpl::enableEdgeTriggered(size_t maxBytesPerEvent)
+{
+    assert(maxBytesPerEvent > 0);
+    assert(status_ == ConnStatus::Connecting);
+    if (isEncrypted_)
+    {
+        // The TLS layer buffers data on its own, keep the level-triggered
+        // mode for encrypted connections.
+        return;
+    }
+    edgeTriggered_ = true;
+    maxBytesPerEvent_ = maxBytesPerEvent;
+    ioChannelPtr_->setEdgeTriggered(true);
+}
+void TcpConnectionImpl::disableEdgeTriggered()
+{
+    if (!edgeTriggered_)
+        return;
+    edgeTriggered_ = false;
+    ioChannelPtr_->setEdgeTriggered(false);
+    ioChannelPtr_->updateEvents(ioChannelPtr_->events());
+}
 void TcpConnectionImpl::extendLife()
 {
     if (idleTimeout_ > 0)
@@ -616,144 +720,98 @@ void TcpConnectionImpl::writeCallback()
 #endif
         loop_->assertInLoopThread();
         extendLife();
-        if (ioChannelPtr_->isWriting())
+        if (!ioChannelPtr_->isWriting())
         {
-            assert(!writeBufferList_.empty());
-            auto writeBuffer_ = writeBufferList_.front();
+            LOG_SYSERR << "no writing but call write callback";
+            return;
+        }
+        if (!checkIoBudget(Channel::kWriteEvent))
+            return;
+        // In the level-triggered mode one write is made per event, the
+        // poller reports the socket again while it is writable. In the
+        // edge-triggered mode write until the socket would block.
+        bool written = false;
+        size_t bytesWritten = 0;
+        size_t limit = ioBytesLeft();
+        if (edgeTriggered_)
+            limit = std::min(limit, maxBytesPerEvent_);
+        while (!writeBufferList_.empty())
+        {
+            auto &node = writeBufferList_.front();
 #ifndef _WIN32
-            if (writeBuffer_->sendFd_ < 0)
+            bool isFile = node->sendFd_ >= 0;
 #else
-        if (writeBuffer_->sendFp_ == nullptr)
+            bool isFile = node->sendFp_ != nullptr;
 #endif
+            bool finished = isFile ? node->fileBytesToSend_ <= 0
+                                   : node->msgBuffer_->readableBytes() == 0;
+            if (finished)
             {
-                if (writeBuffer_->msgBuffer_->readableBytes() <= 0)
-                {
-                    writeBufferList_.pop_front();
-                    if (writeBufferList_.empty())
-                    {
-                        ioChannelPtr_->disableWriting();
-                        //
-                        if (writeCompleteCallback_)
-                            writeCompleteCallback_(shared_from_this());
-                        if (status_ == ConnStatus::Disconnecting)
-                        {
-                            socketPtr_->closeWrite();
-                        }
-                    }
-                    else
-                    {
-                        auto fileNode = writeBufferList_.front();
-#ifndef _WIN32
-                        assert(fileNode->sendFd_ >= 0);
-#else
-                    assert(fileNode->sendFp_);
-#endif
-                        sendFileInLoop(fileNode);
-                    }
-                }
-                else
+                writeBufferList_.pop_front();
+                if (writeBufferList_.empty())
                 {
-                    auto n =
-                        writeInLoop(writeBuffer_->msgBuffer_->peek(),
-                                    writeBuffer_->msgBuffer_->readableBytes());
-                    if (n >= 0)
+                    ioChannelPtr_->disableWriting();
+                    if (writeCompleteCallback_)
+                        writeCompleteCallback_(shared_from_this());
+                    if (status_ == ConnStatus::Disconnecting)
                     {
-                        writeBuffer_->msgBuffer_->retrieve(n);
-                    }
-                    else
-                    {
-#ifdef _WIN32
-                        if (errno != 0 && errno != EWOULDBLOCK)
-#else
-                    if (errno != EWOULDBLOCK)
-#endif
-                        {
-                            // TODO: any others?
-                            if (errno == EPIPE || errno == ECONNRESET)
-                            {
-                                LOG_DEBUG << "EPIPE or ECONNRESET, erron="
-                                          << errno;
-                                return;
-                            }
-                            LOG_SYSERR << "Unexpected error(" << errno << ")";
-                            return;
-                        }
+                        socketPtr_->closeWrite();
                     }
+                    return;
                 }
+                continue;
             }
-            else
+            if (written && !edgeTriggered_)
+                return;
+            if (bytesWritten >= limit)
+            {
+                // Give other connections on this loop a chance.
+                ioChannelPtr_->deferEvents(Channel::kWriteEvent);
+                if (!edgeTriggered_ || limit < maxBytesPerEvent_)
+                    increase(budgetDeferrals_);
+                return;
+            }
+            written = true;
+            if (isFile)
+            {
+                auto bytesToSend = node->fileBytesToSend_;
+                sendFileInLoop(node);
+                auto sent = bytesToSend - node->fileBytesToSend_;
+                bytesWritten += sent;
+                consumeIoBudget(sent, 0);
+                if (node->fileBytesToSend_ > 0)
+                    return;
+                continue;
+            }
+            auto length = std::min(node->msgBuffer_->readableBytes(),
+                                   limit - bytesWritten);
+            auto n = writeInLoop(node->msgBuffer_->peek(), length);
+            if (n < 0)
             {
-                // file
-                if (writeBuffer_->fileBytesToSend_ <= 0)
-                {
-                    writeBufferList_.pop_front();
-                    if (writeBufferList_.empty())
-                    {
-                        ioChannelPtr_->disableWriting();
-                        if (writeCompleteCallback_)
-                            writeCompleteCallback_(shared_from_this());
-                        if (status_ == ConnStatus::Disconnecting)
-                        {
-                            socketPtr_->closeWrite();
-                        }
-                    }
-                    else
-                    {
-#ifndef _WIN32
-                        if (writeBufferList_.front()->sendFd_ < 0)
-#else
-                    if (writeBufferList_.front()->sendFp_ == nullptr)
-#endif
-                        {
-                            // There is data to be sent in the buffer.
-                            auto n = writeInLoop(
-                                writeBufferList_.front()->msgBuffer_->peek(),
-                                writeBufferList_.front()
-                                    ->msgBuffer_->readableBytes());
-                            writeBufferList_.front()->msgBuffer_->retrieve(n);
-                            if (n >= 0)
-                            {
-                                writeBufferList_.front()->msgBuffer_->retrieve(
-                                    n);
-                            }
-                            else
-                            {
 #ifdef _WIN32
-                                if (errno != 0 && errno != EWOULDBLOCK)
+                if (errno != 0 && errno != EWOULDBLOCK)
 #else
-                            if (errno != EWOULDBLOCK)
+                if (errno != EWOULDBLOCK)
 #endif
-                                {
-                                    // TODO: any others?
-                                    if (errno == EPIPE || errno == ECONNRESET)
-                                    {
-                                        LOG_DEBUG
-                                            << "EPIPE or ECONNRESET, erron="
-                                            << errno;
-                                        return;
-                                    }
-                                    LOG_SYSERR << "Unexpected error(" << errno
-                                               << ")";
-                                    return;
-                                }
-                            }
-                        }
-                        else
-                        {
-                            // more file
-                            sendFileInLoop(writeBufferList_.front());
-                        }
-                    }
-                }
-                else
                 {
-                    sendFileInLoop(writeBuffer_);
+                    // TODO: any others?
+                    if (errno == EPIPE || errno == ECONNRESET)
+                    {
+                        LOG_DEBUG << "EPIPE or ECONNRESET, erron=" << errno;
+                        return;
+                    }
+                    LOG_SYSERR << "Unexpected error(" << errno << ")";
                 }
+                return;
+            }
+            node->msgBuffer_->retrieve(n);
+            bytesWritten += n;
+            consumeIoBudget(n, 0);
+            if (static_cast<size_t>(n) < length)
+            {
+                // The socket buffer is full.
+                return;
             }
-        }
-        else
-        {
-            LOG_SYSERR << "no writing but call write callback";
         }
 #ifdef USE_OPENSSL
     }
@@ -847,6 +905,69 @@ void TcpConnectionImpl::setTcpNoDelay(bool on)
 {
     socketPtr_->setTcpNoDelay(on);
 }
+void TcpConnectionImpl::setIoBudget(size_t maxBytes, size_t maxCallbacks)
+{
+    auto thisPtr = shared_from_this();
+    loop_->runInLoop([thisPtr, maxBytes, maxCallbacks]() {
+        thisPtr->budgetBytes_ = maxBytes;
+        thisPtr->budgetCallbacks_ = maxCallbacks;
+    });
+}
+bool TcpConnectionImpl::checkIoBudget(int event)
+{
+    // The counters of the connection are reset lazily when it is first
+    // charged in an iteration, they are zero if the iteration has changed.
+    bool sameIteration = budgetIteration_ == loop_->iteration();
+    if (loop_->hasIoBudget() &&
+        (budgetBytes_ == 0 || !sameIteration ||
+         iterationBytes_.load(std::memory_order_relaxed) < budgetBytes_) &&
+        (budgetCallbacks_ == 0 || !sameIteration ||
+         iterationCallbacks_ < budgetCallbacks_))
+    {
+        return true;
+    }
+    ioChannelPtr_->deferEvents(event);
+    increase(budgetDeferrals_);
+    return false;
+}
+size_t TcpConnectionImpl::ioBytesLeft() const
+{
+    size_t left = loop_->ioBytesLeft();
+    if (budgetBytes_ > 0)
+    {
+        size_t used = budgetIteration_ == loop_->iteration()
+                          ? iterationBytes_.load(std::memory_order_relaxed)
+                          : 0;
+        left = std::min(left, used < budgetBytes_ ? budgetBytes_ - used : 0);
+    }
+    return left;
+}
+void TcpConnectionImpl::consumeIoBudget(size_t bytes, size_t callbacks)
+{
+    auto iteration = loop_->iteration();
+    size_t iterationBytes = bytes;
+    if (budgetIteration_ != iteration)
+    {
+        budgetIteration_ = iteration;
+        iterationCallbacks_ = 0;
+    }
+    else
+    {
+        iterationBytes += iterationBytes_.load(std::memory_order_relaxed);
+    }
+    iterationBytes_.store(iterationBytes, std::memory_order_relaxed);
+    iterationCallbacks_ += callbacks;
+    if (iterationBytes > maxIterationBytes_.load(std::memory_order_relaxed))
+        maxIterationBytes_.store(iterationBytes, std::memory_order_relaxed);
+    loop_->consumeIoBudget(bytes, callbacks);
+}
+void TcpConnectionImpl::setPriority(ChannelPriority priority)
+{
+    auto thisPtr = shared_from_this();
+    loop_->runInLoop([thisPtr, priority]() {
+        thisPtr->ioChannelPtr_->setPriority(priority);
+    });
+}
 void TcpConnectionImpl::connectDestroyed()
 {
     loop_->assertInLoopThread();
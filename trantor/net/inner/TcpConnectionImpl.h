@@ -16,6 +16,7 @@
 
 #include <trantor/net/TcpConnection.h>
 #include <trantor/utils/TimingWheel.h>
+#include <atomic>
 #include <list>
 #include <mutex>
 #ifndef _WIN32
@@ -156,6 +157,7 @@ class TcpConnectionImpl : public TcpConnection,
         return idleTimeout_ == 0;
     }
     virtual void setTcpNoDelay(bool on) override;
+    virtual void setPriority(ChannelPriority priority) override;
     virtual void shutdown() override;
     virtual void forceClose() override;
     virtual EventLoop *getLoop() override
@@ -171,6 +173,19 @@ class TcpConnectionImpl : public TcpConnection,
     {
         return bytesReceived_;
     }
+    virtual void setIoBudget(size_t maxBytes, size_t maxCallbacks) override;
+    virtual size_t lastIterationBytes() const override
+    {
+        return iterationBytes_.load(std::memory_order_relaxed);
+    }
+    virtual size_t maxIterationBytes() const override
+    {
+        return maxIterationBytes_.load(std::memory_order_relaxed);
+    }
+    virtual size_t budgetDeferrals() const override
+    {
+        return budgetDeferrals_.load(std::memory_order_relaxed);
+    }
     virtual void startClientEncryption(std::function<void()> callback,
                                        bool useOldTLS = false,
                                        bool validateCert = true,
@@ -232,6 +247,9 @@ class TcpConnectionImpl : public TcpConnection,
     void connectDestroyed();
     virtual void connectEstablished();
 
+    // Must be called before connectEstablished().
+    void enableEdgeTriggered(size_t maxBytesPerEvent);
+
   protected:
     struct BufferNode
     {
@@ -270,6 +288,8 @@ class TcpConnectionImpl : public TcpConnection,
     MsgBuffer readBuffer_;
     std::list<BufferNodePtr> writeBufferList_;
     void readCallback();
+    void readUntilWouldBlock();
+    void disableEdgeTriggered();
     void writeCallback();
     InetAddress localAddr_, peerAddr_;
     ConnStatus status_{ConnStatus::Connecting};
@@ -295,6 +315,27 @@ class TcpConnectionImpl : public TcpConnection,
     size_t highWaterMarkLen_;
     std::string name_;
 
+    bool edgeTriggered_{false};
+    size_t maxBytesPerEvent_{0};
+
+    // The I/O budget per iteration of the loop.
+    bool checkIoBudget(int event);
+    size_t ioBytesLeft() const;
+    void consumeIoBudget(size_t bytes, size_t callbacks);
+    size_t budgetBytes_{0};
+    size_t budgetCallbacks_{0};
+    uint64_t budgetIteration_{0};
+    size_t iterationCallbacks_{0};
+    // Only written by the thread of the loop, read by any thread.
+    std::atomic<size_t> iterationBytes_{0};
+    std::atomic<size_t> maxIterationBytes_{0};
+    std::atomic<size_t> budgetDeferrals_{0};
+    static void increase(std::atomic<size_t> &counter)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + 1,
+                      std::memory_order_relaxed);
+    }
+
     uint64_t sendNum_{0};
     std::mutex sendNumMutex_;
 
@@ -15,50 +15,171 @@
 #include "Timer.h"
 #include <trantor/utils/Logger.h>
 #include <trantor/net/EventLoop.h>
+#include <thread>
 
 namespace trantor
 {
-std::atomic<TimerId> Timer::timersCreated_ = ATOMIC_VAR_INIT(InvalidTimerId);
-Timer::Timer(const TimerCallback &cb,
-             const TimePoint &when,
-             const TimeInterval &interval)
-    : callback_(cb),
-      when_(when),
-      interval_(interval),
-      repeat_(interval.count() > 0),
-      id_(++timersCreated_)
-{
-}
-Timer::Timer(TimerCallback &&cb,
-             const TimePoint &when,
-             const TimeInterval &interval)
-    : callback_(std::move(cb)),
-      when_(when),
-      interval_(interval),
-      repeat_(interval.count() > 0),
-      id_(++timersCreated_)
-{
-    // LOG_TRACE<<"Timer move contrustor";
-}
+std::atomic<uint64_t> TimerPool::sequence_ = ATOMIC_VAR_INIT(0);
+
 void Timer::run() const
 {
     callback_();
 }
 void Timer::restart(const TimePoint &now)
 {
-    if (repeat_)
+    if (isRepeat())
     {
-        when_ = now + interval_;
+        if (!fixedRate_)
+        {
+            when_ = now + interval_;
+            return;
+        }
+        when_ += interval_;
+        if (when_ < now)
+        {
+            // Skip the runs missed, on the grid of the first deadline.
+            when_ += ((now - when_) / interval_ + 1) * interval_;
+        }
     }
     else
         when_ = std::chrono::steady_clock::now();
 }
 bool Timer::operator<(const Timer &t) const
 {
-    return when_ < t.when_;
+    auto wake = wakeAt(), otherWake = t.wakeAt();
+    return wake < otherWake || (wake == otherWake && id_ < t.id_);
 }
 bool Timer::operator>(const Timer &t) const
 {
-    return when_ > t.when_;
+    return t < *this;
+}
+
+TimerPool::TimerPool()
+{
+    for (auto &chunk : chunks_)
+        chunk.store(nullptr, std::memory_order_relaxed);
+}
+
+TimerPool::~TimerPool()
+{
+    for (size_t k = 0; k < chunkCount_; ++k)
+        delete[] chunks_[k].load(std::memory_order_relaxed);
+}
+
+size_t TimerPool::chunkOf(size_t slot)
+{
+    // The chunk k starts at the slot kFirstChunk * (2^k - 1).
+    size_t k = 0;
+    for (size_t v = slot / kFirstChunk + 1; v > 1; v >>= 1)
+        ++k;
+    return k;
+}
+
+Timer *TimerPool::grow(size_t &size)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (chunkCount_ == kMaxChunks)
+    {
+        LOG_FATAL << "Too many timers in an event loop";
+        abort();
+    }
+    size = kFirstChunk << chunkCount_;
+    size_t first = kFirstChunk * ((size_t(1) << chunkCount_) - 1);
+    auto chunk = new Timer[size];
+    // The lower slots are used first.
+    for (size_t i = 0; i < size; ++i)
+    {
+        chunk[i].slot_ = static_cast<uint32_t>(first + i);
+        chunk[i].nextFree_ = i + 1 < size ? &chunk[i + 1] : nullptr;
+    }
+    chunks_[chunkCount_++].store(chunk, std::memory_order_release);
+    return chunk;
+}
+
+void TimerPool::pushShared(Timer *first, Timer *last)
+{
+    Timer *top = sharedFree_.load(std::memory_order_relaxed);
+    do
+    {
+        last->nextFree_ = top;
+    } while (!sharedFree_.compare_exchange_weak(top,
+                                                first,
+                                                std::memory_order_release,
+                                                std::memory_order_relaxed));
+}
+
+void TimerPool::assignId(Timer *timer)
+{
+    auto sequence = sequence_.fetch_add(1, std::memory_order_relaxed) + 1;
+    timer->id_ = (sequence << kSlotBits) | timer->slot_;
+    timer->nextFree_ = nullptr;
+    timer->state_.store(timer->id_, std::memory_order_release);
+}
+
+Timer *TimerPool::allocate()
+{
+    Timer *timer = localFree_;
+    if (!timer)
+    {
+        size_t size;
+        timer = grow(size);
+    }
+    localFree_ = timer->nextFree_;
+    assignId(timer);
+    return timer;
+}
+
+Timer *TimerPool::allocateShared()
+{
+    // The lock is only held to pop a timer, and only by other threads than
+    // the one of the loop.
+    while (sharedLock_.test_and_set(std::memory_order_acquire))
+        std::this_thread::yield();
+    Timer *timer = sharedFree_.load(std::memory_order_acquire);
+    while (timer && !sharedFree_.compare_exchange_weak(
+                        timer,
+                        timer->nextFree_,
+                        std::memory_order_acquire,
+                        std::memory_order_acquire))
+    {
+    }
+    sharedLock_.clear(std::memory_order_release);
+    if (!timer)
+    {
+        size_t size;
+        timer = grow(size);
+        if (size > 1)
+            pushShared(timer + 1, timer + size - 1);
+    }
+    timer->shared_ = true;
+    assignId(timer);
+    return timer;
+}
+
+void TimerPool::free(Timer *timer)
+{
+    timer->callback_ = nullptr;
+    timer->heapIndex_ = Timer::kNotInHeap;
+    timer->state_.store(0, std::memory_order_release);
+    if (timer->shared_)
+    {
+        timer->shared_ = false;
+        pushShared(timer, timer);
+        return;
+    }
+    timer->nextFree_ = localFree_;
+    localFree_ = timer;
+}
+
+Timer *TimerPool::find(TimerId id) const
+{
+    size_t slot = id & ((size_t(1) << kSlotBits) - 1);
+    size_t k = chunkOf(slot);
+    if (k >= kMaxChunks)
+        return nullptr;
+    auto chunk = chunks_[k].load(std::memory_order_acquire);
+    if (!chunk)
+        return nullptr;
+    return &chunk[slot - kFirstChunk * ((size_t(1) << k) - 1)];
 }
 }  // namespace trantor
@@ -16,40 +16,44 @@
 
 #include <trantor/utils/NonCopyable.h>
 #include <trantor/net/callbacks.h>
+#include <trantor/utils/Task.h>
 #include <functional>
 #include <atomic>
-#include <iostream>
 #include <chrono>
+#include <mutex>
 
 namespace trantor
 {
 using TimerId = uint64_t;
 using TimePoint = std::chrono::steady_clock::time_point;
-using TimeInterval = std::chrono::microseconds;
+using TimeInterval = std::chrono::nanoseconds;
 class Timer : public NonCopyable
 {
   public:
-    Timer(const TimerCallback &cb,
-          const TimePoint &when,
-          const TimeInterval &interval);
-    Timer(TimerCallback &&cb,
-          const TimePoint &when,
-          const TimeInterval &interval);
-    ~Timer()
-    {
-        //   std::cout<<"Timer unconstract!"<<std::endl;
-    }
+    Timer() = default;
     void run() const;
     void restart(const TimePoint &now);
+    // The timers are ordered by the time they wake the loop up, then by
+    // creation for the same time.
     bool operator<(const Timer &t) const;
     bool operator>(const Timer &t) const;
     const TimePoint &when() const
     {
         return when_;
     }
+    // The deadline, earlier by the spin of the timer.
+    TimePoint wakeAt() const
+    {
+        return when_ - spin_;
+    }
+    // A precise timer isn't delayed by the slack of its queue.
+    bool isPrecise() const
+    {
+        return fixedRate_ || spin_.count() > 0;
+    }
     bool isRepeat()
     {
-        return repeat_;
+        return interval_.count() > 0;
     }
     TimerId id()
     {
@@ -57,12 +61,87 @@ class Timer : public NonCopyable
     }
 
   private:
-    TimerCallback callback_;
+    friend class TimerQueue;
+    friend class TimerPool;
+    // The position of the timer in the heap of its queue, kNotInHeap while it
+    // runs, while its insertion is queued or once it is removed.
+    static constexpr size_t kNotInHeap = static_cast<size_t>(-1);
+    // The bit of the state set when the timer is invalidated.
+    static constexpr uint64_t kCancelled = 1ULL << 63;
+    // The bit of the state set while the timer is in the heap of its queue.
+    static constexpr uint64_t kInHeap = 1ULL << 62;
+
+    Task callback_;
     TimePoint when_;
-    const TimeInterval interval_;
-    const bool repeat_;
-    const TimerId id_;
-    static std::atomic<TimerId> timersCreated_;
+    TimeInterval interval_{0};
+    // The loop wakes up spin_ before the deadline and busy-waits for it.
+    TimeInterval spin_{0};
+    // A repeating timer is rescheduled from its deadline instead of the time
+    // it ran.
+    bool fixedRate_{false};
+    TimerId id_{0};
+    size_t heapIndex_{kNotInHeap};
+    // The id while the timer is pending, with kInHeap while it is in the
+    // heap, with kCancelled once it is invalidated, and 0 while the timer is
+    // free in its pool. It is the only field written by other threads.
+    std::atomic<uint64_t> state_{0};
+    uint32_t slot_{0};
+    // Allocated by another thread than the one of the loop, the timer goes
+    // back to the shared free list.
+    bool shared_{false};
+    Timer *nextFree_{nullptr};
+};
+
+/**
+ * The timers of a queue are allocated from this pool and never returned to
+ * the heap until the pool is destroyed. The id of a timer carries its slot in
+ * the pool, so any thread finds the timer of an id without a lookup table,
+ * and a sequence number, so an id is never reused.
+ *
+ * The thread of the loop allocates and frees timers with a free list of its
+ * own, without locks or atomic operations. Other threads take timers from a
+ * lock-free shared list, to which the loop gives them back when they are
+ * freed. The mutex is only taken to grow the pool.
+ */
+class TimerPool : public NonCopyable
+{
+  public:
+    TimerPool();
+    ~TimerPool();
+    // The timer gets a new id and is pending. The thread of the loop calls
+    // allocate(), other threads allocateShared().
+    Timer *allocate();
+    Timer *allocateShared();
+    // The thread of the loop, once the timer is out of the heap.
+    void free(Timer *timer);
+    // Any thread, return the timer in the slot of the id, whose state tells
+    // if it still has the id, or nullptr if the slot doesn't exist.
+    Timer *find(TimerId id) const;
+
+  private:
+    // The chunk k has kFirstChunk << k timers, so the pool holds up to
+    // 2^kSlotBits timers with a fixed table of chunks.
+    static constexpr int kSlotBits = 24;
+    static constexpr size_t kFirstChunk = 64;
+    static constexpr size_t kMaxChunks = 18;
+    static size_t chunkOf(size_t slot);
+    // Return the timers of a new chunk, linked by nextFree_.
+    Timer *grow(size_t &size);
+    void pushShared(Timer *first, Timer *last);
+    void assignId(Timer *timer);
+
+    std::atomic<Timer *> chunks_[kMaxChunks];
+    // Guarded by mutex_.
+    size_t chunkCount_{0};
+    std::mutex mutex_;
+    // Only used by the thread of the loop.
+    Timer *localFree_{nullptr};
+    std::atomic<Timer *> sharedFree_{nullptr};
+    // Only one thread at a time takes timers from the shared list, so a timer
+    // can't be taken and given back between reading the top and the CAS (the
+    // ABA problem).
+    std::atomic_flag sharedLock_ = ATOMIC_FLAG_INIT;
+    static std::atomic<uint64_t> sequence_;
 };
 
 }  // namespace trantor
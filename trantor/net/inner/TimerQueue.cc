@@ -39,16 +39,17 @@ static int createTimerfd()
 
 static struct timespec howMuchTimeFromNow(const TimePoint &when)
 {
-    auto microSeconds = std::chrono::duration_cast<std::chrono::microseconds>(
-                            when - std::chrono::steady_clock::now())
-                            .count();
-    if (microSeconds < 100)
+    auto nanoSeconds = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           when - std::chrono::steady_clock::now())
+                           .count();
+    // A zero time would disarm the timerfd.
+    if (nanoSeconds < 1)
     {
-        microSeconds = 100;
+        nanoSeconds = 1;
     }
     struct timespec ts;
-    ts.tv_sec = static_cast<time_t>(microSeconds / 1000000);
-    ts.tv_nsec = static_cast<long>((microSeconds % 1000000) * 1000);
+    ts.tv_sec = static_cast<time_t>(nanoSeconds / 1000000000);
+    ts.tv_nsec = static_cast<long>(nanoSeconds % 1000000000);
     return ts;
 }
 static void resetTimerfd(int timerfd, const TimePoint &expiration)
@@ -76,27 +77,33 @@ static void readTimerfd(int timerfd, const TimePoint &)
     }
 }
 
+void TimerQueue::arm(const TimePoint &when)
+{
+    if (timerfd_ < 0)
+        return;
+    resetTimerfd(timerfd_, when);
+    armedAt_ = when;
+    increase(arms_);
+}
+
 void TimerQueue::handleRead()
 {
     loop_->assertInLoopThread();
     const auto now = std::chrono::steady_clock::now();
     readTimerfd(timerfd_, now);
+    runExpired(now);
+}
 
-    std::vector<TimerPtr> expired = getExpired(now);
-
-    callingExpiredTimers_ = true;
-    // cancelingTimers_.clear();
-    // safe to callback outside critical section
-    for (auto const &timerPtr : expired)
-    {
-        if (timerIdSet_.find(timerPtr->id()) != timerIdSet_.end())
-        {
-            timerPtr->run();
-        }
-    }
-    callingExpiredTimers_ = false;
-
-    reset(expired, now);
+void TimerQueue::disableTimerfd()
+{
+    loop_->assertInLoopThread();
+    if (timerfd_ < 0)
+        return;
+    timerfdChannelPtr_->disableAll();
+    timerfdChannelPtr_->remove();
+    ::close(timerfd_);
+    timerfd_ = -1;
+    armedAt_ = TimePoint::max();
 }
 #else
 static int64_t howMuchTimeFromNow(const TimePoint &when)
@@ -110,28 +117,66 @@ static int64_t howMuchTimeFromNow(const TimePoint &when)
     }
     return microSeconds / 1000;
 }
+#endif
+
 void TimerQueue::processTimers()
 {
     loop_->assertInLoopThread();
-    const auto now = std::chrono::steady_clock::now();
+    auto now = std::chrono::steady_clock::now();
+    // Most iterations of the loop have no expired timer.
+    if (heap_.empty() || !(heap_.front()->wakeAt() < now))
+        return;
+    runExpired(now);
+}
+
+static void spinUntil(const TimePoint &when)
+{
+    while (std::chrono::steady_clock::now() < when)
+    {
+    }
+}
 
-    std::vector<TimerPtr> expired = getExpired(now);
+void TimerQueue::runExpired(const TimePoint &now)
+{
+    sweepCancelled();
+    getExpired(now);
 
     callingExpiredTimers_ = true;
-    // cancelingTimers_.clear();
+    int activity = loop_->activity_.load(std::memory_order_relaxed);
+    loop_->activity_.store(EventLoop::kRunningTimers,
+                           std::memory_order_release);
     // safe to callback outside critical section
-    for (auto const &timerPtr : expired)
+    for (auto timer : expired_)
     {
-        if (timerIdSet_.find(timerPtr->id()) != timerIdSet_.end())
+        // A callback may invalidate the timers after it in the batch.
+        if (!isCancelled(timer))
         {
-            timerPtr->run();
+            if (timer->spin_.count() > 0)
+                spinUntil(timer->when());
+            loop_->activeTimerWhen_.store(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    timer->when().time_since_epoch())
+                    .count(),
+                std::memory_order_relaxed);
+            loop_->activeTimerInterval_.store(timer->interval_.count(),
+                                              std::memory_order_relaxed);
+            loop_->activeTimer_.store(timer->id(), std::memory_order_release);
+            timer->run();
         }
     }
+    loop_->activeTimer_.store(InvalidTimerId, std::memory_order_relaxed);
+    loop_->activity_.store(activity, std::memory_order_release);
     callingExpiredTimers_ = false;
 
-    reset(expired, now);
+    bool fired = !expired_.empty();
+    reset(now);
+    auto stats = loop_->stats();
+    if (stats && fired)
+    {
+        stats->timersTime_.recordDuration(std::chrono::steady_clock::now() -
+                                          now);
+    }
 }
-#endif
 ///////////////////////////////////////
 TimerQueue::TimerQueue(EventLoop *loop)
     : loop_(loop),
@@ -139,7 +184,6 @@ TimerQueue::TimerQueue(EventLoop *loop)
       timerfd_(createTimerfd()),
       timerfdChannelPtr_(new Channel(loop, timerfd_)),
 #endif
-      timers_(),
       callingExpiredTimers_(false)
 {
 #ifdef __linux__
@@ -153,6 +197,8 @@ TimerQueue::TimerQueue(EventLoop *loop)
 void TimerQueue::reset()
 {
     loop_->runInLoop([this]() {
+        if (timerfd_ < 0)
+            return;
         timerfdChannelPtr_->disableAll();
         timerfdChannelPtr_->remove();
         close(timerfd_);
@@ -162,17 +208,17 @@ void TimerQueue::reset()
             std::bind(&TimerQueue::handleRead, this));
         // we are always reading the timerfd, we disarm it with timerfd_settime.
         timerfdChannelPtr_->enableReading();
-        if (!timers_.empty())
-        {
-            const auto nextExpire = timers_.top()->when();
-            resetTimerfd(timerfd_, nextExpire);
-        }
+        armedAt_ = TimePoint::max();
+        if (!heap_.empty())
+            arm(heap_.front()->wakeAt() + slack());
     });
 }
 #endif
 TimerQueue::~TimerQueue()
 {
 #ifdef __linux__
+    if (timerfd_ < 0)
+        return;
     auto chlPtr = timerfdChannelPtr_;
     auto fd = timerfd_;
     loop_->runInLoop([chlPtr, fd]() {
@@ -183,112 +229,254 @@ TimerQueue::~TimerQueue()
 #endif
 }
 
-TimerId TimerQueue::addTimer(const TimerCallback &cb,
-                             const TimePoint &when,
-                             const TimeInterval &interval)
-{
-    std::shared_ptr<Timer> timerPtr =
-        std::make_shared<Timer>(cb, when, interval);
-
-    loop_->runInLoop([this, timerPtr]() { addTimerInLoop(timerPtr); });
-    return timerPtr->id();
-}
-TimerId TimerQueue::addTimer(TimerCallback &&cb,
+TimerId TimerQueue::addTimer(Task &&cb,
                              const TimePoint &when,
-                             const TimeInterval &interval)
+                             const TimeInterval &interval,
+                             const TimeInterval &spin,
+                             bool fixedRate)
 {
-    std::shared_ptr<Timer> timerPtr =
-        std::make_shared<Timer>(std::move(cb), when, interval);
-
-    loop_->runInLoop([this, timerPtr]() { addTimerInLoop(timerPtr); });
-    return timerPtr->id();
+    bool inLoop = loop_->isInLoopThread();
+    auto timer = inLoop ? pool_.allocate() : pool_.allocateShared();
+    timer->callback_ = std::move(cb);
+    timer->when_ = when;
+    timer->interval_ = interval;
+    timer->spin_ = spin;
+    timer->fixedRate_ = fixedRate;
+    auto id = timer->id_;
+    if (inLoop)
+        addTimerInLoop(timer);
+    else
+        loop_->queueInLoop([this, timer]() { addTimerInLoop(timer); });
+    return id;
 }
-void TimerQueue::addTimerInLoop(const TimerPtr &timer)
+void TimerQueue::addTimerInLoop(Timer *timer)
 {
     loop_->assertInLoopThread();
-    timerIdSet_.insert(timer->id());
+    if (isCancelled(timer))
+    {
+        // Invalidated before its insertion.
+        pool_.free(timer);
+        return;
+    }
+    sweepCancelled();
     if (insert(timer))
     {
 // the earliest timer changed
 #ifdef __linux__
-        resetTimerfd(timerfd_, timer->when());
+        // The timerfd is only re-armed if the new timer can't wait for the
+        // armed deadline within its slack. It is armed for the deadline of
+        // the timer, so the earlier timers which follow it are in its slack.
+        if (timer->wakeAt() + slack() < armedAt_)
+            arm(timer->wakeAt());
+        else if (timer->wakeAt() < armedAt_)
+            increase(armsSaved_);
 #endif
     }
 }
 
 void TimerQueue::invalidateTimer(TimerId id)
 {
-    loop_->runInLoop([this, id]() { timerIdSet_.erase(id); });
+    auto timer = pool_.find(id);
+    if (!timer)
+        return;
+    uint64_t state = timer->state_.load(std::memory_order_acquire);
+    do
+    {
+        // Expired, invalidated or never allocated.
+        if ((state & ~Timer::kInHeap) != id)
+            return;
+    } while (!timer->state_.compare_exchange_weak(state,
+                                                  state | Timer::kCancelled,
+                                                  std::memory_order_acq_rel,
+                                                  std::memory_order_acquire));
+    if (!loop_->isInLoopThread())
+    {
+        // Only the timers left in the heap count towards a sweep, a running
+        // timer or one whose insertion is queued is freed by the loop.
+        if (state & Timer::kInHeap)
+            remoteCancels_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    // A timer out of the heap is running, or its insertion is queued, it is
+    // freed then.
+    if (timer->heapIndex_ != Timer::kNotInHeap)
+        pool_.free(removeAt(timer->heapIndex_));
+}
+
+void TimerQueue::sweepCancelled()
+{
+    if (remoteCancels_.load(std::memory_order_relaxed) == 0)
+        return;
+    cancelledInHeap_ += remoteCancels_.exchange(0, std::memory_order_relaxed);
+    // Sweep when the invalidated timers are at least half of the heap, so
+    // each of them costs O(1) on average.
+    if (cancelledInHeap_ < 64 || cancelledInHeap_ * 2 < heap_.size())
+        return;
+    size_t kept = 0;
+    for (auto timer : heap_)
+    {
+        if (isCancelled(timer))
+        {
+            if (timer->isPrecise())
+                --preciseInHeap_;
+            pool_.free(timer);
+        }
+        else
+            heap_[kept++] = timer;
+    }
+    heap_.resize(kept);
+    for (size_t i = 0; i < heap_.size(); ++i)
+        heap_[i]->heapIndex_ = i;
+    for (size_t i = heap_.size() / 4 + 1; i > 0; --i)
+    {
+        if (i - 1 < heap_.size())
+            siftDown(i - 1);
+    }
+    cancelledInHeap_ = 0;
 }
 
-bool TimerQueue::insert(const TimerPtr &timerPtr)
+static const size_t kHeapArity = 4;
+
+bool TimerQueue::insert(Timer *timer)
 {
     loop_->assertInLoopThread();
-    bool earliestChanged = false;
-    if (timers_.size() == 0 || *timerPtr < *timers_.top())
+    timer->state_.fetch_or(Timer::kInHeap, std::memory_order_relaxed);
+    heap_.push_back(timer);
+    siftUp(heap_.size() - 1);
+    if (timer->isPrecise())
+        ++preciseInHeap_;
+    // Return true if the earliest timer changed.
+    return timer->heapIndex_ == 0;
+}
+
+Timer *TimerQueue::removeAt(size_t index)
+{
+    auto timer = heap_[index];
+    timer->heapIndex_ = Timer::kNotInHeap;
+    timer->state_.fetch_and(~Timer::kInHeap, std::memory_order_relaxed);
+    if (timer->isPrecise())
+        --preciseInHeap_;
+    auto last = heap_.back();
+    heap_.pop_back();
+    if (index < heap_.size())
+    {
+        // Move the last timer to the hole, then up or down.
+        heap_[index] = last;
+        if (index > 0 && *heap_[index] < *heap_[(index - 1) / kHeapArity])
+            siftUp(index);
+        else
+            siftDown(index);
+    }
+    return timer;
+}
+
+void TimerQueue::siftUp(size_t index)
+{
+    auto timer = heap_[index];
+    while (index > 0)
+    {
+        size_t parent = (index - 1) / kHeapArity;
+        if (!(*timer < *heap_[parent]))
+            break;
+        heap_[index] = heap_[parent];
+        heap_[index]->heapIndex_ = index;
+        index = parent;
+    }
+    timer->heapIndex_ = index;
+    heap_[index] = timer;
+}
+
+void TimerQueue::siftDown(size_t index)
+{
+    auto timer = heap_[index];
+    const size_t size = heap_.size();
+    while (true)
     {
-        earliestChanged = true;
+        size_t child = index * kHeapArity + 1;
+        if (child >= size)
+            break;
+        size_t last = child + kHeapArity < size ? child + kHeapArity : size;
+        for (size_t i = child + 1; i < last; ++i)
+        {
+            if (*heap_[i] < *heap_[child])
+                child = i;
+        }
+        if (!(*heap_[child] < *timer))
+            break;
+        heap_[index] = heap_[child];
+        heap_[index]->heapIndex_ = index;
+        index = child;
     }
-    timers_.push(timerPtr);
-    // std::cout<<"after push new
-    // timer:"<<timerPtr->when().microSecondsSinceEpoch()/1000000<<std::endl;
-    return earliestChanged;
+    timer->heapIndex_ = index;
+    heap_[index] = timer;
+}
+int64_t TimerQueue::getTimeoutNs(int64_t maxNs) const
+{
+    loop_->assertInLoopThread();
+    if (heap_.empty())
+        return maxNs;
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                  heap_.front()->wakeAt() + slack() -
+                  std::chrono::steady_clock::now())
+                  .count();
+    if (ns < 0)
+        return 0;
+    return ns < maxNs ? ns : maxNs;
 }
 #ifndef __linux__
 int64_t TimerQueue::getTimeout() const
 {
     loop_->assertInLoopThread();
-    if (timers_.empty())
+    if (heap_.empty())
     {
         return 10000;
     }
     else
     {
-        return howMuchTimeFromNow(timers_.top()->when());
+        return howMuchTimeFromNow(heap_.front()->wakeAt() + slack());
     }
 }
 #endif
 
-std::vector<TimerPtr> TimerQueue::getExpired(const TimePoint &now)
+void TimerQueue::getExpired(const TimePoint &now)
 {
-    std::vector<TimerPtr> expired;
-    while (!timers_.empty())
+    expired_.clear();
+    while (!heap_.empty() && heap_.front()->wakeAt() < now)
     {
-        if (timers_.top()->when() < now)
+        auto timer = removeAt(0);
+        if (isCancelled(timer))
         {
-            expired.push_back(timers_.top());
-            timers_.pop();
+            // Invalidated by another thread.
+            pool_.free(timer);
+            if (cancelledInHeap_ > 0)
+                --cancelledInHeap_;
+            continue;
         }
-        else
-            break;
+        expired_.push_back(timer);
     }
-    return expired;
 }
-void TimerQueue::reset(const std::vector<TimerPtr> &expired,
-                       const TimePoint &now)
+void TimerQueue::reset(const TimePoint &now)
 {
     loop_->assertInLoopThread();
-    for (auto const &timerPtr : expired)
+    for (auto timer : expired_)
     {
-        auto iter = timerIdSet_.find(timerPtr->id());
-        if (iter != timerIdSet_.end())
+        if (timer->isRepeat() && !isCancelled(timer))
         {
-            if (timerPtr->isRepeat())
-            {
-                timerPtr->restart(now);
-                insert(timerPtr);
-            }
-            else
-            {
-                timerIdSet_.erase(iter);
-            }
+            timer->restart(now);
+            insert(timer);
+            continue;
         }
+        // The invalidateTimer() that races with this doesn't matter, it sees
+        // the state of a free timer or of a later one.
+        pool_.free(timer);
     }
+    expired_.clear();
 #ifdef __linux__
-    if (!timers_.empty())
-    {
-        const auto nextExpire = timers_.top()->when();
-        resetTimerfd(timerfd_, nextExpire);
-    }
+    // The timerfd has fired, it isn't armed anymore.
+    armedAt_ = TimePoint::max();
+    // Armed for the latest time the earliest timer may fire, all the timers
+    // whose deadlines are before then fire in the same wakeup.
+    if (!heap_.empty())
+        arm(heap_.front()->wakeAt() + slack());
 #endif
 }
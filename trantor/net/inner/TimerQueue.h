@@ -17,60 +17,110 @@
 #include <trantor/utils/NonCopyable.h>
 #include <trantor/net/callbacks.h>
 #include "Timer.h"
-#include <queue>
 #include <memory>
 #include <atomic>
-#include <unordered_set>
+#include <vector>
 namespace trantor
 {
 // class Timer;
 class EventLoop;
 class Channel;
-using TimerPtr = std::shared_ptr<Timer>;
-struct TimerPtrComparer
-{
-    bool operator()(const TimerPtr &x, const TimerPtr &y) const
-    {
-        return *x > *y;
-    }
-};
 
 class TimerQueue : NonCopyable
 {
   public:
     explicit TimerQueue(EventLoop *loop);
     ~TimerQueue();
-    TimerId addTimer(const TimerCallback &cb,
-                     const TimePoint &when,
-                     const TimeInterval &interval);
-    TimerId addTimer(TimerCallback &&cb,
+    // In the thread of the loop, the timer is inserted at once.
+    TimerId addTimer(Task &&cb,
                      const TimePoint &when,
-                     const TimeInterval &interval);
-    void addTimerInLoop(const TimerPtr &timer);
+                     const TimeInterval &interval,
+                     const TimeInterval &spin = TimeInterval(0),
+                     bool fixedRate = false);
+    // Any thread, the timer doesn't run once this method returns unless its
+    // callback is already running.
     void invalidateTimer(TimerId id);
+    // The thread of the loop.
+    void setSlack(const TimeInterval &slack)
+    {
+        slack_ = slack;
+    }
+    // Any thread, the number of times the timer was armed, and the number of
+    // new earliest timers which didn't re-arm it thanks to the slack.
+    uint64_t arms() const
+    {
+        return arms_.load(std::memory_order_relaxed);
+    }
+    uint64_t armsSaved() const
+    {
+        return armsSaved_.load(std::memory_order_relaxed);
+    }
 #ifdef __linux__
     void reset();
+    // The thread of the loop. The timers are then run by processTimers(),
+    // the loop waits in the poller for at most getTimeoutNs().
+    void disableTimerfd();
 #else
     int64_t getTimeout() const;
-    void processTimers();
 #endif
+    // The thread of the loop, the time until the next timer is due, at most
+    // maxNs.
+    int64_t getTimeoutNs(int64_t maxNs) const;
+    void processTimers();
   protected:
     EventLoop *loop_;
 #ifdef __linux__
+    // -1 once the timerfd is disabled.
     int timerfd_;
     std::shared_ptr<Channel> timerfdChannelPtr_;
+    // The deadline the timerfd is armed for, max() if it isn't armed. It
+    // stays armed for an invalidated timer, which only costs a wakeup.
+    TimePoint armedAt_{TimePoint::max()};
+    void arm(const TimePoint &when);
     void handleRead();
 #endif
-    std::priority_queue<TimerPtr, std::vector<TimerPtr>, TimerPtrComparer>
-        timers_;
+    // A timer may fire up to slack_ after its deadline, so the timers in a
+    // window of slack_ share one wakeup.
+    TimeInterval slack_{0};
+    // The slack doesn't apply while the heap has precise timers.
+    size_t preciseInHeap_{0};
+    TimeInterval slack() const
+    {
+        return preciseInHeap_ == 0 ? slack_ : TimeInterval(0);
+    }
+    // Only written by the thread of the loop.
+    std::atomic<uint64_t> arms_{0};
+    std::atomic<uint64_t> armsSaved_{0};
+    static void increase(std::atomic<uint64_t> &counter)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + 1,
+                      std::memory_order_relaxed);
+    }
+    TimerPool pool_;
+    // A 4-ary min-heap of the pending timers. Each timer knows its index, so
+    // a timer invalidated in the loop is removed at once instead of staying
+    // in the heap until its deadline.
+    std::vector<Timer *> heap_;
+    // The timers invalidated by other threads are left in the heap, they are
+    // counted here and swept when they are too many.
+    std::atomic<size_t> remoteCancels_{0};
+    size_t cancelledInHeap_{0};
+    std::vector<Timer *> expired_;
 
     bool callingExpiredTimers_;
-    bool insert(const TimerPtr &timePtr);
-    std::vector<TimerPtr> getExpired();
-    void reset(const std::vector<TimerPtr> &expired, const TimePoint &now);
-    std::vector<TimerPtr> getExpired(const TimePoint &now);
-
-  private:
-    std::unordered_set<uint64_t> timerIdSet_;
+    void addTimerInLoop(Timer *timer);
+    bool insert(Timer *timer);
+    Timer *removeAt(size_t index);
+    void siftUp(size_t index);
+    void siftDown(size_t index);
+    void sweepCancelled();
+    static bool isCancelled(const Timer *timer)
+    {
+        return (timer->state_.load(std::memory_order_acquire) &
+                Timer::kCancelled) != 0;
+    }
+    void runExpired(const TimePoint &now);
+    void reset(const TimePoint &now);
+    void getExpired(const TimePoint &now);
 };
 }  // namespace trantor
@@ -18,6 +18,7 @@
 #ifdef __linux__
 #include <poll.h>
 #include <sys/epoll.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 #include <assert.h>
 #include <strings.h>
@@ -81,6 +82,44 @@ void EpollPoller::poll(int timeoutMs, ChannelList *activeChannels)
                                  &*events_.begin(),
                                  static_cast<int>(events_.size()),
                                  timeoutMs);
+    handleResult(numEvents, activeChannels);
+}
+#ifdef __linux__
+void EpollPoller::pollNs(int64_t timeoutNs, ChannelList *activeChannels)
+{
+#ifdef SYS_epoll_pwait2
+    if (timeoutNs > 0 && timeoutNs % 1000000 != 0 && hasPwait2_)
+    {
+        // The layout of struct __kernel_timespec, which the syscall takes on
+        // all architectures.
+        struct
+        {
+            int64_t tv_sec;
+            int64_t tv_nsec;
+        } ts;
+        ts.tv_sec = timeoutNs / 1000000000;
+        ts.tv_nsec = timeoutNs % 1000000000;
+        int numEvents =
+            static_cast<int>(::syscall(SYS_epoll_pwait2,
+                                       epollfd_,
+                                       &*events_.begin(),
+                                       static_cast<int>(events_.size()),
+                                       &ts,
+                                       nullptr,
+                                       0));
+        if (numEvents >= 0 || errno != ENOSYS)
+        {
+            handleResult(numEvents, activeChannels);
+            return;
+        }
+        hasPwait2_ = false;
+    }
+#endif
+    Poller::pollNs(timeoutNs, activeChannels);
+}
+#endif
+void EpollPoller::handleResult(int numEvents, ChannelList *activeChannels)
+{
     int savedErrno = errno;
     // Timestamp now(Timestamp::now());
     if (numEvents > 0)
@@ -203,6 +242,10 @@ void EpollPoller::update(int operation, Channel *channel)
     struct epoll_event event;
     memset(&event, 0, sizeof(event));
     event.events = channel->events();
+#ifdef __linux__
+    if (channel->isEdgeTriggered())
+        event.events |= EPOLLET;
+#endif
     event.data.ptr = channel;
     int fd = channel->fd();
     if (::epoll_ctl(epollfd_, operation, fd, &event) < 0)
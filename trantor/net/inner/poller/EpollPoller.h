@@ -33,6 +33,10 @@ class EpollPoller : public Poller
     explicit EpollPoller(EventLoop *loop);
     virtual ~EpollPoller();
     virtual void poll(int timeoutMs, ChannelList *activeChannels) override;
+#ifdef __linux__
+    virtual void pollNs(int64_t timeoutNs,
+                        ChannelList *activeChannels) override;
+#endif
     virtual void updateChannel(Channel *channel) override;
     virtual void removeChannel(Channel *channel) override;
 #ifdef _WIN32
@@ -51,6 +55,8 @@ class EpollPoller : public Poller
     EventCallback eventCallback_{[](uint64_t event) {}};
 #else
     int epollfd_;
+    // Whether the kernel has epoll_pwait2(), since Linux 5.11.
+    bool hasPwait2_{true};
 #endif
     EventList events_;
     void update(int operation, Channel *channel);
@@ -59,6 +65,7 @@ class EpollPoller : public Poller
     ChannelMap channels_;
 #endif
     void fillActiveChannels(int numEvents, ChannelList *activeChannels) const;
+    void handleResult(int numEvents, ChannelList *activeChannels);
 #endif
 };
 }  // namespace trantor
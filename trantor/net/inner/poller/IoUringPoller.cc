@@ -0,0 +1,555 @@
+/**
+ *
+ *  IoUringPoller.cc
+ *  An Tao
+ *
+ *  Copyright 2021, An Tao.  All rights reserved.
+ *  https://github.com/an-tao/trantor
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the License file.
+ *
+ *  Trantor
+ *
+ */
+
+#include "IoUringPoller.h"
+#include "Channel.h"
+#include <assert.h>
+#if defined __linux__ && defined USE_IO_URING
+#include <trantor/utils/Logger.h>
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <algorithm>
+#endif
+namespace trantor
+{
+#if defined __linux__ && defined USE_IO_URING
+namespace
+{
+const int kNew = -1;
+const int kAdded = 1;
+
+// user_data of SQEs whose completions are of no interest (poll removals).
+const uint64_t kIgnoredUserData = ~static_cast<uint64_t>(0);
+
+inline uint64_t makeUserData(int fd, uint32_t seq)
+{
+    return (static_cast<uint64_t>(fd) << 32) | seq;
+}
+
+inline int ioUringSetup(unsigned entries, struct io_uring_params *params)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+inline int ioUringEnter(int fd,
+                        unsigned toSubmit,
+                        unsigned minComplete,
+                        unsigned flags,
+                        const void *arg,
+                        size_t argSize)
+{
+    return static_cast<int>(::syscall(
+        __NR_io_uring_enter, fd, toSubmit, minComplete, flags, arg, argSize));
+}
+
+struct RingFeatures
+{
+    bool supported{false};
+    bool multishotPoll{false};
+};
+
+// Multishot polls came with Linux 5.13 and have no feature flag of their own,
+// older kernels fail them with -EINVAL. So arm one on an eventfd, which is
+// always writable, and see what completes.
+bool probeMultishotPoll(int ringFd, const struct io_uring_params &params)
+{
+    size_t sqRingSize =
+        params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cqRingSize =
+        params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    size_t ringSize = std::max(sqRingSize, cqRingSize);
+    void *ringPtr = ::mmap(nullptr,
+                           ringSize,
+                           PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE,
+                           ringFd,
+                           IORING_OFF_SQ_RING);
+    if (ringPtr == MAP_FAILED)
+        return false;
+    size_t sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqes = ::mmap(nullptr,
+                        sqesSize,
+                        PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE,
+                        ringFd,
+                        IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+    {
+        ::munmap(ringPtr, ringSize);
+        return false;
+    }
+    bool supported = false;
+    int evfd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (evfd >= 0)
+    {
+        auto base = static_cast<char *>(ringPtr);
+        auto sqTail = reinterpret_cast<unsigned *>(base + params.sq_off.tail);
+        auto sqMask =
+            reinterpret_cast<unsigned *>(base + params.sq_off.ring_mask);
+        auto sqArray = reinterpret_cast<unsigned *>(base + params.sq_off.array);
+        auto cqHead = reinterpret_cast<unsigned *>(base + params.cq_off.head);
+        auto cqTail = reinterpret_cast<unsigned *>(base + params.cq_off.tail);
+        auto cqMask =
+            reinterpret_cast<unsigned *>(base + params.cq_off.ring_mask);
+        auto cqes =
+            reinterpret_cast<struct io_uring_cqe *>(base + params.cq_off.cqes);
+
+        unsigned tail = *sqTail;
+        unsigned index = tail & *sqMask;
+        auto sqe = static_cast<struct io_uring_sqe *>(sqes) + index;
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = evfd;
+        sqe->len = IORING_POLL_ADD_MULTI;
+        uint32_t events = POLLOUT;
+#if __BYTE_ORDER == __BIG_ENDIAN
+        events = (events << 16) | (events >> 16);
+#endif
+        sqe->poll32_events = events;
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+        if (ioUringEnter(ringFd, 1, 1, IORING_ENTER_GETEVENTS, nullptr, 0) >=
+            0)
+        {
+            unsigned head = *cqHead;
+            if (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+            {
+                const struct io_uring_cqe *cqe = &cqes[head & *cqMask];
+                supported = cqe->res >= 0 && (cqe->flags & IORING_CQE_F_MORE);
+            }
+        }
+        ::close(evfd);
+    }
+    ::munmap(sqes, sqesSize);
+    ::munmap(ringPtr, ringSize);
+    return supported;
+}
+
+const RingFeatures &ringFeatures()
+{
+    static const RingFeatures features = []() {
+        RingFeatures result;
+        struct io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        int fd = ioUringSetup(4, &params);
+        if (fd < 0)
+            return result;
+        result.supported = (params.features & IORING_FEAT_SINGLE_MMAP) &&
+                           (params.features & IORING_FEAT_NODROP) &&
+                           (params.features & IORING_FEAT_EXT_ARG);
+        if (result.supported)
+            result.multishotPoll = probeMultishotPoll(fd, params);
+        ::close(fd);
+        return result;
+    }();
+    return features;
+}
+}  // namespace
+
+bool IoUringPoller::isSupported()
+{
+    return ringFeatures().supported;
+}
+
+IoUringPoller::IoUringPoller(EventLoop *loop)
+    : Poller(loop), multishot_(ringFeatures().multishotPoll)
+{
+    if (!setupRing())
+    {
+        LOG_SYSERR << "IoUringPoller: failed to set up the ring";
+        abort();
+    }
+}
+
+IoUringPoller::~IoUringPoller()
+{
+    closeRing();
+}
+
+bool IoUringPoller::setupRing()
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = kCqEntries;
+    ringFd_ = ioUringSetup(kSqEntries, &params);
+    if (ringFd_ < 0)
+        return false;
+    ::fcntl(ringFd_, F_SETFD, FD_CLOEXEC);
+    sqEntries_ = params.sq_entries;
+    skipRemoveCqe_ = (params.features & IORING_FEAT_CQE_SKIP) != 0;
+
+    size_t sqRingSize =
+        params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cqRingSize =
+        params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ringSize_ = std::max(sqRingSize, cqRingSize);
+    ringPtr_ = ::mmap(nullptr,
+                      ringSize_,
+                      PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE,
+                      ringFd_,
+                      IORING_OFF_SQ_RING);
+    if (ringPtr_ == MAP_FAILED)
+    {
+        ringPtr_ = nullptr;
+        closeRing();
+        return false;
+    }
+    sqesSize_ = params.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqes = ::mmap(nullptr,
+                        sqesSize_,
+                        PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE,
+                        ringFd_,
+                        IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+    {
+        closeRing();
+        return false;
+    }
+    sqes_ = static_cast<struct io_uring_sqe *>(sqes);
+
+    auto base = static_cast<char *>(ringPtr_);
+    sqHead_ = reinterpret_cast<unsigned *>(base + params.sq_off.head);
+    sqTail_ = reinterpret_cast<unsigned *>(base + params.sq_off.tail);
+    sqMask_ = reinterpret_cast<unsigned *>(base + params.sq_off.ring_mask);
+    sqArray_ = reinterpret_cast<unsigned *>(base + params.sq_off.array);
+    cqHead_ = reinterpret_cast<unsigned *>(base + params.cq_off.head);
+    cqTail_ = reinterpret_cast<unsigned *>(base + params.cq_off.tail);
+    cqMask_ = reinterpret_cast<unsigned *>(base + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<struct io_uring_cqe *>(base + params.cq_off.cqes);
+    sqLocalTail_ = *sqTail_;
+    return true;
+}
+
+void IoUringPoller::closeRing()
+{
+    if (sqes_)
+    {
+        ::munmap(sqes_, sqesSize_);
+        sqes_ = nullptr;
+    }
+    if (ringPtr_)
+    {
+        ::munmap(ringPtr_, ringSize_);
+        ringPtr_ = nullptr;
+    }
+    if (ringFd_ >= 0)
+    {
+        ::close(ringFd_);
+        ringFd_ = -1;
+    }
+}
+
+void IoUringPoller::resetAfterFork()
+{
+    // The ring is shared with the parent process after fork(), so build a new
+    // one and arm every registered channel on it again.
+    closeRing();
+    if (!setupRing())
+    {
+        LOG_SYSERR << "IoUringPoller: failed to set up the ring";
+        abort();
+    }
+    dirtyFds_.clear();
+    for (size_t fd = 0; fd < entries_.size(); ++fd)
+    {
+        auto &entry = entries_[fd];
+        entry.armed = false;
+        entry.dirty = false;
+        if (entry.channel)
+            markDirty(static_cast<int>(fd));
+    }
+}
+
+struct io_uring_sqe *IoUringPoller::getSqe()
+{
+    unsigned head = __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+    if (sqLocalTail_ - head >= sqEntries_)
+    {
+        // The submission queue is full, hand what we have to the kernel.
+        enter(0, 0);
+        head = __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+        if (sqLocalTail_ - head >= sqEntries_)
+            return nullptr;
+    }
+    unsigned index = sqLocalTail_ & *sqMask_;
+    struct io_uring_sqe *sqe = &sqes_[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqArray_[index] = index;
+    ++sqLocalTail_;
+    return sqe;
+}
+
+void IoUringPoller::enter(unsigned minComplete, int64_t timeoutNs)
+{
+    __atomic_store_n(sqTail_, sqLocalTail_, __ATOMIC_RELEASE);
+    unsigned toSubmit =
+        sqLocalTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+    if (toSubmit == 0 && minComplete == 0)
+        return;
+    unsigned flags = 0;
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    if (minComplete > 0)
+    {
+        flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+        if (timeoutNs >= 0)
+        {
+            ts.tv_sec = timeoutNs / 1000000000;
+            ts.tv_nsec = timeoutNs % 1000000000;
+            arg.ts = reinterpret_cast<uint64_t>(&ts);
+        }
+    }
+    int ret = ioUringEnter(ringFd_,
+                           toSubmit,
+                           minComplete,
+                           flags,
+                           minComplete > 0 ? &arg : nullptr,
+                           minComplete > 0 ? sizeof(arg) : 0);
+    if (ret < 0 && errno != ETIME && errno != EINTR && errno != EBUSY &&
+        errno != EAGAIN)
+    {
+        LOG_SYSERR << "IoUringPoller::poll()";
+    }
+}
+
+void IoUringPoller::markDirty(int fd)
+{
+    auto &entry = entries_[fd];
+    if (!entry.dirty)
+    {
+        entry.dirty = true;
+        dirtyFds_.push_back(fd);
+    }
+}
+
+void IoUringPoller::armPoll(int fd,
+                            PollEntry &entry,
+                            uint32_t events,
+                            bool multishot)
+{
+    struct io_uring_sqe *sqe = getSqe();
+    if (!sqe)
+    {
+        // Try again on the next call to poll().
+        markDirty(fd);
+        return;
+    }
+    ++entry.seq;
+    entry.armed = true;
+    entry.armedEvents = events;
+    entry.armedMultishot = multishot;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    if (multishot)
+        sqe->len = IORING_POLL_ADD_MULTI;
+#if __BYTE_ORDER == __BIG_ENDIAN
+    events = (events << 16) | (events >> 16);
+#endif
+    sqe->poll32_events = events;
+    sqe->user_data = makeUserData(fd, entry.seq);
+}
+
+void IoUringPoller::cancelPoll(int fd, PollEntry &entry)
+{
+    struct io_uring_sqe *sqe = getSqe();
+    if (!sqe)
+    {
+        LOG_ERROR << "IoUringPoller: no SQE to remove the poll on fd " << fd;
+        return;
+    }
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = makeUserData(fd, entry.seq);
+    sqe->user_data = kIgnoredUserData;
+    if (skipRemoveCqe_)
+        sqe->flags |= IOSQE_CQE_SKIP_SUCCESS;
+    // Completions of the removed request carry the old sequence number and
+    // are dropped in fillActiveChannels().
+    ++entry.seq;
+    entry.armed = false;
+    entry.armedEvents = 0;
+}
+
+void IoUringPoller::flushChanges()
+{
+    // Swap out the list first: armPoll() may put an fd back when the
+    // submission queue is exhausted.
+    std::vector<int> dirtyFds;
+    dirtyFds.swap(dirtyFds_);
+    for (int fd : dirtyFds)
+    {
+        auto &entry = entries_[fd];
+        entry.dirty = false;
+        uint32_t wanted = entry.channel
+                              ? static_cast<uint32_t>(entry.channel->events())
+                              : 0;
+        // Without multishot polls, edge-triggered channels are polled like
+        // level-triggered ones, which only costs some extra wakeups.
+        bool multishot =
+            multishot_ && entry.channel && entry.channel->isEdgeTriggered();
+        if (entry.armed && (entry.armedEvents != wanted ||
+                            entry.armedMultishot != multishot))
+        {
+            cancelPoll(fd, entry);
+        }
+        if (!entry.armed && wanted != 0)
+        {
+            armPoll(fd, entry, wanted, multishot);
+        }
+    }
+    dirtyFds.clear();
+    if (dirtyFds_.empty())
+        dirtyFds_.swap(dirtyFds);
+}
+
+void IoUringPoller::poll(int timeoutMs, ChannelList *activeChannels)
+{
+    pollNs(timeoutMs < 0 ? -1 : static_cast<int64_t>(timeoutMs) * 1000000,
+           activeChannels);
+}
+
+void IoUringPoller::pollNs(int64_t timeoutNs, ChannelList *activeChannels)
+{
+    flushChanges();
+    unsigned head = *cqHead_;
+    unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+    // Don't wait if there are completions left over from the last round.
+    enter(head == tail ? 1 : 0, timeoutNs);
+    fillActiveChannels(activeChannels);
+}
+
+void IoUringPoller::fillActiveChannels(ChannelList *activeChannels)
+{
+    // A multishot poll may have completed more than once since the last
+    // round, merge the events of such completions so that each channel is
+    // handled at most once per batch.
+    if (++batch_ == 0)
+        ++batch_;
+    unsigned head = *cqHead_;
+    unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head)
+    {
+        const struct io_uring_cqe *cqe = &cqes_[head & *cqMask_];
+        if (cqe->user_data == kIgnoredUserData)
+            continue;
+        int fd = static_cast<int>(cqe->user_data >> 32);
+        uint32_t seq = static_cast<uint32_t>(cqe->user_data);
+        if (fd < 0 || static_cast<size_t>(fd) >= entries_.size())
+            continue;
+        auto &entry = entries_[fd];
+        if (!entry.armed || entry.seq != seq || !entry.channel)
+            continue;
+        if (!(cqe->flags & IORING_CQE_F_MORE))
+        {
+            // One-shot poll (or a multishot one the kernel has terminated),
+            // re-arm it after the channel has been handled.
+            entry.armed = false;
+            entry.armedEvents = 0;
+            markDirty(fd);
+        }
+        int revents = cqe->res;
+        if (revents < 0)
+        {
+            if (revents == -ECANCELED)
+                continue;
+            errno = -revents;
+            LOG_SYSERR << "IoUringPoller: poll on fd " << fd << " failed";
+            revents = POLLERR;
+        }
+        if (entry.batch == batch_)
+        {
+            entry.channel->setRevents(entry.channel->revents() | revents);
+            continue;
+        }
+        entry.batch = batch_;
+        entry.channel->setRevents(revents);
+        activeChannels->push_back(entry.channel);
+    }
+    __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+}
+
+void IoUringPoller::updateChannel(Channel *channel)
+{
+    assertInLoopThread();
+    int fd = channel->fd();
+    assert(fd >= 0);
+    if (static_cast<size_t>(fd) >= entries_.size())
+    {
+        entries_.resize(std::max(static_cast<size_t>(fd) + 1,
+                                 entries_.size() * 2));
+    }
+    auto &entry = entries_[fd];
+    assert(entry.channel == nullptr || entry.channel == channel);
+    if (channel->index() == kNew)
+    {
+        channel->setIndex(kAdded);
+    }
+    entry.channel = channel;
+    markDirty(fd);
+}
+
+void IoUringPoller::removeChannel(Channel *channel)
+{
+    assertInLoopThread();
+    assert(channel->isNoneEvent());
+    int fd = channel->fd();
+    assert(static_cast<size_t>(fd) < entries_.size());
+    auto &entry = entries_[fd];
+    assert(entry.channel == channel);
+    if (entry.armed)
+    {
+        cancelPoll(fd, entry);
+    }
+    entry.channel = nullptr;
+    channel->setIndex(kNew);
+}
+#else
+IoUringPoller::IoUringPoller(EventLoop *loop) : Poller(loop)
+{
+    assert(false);
+}
+IoUringPoller::~IoUringPoller()
+{
+}
+bool IoUringPoller::isSupported()
+{
+    return false;
+}
+void IoUringPoller::poll(int, ChannelList *)
+{
+}
+void IoUringPoller::pollNs(int64_t, ChannelList *)
+{
+}
+void IoUringPoller::updateChannel(Channel *)
+{
+}
+void IoUringPoller::removeChannel(Channel *)
+{
+}
+void IoUringPoller::resetAfterFork()
+{
+}
+#endif
+}  // namespace trantor
@@ -0,0 +1,108 @@
+/**
+ *
+ *  IoUringPoller.h
+ *  An Tao
+ *
+ *  Copyright 2021, An Tao.  All rights reserved.
+ *  https://github.com/an-tao/trantor
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the License file.
+ *
+ *  Trantor
+ *
+ */
+
+#pragma once
+#include "../Poller.h"
+#include <trantor/utils/NonCopyable.h>
+#include <trantor/net/EventLoop.h>
+
+#if defined __linux__ && defined USE_IO_URING
+#include <vector>
+struct io_uring_sqe;
+struct io_uring_cqe;
+#endif
+namespace trantor
+{
+class Channel;
+
+/**
+ * @brief A poller based on io_uring. Interest changes are queued as poll
+ * SQEs and handed to the kernel together with the wait for completions, so
+ * enabling or disabling writing on a channel costs no syscall of its own.
+ *
+ * Poll requests of level-triggered channels are one-shot and are re-armed on
+ * the next call to poll() after the channel has been handled. A re-armed poll
+ * completes immediately if the fd is still ready, which keeps the
+ * level-triggered semantics that the Channel interface provides with epoll.
+ * Edge-triggered channels use multishot polls that stay armed, on kernels
+ * before 5.13, which lack them, they are polled one-shot as well.
+ */
+class IoUringPoller : public Poller
+{
+  public:
+    explicit IoUringPoller(EventLoop *loop);
+    virtual ~IoUringPoller();
+    virtual void poll(int timeoutMs, ChannelList *activeChannels) override;
+    virtual void pollNs(int64_t timeoutNs,
+                        ChannelList *activeChannels) override;
+    virtual void updateChannel(Channel *channel) override;
+    virtual void removeChannel(Channel *channel) override;
+    virtual void resetAfterFork() override;
+
+    /**
+     * @brief Check whether the running kernel provides the io_uring features
+     * this poller relies on. The result is cached after the first call.
+     */
+    static bool isSupported();
+
+  private:
+#if defined __linux__ && defined USE_IO_URING
+    static const unsigned kSqEntries = 256;
+    static const unsigned kCqEntries = 4 * kSqEntries;
+
+    struct PollEntry
+    {
+        Channel *channel{nullptr};
+        uint32_t seq{0};
+        uint32_t batch{0};
+        uint32_t armedEvents{0};
+        bool armed{false};
+        bool armedMultishot{false};
+        bool dirty{false};
+    };
+    int ringFd_{-1};
+    void *ringPtr_{nullptr};
+    size_t ringSize_{0};
+    struct io_uring_sqe *sqes_{nullptr};
+    size_t sqesSize_{0};
+    unsigned *sqHead_{nullptr};
+    unsigned *sqTail_{nullptr};
+    unsigned *sqMask_{nullptr};
+    unsigned *sqArray_{nullptr};
+    unsigned sqEntries_{0};
+    unsigned sqLocalTail_{0};
+    unsigned *cqHead_{nullptr};
+    unsigned *cqTail_{nullptr};
+    unsigned *cqMask_{nullptr};
+    struct io_uring_cqe *cqes_{nullptr};
+    bool skipRemoveCqe_{false};
+    bool multishot_{false};
+    uint32_t batch_{0};
+
+    std::vector<PollEntry> entries_;
+    std::vector<int> dirtyFds_;
+
+    bool setupRing();
+    void closeRing();
+    struct io_uring_sqe *getSqe();
+    void enter(unsigned minComplete, int64_t timeoutNs);
+    void markDirty(int fd);
+    void flushChanges();
+    void armPoll(int fd, PollEntry &entry, uint32_t events, bool multishot);
+    void cancelPoll(int fd, PollEntry &entry);
+    void fillActiveChannels(ChannelList *activeChannels);
+#endif
+};
+
+}  // namespace trantor
@@ -179,13 +179,14 @@ void KQueue::update(Channel *channel)
 
     auto fd = channel->fd();
     channels_[fd] = {events, channel};
+    unsigned short clearFlag = channel->isEdgeTriggered() ? EV_CLEAR : 0;
 
     if ((events & Channel::kReadEvent) && (!(oldEvents & Channel::kReadEvent)))
     {
         EV_SET(&ev[n++],
                fd,
                EVFILT_READ,
-               EV_ADD | EV_ENABLE,
+               EV_ADD | EV_ENABLE | clearFlag,
                0,
                0,
                (void *)(intptr_t)channel);
@@ -207,7 +208,7 @@ void KQueue::update(Channel *channel)
         EV_SET(&ev[n++],
                fd,
                EVFILT_WRITE,
-               EV_ADD | EV_ENABLE,
+               EV_ADD | EV_ENABLE | clearFlag,
                0,
                0,
                (void *)(intptr_t)channel);
@@ -0,0 +1,83 @@
+#include <trantor/net/TcpServer.h>
+#include <trantor/net/EventLoopThread.h>
+#include <trantor/utils/Logger.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <stdlib.h>
+
+using namespace trantor;
+using namespace std::chrono;
+
+const size_t kConnections = 20000;
+const size_t kBurst = 256;
+
+// Connect the clients in bursts of non-blocking connects, wait for the server
+// to accept each burst and reset the connections so that no port is left in
+// TIME_WAIT. Return the number of connections accepted per second.
+double storm(size_t maxAccepts)
+{
+    EventLoopThread serverThread;
+    serverThread.run();
+    auto serverLoop = serverThread.getLoop();
+    TcpServer server(serverLoop, InetAddress(0), "storm");
+    server.setIoLoopNum(1);
+    server.setMaxAcceptsPerWakeup(maxAccepts);
+    std::atomic<size_t> accepted{0};
+    server.setConnectionCallback([&accepted](const TcpConnectionPtr &conn) {
+        if (conn->connected())
+            ++accepted;
+    });
+    server.start();
+    std::promise<void> listening;
+    serverLoop->queueInLoop([&listening]() { listening.set_value(); });
+    listening.get_future().wait();
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(server.address().toPort());
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    linger reset{1, 0};
+    auto start = steady_clock::now();
+    std::vector<int> fds;
+    for (size_t sent = 0; sent < kConnections; sent += kBurst)
+    {
+        for (size_t i = 0; i < kBurst; ++i)
+        {
+            int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+            setsockopt(fd, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+            connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+            fds.push_back(fd);
+        }
+        while (accepted < sent + kBurst)
+            std::this_thread::yield();
+        for (auto fd : fds)
+            close(fd);
+        fds.clear();
+    }
+    auto seconds = duration<double>(steady_clock::now() - start).count();
+    server.stop();
+    serverLoop->quit();
+    serverThread.wait();
+    return accepted / seconds;
+}
+
+int main(int argc, char *argv[])
+{
+    Logger::setLogLevel(Logger::kWarn);
+    size_t maxAccepts = 64;
+    if (argc > 1)
+        maxAccepts = atoi(argv[1]);
+    std::cout << "1 accept per wakeup: " << static_cast<size_t>(storm(1))
+              << " connections/s" << std::endl;
+    auto rate = static_cast<size_t>(storm(maxAccepts));
+    std::cout << maxAccepts << " accepts per wakeup: " << rate
+              << " connections/s" << std::endl;
+}
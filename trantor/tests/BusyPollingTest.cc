@@ -0,0 +1,124 @@
+#include <trantor/net/TcpServer.h>
+#include <trantor/net/TcpClient.h>
+#include <trantor/net/EventLoopThread.h>
+#include <trantor/utils/Logger.h>
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+
+using namespace trantor;
+using namespace std::chrono;
+
+// Measure the round trip time of a small message between a client loop and a
+// server loop.
+static std::promise<void> *serverConnectionClosed{nullptr};
+
+static std::vector<int64_t> pingpong(EventLoop *clientLoop,
+                                     uint16_t port,
+                                     size_t rounds)
+{
+    std::promise<void> closed;
+    serverConnectionClosed = &closed;
+    const size_t kMessageSize = 64;
+    std::vector<int64_t> rtts;
+    rtts.reserve(rounds);
+    std::promise<void> done;
+    std::string message(kMessageSize, 'p');
+    steady_clock::time_point sendTime;
+    auto client = std::make_shared<TcpClient>(clientLoop,
+                                              InetAddress("127.0.0.1", port),
+                                              "pingpong");
+    client->setConnectionCallback([&](const TcpConnectionPtr &conn) {
+        if (conn->connected())
+        {
+            sendTime = steady_clock::now();
+            conn->send(message);
+        }
+    });
+    client->setMessageCallback([&](const TcpConnectionPtr &conn,
+                                   MsgBuffer *buf) {
+        if (buf->readableBytes() < kMessageSize)
+            return;
+        buf->retrieve(kMessageSize);
+        rtts.push_back(
+            duration_cast<nanoseconds>(steady_clock::now() - sendTime)
+                .count());
+        if (rtts.size() == rounds)
+        {
+            conn->shutdown();
+            done.set_value();
+            return;
+        }
+        sendTime = steady_clock::now();
+        conn->send(message);
+    });
+    client->connect();
+    done.get_future().wait();
+    std::promise<void> destroyed;
+    clientLoop->runInLoop([&client, &destroyed]() {
+        client.reset();
+        destroyed.set_value();
+    });
+    destroyed.get_future().wait();
+    closed.get_future().wait();
+    return rtts;
+}
+
+static void report(const char *mode, std::vector<int64_t> &rtts)
+{
+    std::sort(rtts.begin(), rtts.end());
+    auto percentile = [&rtts](double p) {
+        return rtts[static_cast<size_t>(p * (rtts.size() - 1))] / 1000.0;
+    };
+    std::cout << "busy polling " << mode << ": " << rtts.size()
+              << " round trips, p50=" << percentile(0.5)
+              << "us p99=" << percentile(0.99) << "us" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    Logger::setLogLevel(Logger::kWarn);
+    size_t rounds = 20000;
+    if (argc > 1)
+        rounds = atoi(argv[1]);
+    const uint16_t port = 8890;
+    EventLoopThread serverThread;
+    EventLoopThread clientThread;
+    serverThread.run();
+    clientThread.run();
+    auto serverLoop = serverThread.getLoop();
+    auto clientLoop = clientThread.getLoop();
+    TcpServer server(serverLoop, InetAddress(port), "pingpong");
+    server.setRecvMessageCallback(
+        [](const TcpConnectionPtr &conn, MsgBuffer *buf) {
+            conn->send(buf->peek(), buf->readableBytes());
+            buf->retrieveAll();
+        });
+    server.setConnectionCallback([](const TcpConnectionPtr &conn) {
+        if (conn->disconnected())
+            serverConnectionClosed->set_value();
+    });
+    server.start();
+    // The server starts listening in its loop.
+    std::promise<void> listening;
+    serverLoop->queueInLoop([&listening]() { listening.set_value(); });
+    listening.get_future().wait();
+
+    auto off = pingpong(clientLoop, port, rounds);
+    report("off", off);
+
+    serverLoop->enableBusyPolling();
+    clientLoop->enableBusyPolling();
+    auto on = pingpong(clientLoop, port, rounds);
+    report("on", on);
+
+    serverLoop->runInLoop([&server, serverLoop]() {
+        server.stop();
+        serverLoop->quit();
+    });
+    serverThread.wait();
+}
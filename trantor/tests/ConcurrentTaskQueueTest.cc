@@ -4,6 +4,7 @@
 #include <atomic>
 #include <thread>
 #include <chrono>
+#include <memory>
 #include <time.h>
 #include <stdio.h>
 using namespace std::chrono_literals;
@@ -32,6 +33,12 @@ int main()
         }
     });
 
+    // Tasks which can't be copied are accepted too.
+    std::unique_ptr<int> value(new int(42));
+    queue.runTaskInQueue([v = std::move(value)]() {
+        LOG_DEBUG << "move-only task, value=" << *v;
+    });
+
     getc(stdin);
     LOG_DEBUG << "sum=" << sum;
 }
@@ -0,0 +1,89 @@
+#include <trantor/net/TcpServer.h>
+#include <trantor/net/TcpClient.h>
+#include <trantor/net/EventLoopThread.h>
+#include <trantor/utils/Logger.h>
+#include <atomic>
+#include <future>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+
+using namespace trantor;
+
+// Several clients send data to a server with one I/O loop as fast as they
+// can. The I/O of each connection is limited per iteration of the loop, and
+// the bytes served per iteration are reported for each connection.
+int main(int argc, char *argv[])
+{
+    Logger::setLogLevel(Logger::kWarn);
+    size_t connectionBudget = 64 * 1024;
+    size_t loopBudget = 256 * 1024;
+    if (argc > 2)
+    {
+        connectionBudget = atoi(argv[1]);
+        loopBudget = atoi(argv[2]);
+    }
+    const size_t kClients = 8;
+    const size_t kBytes = 4 * 1024 * 1024;
+    const uint16_t port = 8891;
+    EventLoopThread serverThread;
+    serverThread.run();
+    auto serverLoop = serverThread.getLoop();
+    serverLoop->setIoBudget(loopBudget);
+    TcpServer server(serverLoop, InetAddress(port), "budget");
+    server.setConnectionIoBudget(connectionBudget);
+    std::atomic<size_t> closed{0};
+    std::promise<void> allClosed;
+    server.setRecvMessageCallback(
+        [](const TcpConnectionPtr &, MsgBuffer *buf) { buf->retrieveAll(); });
+    server.setConnectionCallback([&](const TcpConnectionPtr &conn) {
+        if (conn->disconnected())
+        {
+            std::cout << conn->peerAddr().toIpPort() << ": "
+                      << conn->bytesReceived() << " bytes, last iteration "
+                      << conn->lastIterationBytes() << " bytes, max "
+                      << conn->maxIterationBytes() << " bytes per iteration, "
+                      << conn->budgetDeferrals() << " deferrals" << std::endl;
+            if (++closed == kClients)
+                allClosed.set_value();
+        }
+    });
+    server.start();
+    std::promise<void> listening;
+    serverLoop->queueInLoop([&listening]() { listening.set_value(); });
+    listening.get_future().wait();
+
+    EventLoopThread clientThread;
+    clientThread.run();
+    auto clientLoop = clientThread.getLoop();
+    std::string payload(kBytes, 'b');
+    std::vector<std::shared_ptr<TcpClient>> clients;
+    for (size_t i = 0; i < kClients; ++i)
+    {
+        auto client =
+            std::make_shared<TcpClient>(clientLoop,
+                                        InetAddress("127.0.0.1", port),
+                                        "sender");
+        client->setConnectionCallback([&payload](const TcpConnectionPtr &conn) {
+            if (conn->connected())
+                conn->send(payload);
+        });
+        client->setWriteCompleteCallback(
+            [](const TcpConnectionPtr &conn) { conn->shutdown(); });
+        client->connect();
+        clients.push_back(client);
+    }
+    allClosed.get_future().wait();
+    std::promise<void> destroyed;
+    clientLoop->runInLoop([&clients, &destroyed]() {
+        clients.clear();
+        destroyed.set_value();
+    });
+    destroyed.get_future().wait();
+    serverLoop->runInLoop([&server, serverLoop]() {
+        server.stop();
+        serverLoop->quit();
+    });
+    serverThread.wait();
+}
@@ -0,0 +1,206 @@
+#include <trantor/utils/LockFreeQueue.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace trantor;
+using namespace std::chrono;
+
+// The queue before nodes were recycled, it allocates a node and an item for
+// every call of enqueue().
+template <typename T>
+class LegacyMpscQueue : public NonCopyable
+{
+  public:
+    LegacyMpscQueue()
+        : head_(new BufferNode), tail_(head_.load(std::memory_order_relaxed))
+    {
+    }
+    ~LegacyMpscQueue()
+    {
+        T output;
+        while (this->dequeue(output))
+        {
+        }
+        BufferNode *front = head_.load(std::memory_order_relaxed);
+        delete front;
+    }
+    void enqueue(T &&input)
+    {
+        BufferNode *node{new BufferNode(std::move(input))};
+        BufferNode *prevhead{head_.exchange(node, std::memory_order_acq_rel)};
+        prevhead->next_.store(node, std::memory_order_release);
+    }
+    bool dequeue(T &output)
+    {
+        BufferNode *tail = tail_.load(std::memory_order_relaxed);
+        BufferNode *next = tail->next_.load(std::memory_order_acquire);
+
+        if (next == nullptr)
+        {
+            return false;
+        }
+        output = std::move(*(next->dataPtr_));
+        delete next->dataPtr_;
+        tail_.store(next, std::memory_order_release);
+        delete tail;
+        return true;
+    }
+
+  private:
+    struct BufferNode
+    {
+        BufferNode() = default;
+        BufferNode(T &&data) : dataPtr_(new T(std::move(data)))
+        {
+        }
+        T *dataPtr_;
+        std::atomic<BufferNode *> next_{nullptr};
+    };
+
+    std::atomic<BufferNode *> head_;
+    std::atomic<BufferNode *> tail_;
+};
+
+using Func = std::function<void()>;
+const size_t kItems = 1000000;
+const size_t kProducers = 4;
+
+template <typename Queue, typename Drain>
+void runSingleThread(const char *name, Queue &queue, Drain drain)
+{
+    uint64_t sum = 0;
+    auto start = steady_clock::now();
+    // Keep a few items in the queue, like a loop running the functions that
+    // were queued in one iteration.
+    for (size_t i = 0; i < kItems; i += 64)
+    {
+        for (size_t j = 0; j < 64; ++j)
+            queue.enqueue([&sum, j]() { sum += j; });
+        drain(queue);
+    }
+    auto elapsed = duration_cast<nanoseconds>(steady_clock::now() - start);
+    std::cout << name << ": " << elapsed.count() / kItems << " ns per item"
+              << std::endl;
+}
+
+template <typename Queue, typename Enqueue, typename Drain>
+void runProducers(const char *name,
+                  Queue &queue,
+                  Enqueue enqueue,
+                  Drain drain)
+{
+    std::atomic<uint64_t> sum{0};
+    auto start = steady_clock::now();
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < kProducers; ++t)
+    {
+        threads.emplace_back([&queue, &sum, enqueue]() {
+            for (size_t i = 0; i < kItems / kProducers; ++i)
+                enqueue(queue, [&sum]() { ++sum; });
+        });
+    }
+    size_t count = 0;
+    while (count < kItems)
+    {
+        auto n = drain(queue);
+        if (n == 0)
+            std::this_thread::yield();
+        count += n;
+    }
+    for (auto &t : threads)
+        t.join();
+    auto elapsed = duration_cast<nanoseconds>(steady_clock::now() - start);
+    std::cout << name << ": " << elapsed.count() / kItems << " ns per item"
+              << std::endl;
+}
+
+template <typename Queue>
+size_t drainOneByOne(Queue &queue)
+{
+    size_t n = 0;
+    Func func;
+    while (queue.dequeue(func))
+    {
+        func();
+        ++n;
+    }
+    return n;
+}
+
+template <typename Queue>
+size_t drainAll(Queue &queue)
+{
+    return queue.dequeueAll([](Func &&func) { func(); });
+}
+
+int main()
+{
+    std::cout << "1 thread, " << kItems << " items:" << std::endl;
+    {
+        LegacyMpscQueue<Func> queue;
+        runSingleThread("  legacy MpscQueue, dequeue",
+                        queue,
+                        drainOneByOne<LegacyMpscQueue<Func>>);
+    }
+    {
+        MpscQueue<Func> queue;
+        runSingleThread("  MpscQueue, dequeue",
+                        queue,
+                        drainOneByOne<MpscQueue<Func>>);
+    }
+    {
+        MpscQueue<Func> queue;
+        runSingleThread("  MpscQueue, dequeueAll",
+                        queue,
+                        drainAll<MpscQueue<Func>>);
+    }
+    {
+        BoundedMpscQueue<Func> queue(1024);
+        runSingleThread("  BoundedMpscQueue, dequeueAll",
+                        queue,
+                        drainAll<BoundedMpscQueue<Func>>);
+    }
+
+    std::cout << kProducers << " producers, " << kItems
+              << " items:" << std::endl;
+    auto enqueue = [](auto &queue, Func &&func) {
+        queue.enqueue(std::move(func));
+    };
+    {
+        LegacyMpscQueue<Func> queue;
+        runProducers("  legacy MpscQueue, dequeue",
+                     queue,
+                     enqueue,
+                     drainOneByOne<LegacyMpscQueue<Func>>);
+    }
+    {
+        MpscQueue<Func> queue;
+        runProducers("  MpscQueue, dequeue",
+                     queue,
+                     enqueue,
+                     drainOneByOne<MpscQueue<Func>>);
+    }
+    {
+        MpscQueue<Func> queue;
+        runProducers("  MpscQueue, dequeueAll",
+                     queue,
+                     enqueue,
+                     drainAll<MpscQueue<Func>>);
+    }
+    {
+        BoundedMpscQueue<Func> queue(1024);
+        runProducers(
+            "  BoundedMpscQueue, dequeueAll",
+            queue,
+            [](BoundedMpscQueue<Func> &q, Func &&func) {
+                while (!q.enqueue(std::move(func)))
+                    std::this_thread::yield();
+            },
+            drainAll<BoundedMpscQueue<Func>>);
+    }
+}
@@ -0,0 +1,86 @@
+#include <trantor/net/EventLoopThreadPool.h>
+#include <trantor/net/LoopChannels.h>
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <thread>
+
+using namespace trantor;
+using namespace std::chrono;
+
+const size_t kMessages = 1000000;
+const size_t kChunk = 256;
+
+// Send messages from a loop in chunks queued one after another. When the
+// receiver falls behind, the sender yields the CPU before it goes on.
+template <typename Send>
+struct Relay
+{
+    void run()
+    {
+        size_t end = std::min(sent + kChunk, kMessages);
+        while (sent < end && send(sent))
+            ++sent;
+        if (sent < end)
+            std::this_thread::yield();
+        if (sent < kMessages)
+            sender->queueInLoop([this]() { run(); });
+    }
+    EventLoop *sender;
+    Send send;
+    size_t sent;
+};
+
+template <typename Send>
+void relay(EventLoop *sender, Send send, std::promise<void> &done)
+{
+    auto start = steady_clock::now();
+    Relay<Send> relay{sender, send, 0};
+    sender->queueInLoop([&relay]() { relay.run(); });
+    done.get_future().wait();
+    auto ns = duration_cast<nanoseconds>(steady_clock::now() - start);
+    std::cout << ns.count() / kMessages << " ns per message" << std::endl;
+}
+
+int main()
+{
+    EventLoopThreadPool pool(2);
+    pool.start();
+    auto sender = pool.getLoop(0);
+    auto receiver = pool.getLoop(1);
+
+    {
+        std::promise<void> done;
+        size_t received = 0;
+        std::cout << "queueInLoop: ";
+        relay(sender,
+              [&](size_t) {
+                  receiver->queueInLoop([&]() {
+                      if (++received == kMessages)
+                          done.set_value();
+                  });
+                  return true;
+              },
+              done);
+    }
+    {
+        std::promise<void> done;
+        size_t received = 0;
+        LoopChannels<size_t> channels(pool,
+                                      4096,
+                                      [&](size_t, size_t &&) {
+                                          if (++received == kMessages)
+                                              done.set_value();
+                                      });
+        std::cout << "LoopChannels: ";
+        relay(sender,
+              [&](size_t i) { return channels.send(1, std::move(i)); },
+              done);
+    }
+
+    for (auto loop : pool.getLoops())
+        loop->quit();
+    pool.wait();
+}
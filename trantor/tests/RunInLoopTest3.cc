@@ -0,0 +1,55 @@
+#include <trantor/net/EventLoopThread.h>
+#include <iostream>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <thread>
+#include <vector>
+
+// Producers on several threads push functions into one loop, as in
+// RunInLoopTest2. Without wakeup coalescing every function queued from
+// another thread costs a write to the wakeup fd, this test shows how many
+// writes are actually made.
+int main()
+{
+    const uint64_t kThreads = 10;
+    const uint64_t kTasksPerThread = 100000;
+    const uint64_t kTotal = kThreads * kTasksPerThread;
+    std::atomic<uint64_t> counter;
+    counter = 0;
+    std::promise<int> pro;
+    auto ft = pro.get_future();
+    trantor::EventLoopThread loopThread;
+    loopThread.run();
+    auto loop = loopThread.getLoop();
+    auto wakeupsBefore = loop->wakeupCount();
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (uint64_t i = 0; i < kThreads; ++i)
+    {
+        threads.emplace_back([&counter, loop, &pro, kTotal]() {
+            for (uint64_t j = 0; j < kTasksPerThread; ++j)
+            {
+                loop->queueInLoop([&counter, &pro, kTotal]() {
+                    if (++counter == kTotal)
+                        pro.set_value(1);
+                });
+            }
+        });
+    }
+    for (auto &t : threads)
+        t.join();
+    ft.get();
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+    auto wakeups = loop->wakeupCount() - wakeupsBefore;
+    std::cout << kTotal << " functions queued from " << kThreads
+              << " threads in " << elapsed / 1000.0 << "ms" << std::endl;
+    std::cout << "wakeup writes: " << wakeups << " (" << kTotal
+              << " without coalescing, " << kTotal - wakeups << " saved)"
+              << std::endl;
+    loop->quit();
+    loopThread.wait();
+}
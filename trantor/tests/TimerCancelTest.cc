@@ -0,0 +1,79 @@
+#include <trantor/net/EventLoopThread.h>
+#include <trantor/utils/Logger.h>
+#include <chrono>
+#include <deque>
+#include <future>
+#include <iostream>
+#include <stdlib.h>
+
+using namespace trantor;
+using namespace std::chrono;
+
+// Schedule timeouts which are almost always invalidated before they expire,
+// like the timeouts of requests, and report the time per timer.
+int main(int argc, char *argv[])
+{
+    Logger::setLogLevel(Logger::kWarn);
+    size_t count = 2000000;
+    if (argc > 1)
+        count = atoi(argv[1]);
+    EventLoopThread loopThread;
+    loopThread.run();
+    auto loop = loopThread.getLoop();
+
+    // Invalidated at once in the loop.
+    {
+        std::promise<void> done;
+        loop->runInLoop([&]() {
+            auto start = steady_clock::now();
+            for (size_t i = 0; i < count; ++i)
+                loop->invalidateTimer(loop->runAfter(30.0, []() {}));
+            auto ns = duration_cast<nanoseconds>(steady_clock::now() - start);
+            std::cout << "schedule and invalidate: " << ns.count() / count
+                      << " ns per timer" << std::endl;
+            done.set_value();
+        });
+        done.get_future().wait();
+    }
+    // A window of outstanding timeouts, the oldest is invalidated when a new
+    // one is scheduled.
+    {
+        const size_t kWindow = 100000;
+        std::promise<void> done;
+        loop->runInLoop([&]() {
+            std::deque<TimerId> window;
+            auto start = steady_clock::now();
+            for (size_t i = 0; i < count; ++i)
+            {
+                window.push_back(
+                    loop->runAfter(30.0 + 0.001 * (i % 1000), []() {}));
+                if (window.size() > kWindow)
+                {
+                    loop->invalidateTimer(window.front());
+                    window.pop_front();
+                }
+            }
+            for (auto id : window)
+                loop->invalidateTimer(id);
+            auto ns = duration_cast<nanoseconds>(steady_clock::now() - start);
+            std::cout << kWindow << " outstanding timers: "
+                      << ns.count() / count << " ns per timer" << std::endl;
+            done.set_value();
+        });
+        done.get_future().wait();
+    }
+    // Scheduled and invalidated from another thread.
+    {
+        auto start = steady_clock::now();
+        for (size_t i = 0; i < count; ++i)
+            loop->invalidateTimer(loop->runAfter(30.0, []() {}));
+        std::promise<void> done;
+        loop->queueInLoop([&done]() { done.set_value(); });
+        done.get_future().wait();
+        auto ns = duration_cast<nanoseconds>(steady_clock::now() - start);
+        std::cout << "from another thread: " << ns.count() / count
+                  << " ns per timer" << std::endl;
+    }
+    loop->quit();
+    loopThread.wait();
+}
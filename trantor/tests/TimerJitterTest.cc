@@ -0,0 +1,100 @@
+#include <trantor/net/EventLoopThread.h>
+#include <trantor/utils/Logger.h>
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <stdlib.h>
+#include <vector>
+
+using namespace trantor;
+using namespace std::chrono;
+
+// Run a periodic timer whose callback takes a fifth of the interval, like a
+// pacing or flush timer, and report how late the runs are from their nominal
+// times (the start plus n intervals) for the usual repeating timers and the
+// fixed-rate ones, with and without spinning and the timerfd. The lateness of
+// a usual repeating timer accumulates, a fixed-rate one skips the runs it
+// misses.
+static void run(const char *name,
+                bool fixedRate,
+                microseconds spin,
+                bool timerfd,
+                size_t count)
+{
+    const auto interval = microseconds(1000);
+    EventLoopThread loopThread;
+    loopThread.run();
+    auto loop = loopThread.getLoop();
+    if (!timerfd)
+        loop->disableTimerfd();
+    std::vector<int64_t> lateness;
+    lateness.reserve(count);
+    std::promise<void> done;
+    steady_clock::time_point start;
+    auto id = std::make_shared<TimerId>(0);
+    int64_t lastSlot = 0;
+    auto cb = [&, id]() {
+        auto now = steady_clock::now();
+        int64_t slot;
+        if (fixedRate)
+        {
+            // The slot of the grid the run belongs to, the runs missed are
+            // skipped.
+            slot = (now - start) / interval;
+        }
+        else
+        {
+            slot = static_cast<int64_t>(lateness.size()) + 1;
+        }
+        lastSlot = slot;
+        lateness.push_back(
+            duration_cast<nanoseconds>(now - (start + interval * slot))
+                .count());
+        while (steady_clock::now() < now + interval / 5)
+        {
+        }
+        if (lateness.size() == count)
+        {
+            loop->invalidateTimer(*id);
+            done.set_value();
+        }
+    };
+    loop->runInLoop([&]() {
+        start = steady_clock::now();
+        if (fixedRate)
+            *id = loop->runAtFixedRate(interval, cb, spin);
+        else
+            *id = loop->runEvery(interval, cb);
+    });
+    done.get_future().wait();
+    auto sorted = lateness;
+    std::sort(sorted.begin(), sorted.end());
+    auto at = [&sorted](double p) {
+        return sorted[static_cast<size_t>(p * (sorted.size() - 1))] / 1000;
+    };
+    std::cout << name << ": p50=" << at(0.5) << " us p99=" << at(0.99)
+              << " us max=" << sorted.back() / 1000
+              << " us, last run late by " << lateness.back() / 1000
+              << " us, skipped " << lastSlot - static_cast<int64_t>(count)
+              << std::endl;
+    loop->quit();
+    loopThread.wait();
+}
+
+int main(int argc, char *argv[])
+{
+    Logger::setLogLevel(Logger::kWarn);
+    size_t count = 2000;
+    if (argc > 1)
+        count = atoi(argv[1]);
+    run("runEvery", false, microseconds(0), true, count);
+    run("fixed rate", true, microseconds(0), true, count);
+    run("fixed rate, 50 us spin", true, microseconds(50), true, count);
+    run("fixed rate, no timerfd", true, microseconds(0), false, count);
+    run("fixed rate, 50 us spin, no timerfd",
+        true,
+        microseconds(50),
+        false,
+        count);
+}
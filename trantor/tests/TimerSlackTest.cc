@@ -0,0 +1,90 @@
+#include <trantor/net/EventLoopThread.h>
+#include <trantor/utils/Logger.h>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <random>
+#include <stdlib.h>
+#include <thread>
+
+using namespace trantor;
+using namespace std::chrono;
+
+// Set timeouts with several timer slacks, and report the times the timerfd
+// was armed, the re-arms saved by the slack on insertion and the wakeups
+// which ran timers.
+static void run(const char *name,
+                int slack,
+                size_t count,
+                const std::function<void(EventLoop *, Task &&)> &schedule)
+{
+    EventLoopThread loopThread;
+    loopThread.run();
+    auto loop = loopThread.getLoop();
+    loop->enableStats();
+    loop->setTimerSlack(microseconds(slack));
+    std::promise<EventLoopStatsSnapshot> before;
+    loop->runInLoop([&]() { before.set_value(loop->getStats()); });
+    auto start = before.get_future().get();
+
+    std::promise<void> done;
+    size_t remaining = count;
+    for (size_t i = 0; i < count; ++i)
+    {
+        schedule(loop, [&]() {
+            if (--remaining == 0)
+                done.set_value();
+        });
+    }
+    done.get_future().wait();
+    std::promise<EventLoopStatsSnapshot> after;
+    loop->runInLoop([&]() { after.set_value(loop->getStats()); });
+    auto end = after.get_future().get();
+    std::cout << name << ", slack " << slack
+              << " us: arms=" << end.timerArms - start.timerArms
+              << " saved=" << end.timerArmsSaved - start.timerArmsSaved
+              << " timer wakeups="
+              << end.timersTime.count - start.timersTime.count << std::endl;
+    loop->quit();
+    loopThread.wait();
+}
+
+int main(int argc, char *argv[])
+{
+    Logger::setLogLevel(Logger::kWarn);
+    size_t count = 10000;
+    if (argc > 1)
+        count = atoi(argv[1]);
+    const int slacks[] = {0, 50, 200, 1000};
+    // Each timeout is a microsecond earlier than the previous one, so each
+    // new timer is the earliest.
+    for (auto slack : slacks)
+    {
+        auto deadline = steady_clock::now() + milliseconds(100);
+        run("descending deadlines",
+            slack,
+            count,
+            [&deadline](EventLoop *loop, Task &&cb) {
+                deadline -= microseconds(1);
+                auto delay = deadline - steady_clock::now();
+                loop->runAfter(duration<double>(delay).count(),
+                               std::move(cb));
+            });
+    }
+    // Four requests arrive every 100 us, each sets a timeout of 0.2 to 2 ms.
+    for (auto slack : slacks)
+    {
+        std::mt19937 rng(42);
+        std::uniform_int_distribution<int> timeout(200, 2000);
+        size_t scheduled = 0;
+        run("request timeouts",
+            slack,
+            count,
+            [&](EventLoop *loop, Task &&cb) {
+                if (++scheduled % 4 == 0)
+                    std::this_thread::sleep_for(microseconds(100));
+                loop->runAfter(timeout(rng) / 1000000.0, std::move(cb));
+            });
+    }
+}
@@ -0,0 +1,72 @@
+#include <trantor/utils/CpuAffinity.h>
+#include <trantor/net/EventLoopThreadPool.h>
+#include <gtest/gtest.h>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace trantor;
+
+TEST(CpuAffinityTest, ParseCpuList)
+{
+    EXPECT_EQ(std::vector<int>({0, 1, 2, 3, 8, 10, 11}),
+              CpuAffinity::parseCpuList("0-3,8,10-11\n"));
+    EXPECT_EQ(std::vector<int>({5}), CpuAffinity::parseCpuList("5"));
+    EXPECT_EQ(std::vector<int>({1, 2}), CpuAffinity::parseCpuList("2,1,1"));
+    EXPECT_TRUE(CpuAffinity::parseCpuList("").empty());
+    EXPECT_TRUE(CpuAffinity::parseCpuList("3-1").empty());
+    EXPECT_TRUE(CpuAffinity::parseCpuList("0-").empty());
+    EXPECT_TRUE(CpuAffinity::parseCpuList("a").empty());
+}
+TEST(CpuAffinityTest, Sets)
+{
+    CpuAffinity none;
+    EXPECT_TRUE(none.empty());
+    EXPECT_TRUE(none.cpusOf(3).empty());
+    EXPECT_EQ(-1, none.nodeOf(0));
+    EXPECT_TRUE(none.apply(0));
+    auto list = CpuAffinity::cpuList({2, 5});
+    EXPECT_EQ(std::vector<int>({2}), list.cpusOf(0));
+    EXPECT_EQ(std::vector<int>({5}), list.cpusOf(1));
+    EXPECT_EQ(std::vector<int>({2}), list.cpusOf(2));
+    EXPECT_EQ(-1, list.nodeOf(1));
+}
+#ifdef __linux__
+TEST(CpuAffinityTest, Pool)
+{
+    auto allowed = CpuAffinity::allowedCpus();
+    ASSERT_FALSE(allowed.empty());
+    auto affinity = CpuAffinity::roundRobin();
+    EXPECT_EQ(std::vector<int>({allowed[0]}), affinity.cpusOf(0));
+    EventLoopThreadPool pool(2);
+    pool.setCpuAffinity(affinity);
+    pool.start();
+    for (size_t i = 0; i < pool.size(); ++i)
+    {
+        std::promise<std::vector<int>> cpus;
+        pool.getLoop(i)->runInLoop(
+            [&cpus]() { cpus.set_value(CpuAffinity::allowedCpus()); });
+        EXPECT_EQ(affinity.cpusOf(i), cpus.get_future().get());
+    }
+    // The NUMA nodes cover the allowed CPUs when the information exists.
+    auto nodes = CpuAffinity::numaNodes();
+    if (!nodes.empty())
+    {
+        EXPECT_GE(nodes.nodeOf(0), 0);
+        bool applied = false;
+        std::thread thread([&]() { applied = nodes.apply(0); });
+        thread.join();
+        EXPECT_TRUE(applied);
+    }
+    for (auto loop : pool.getLoops())
+        loop->quit();
+    pool.wait();
+}
+#endif
+
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,902 @@
+#include <trantor/net/EventLoopThread.h>
+#include <trantor/net/EventLoopThreadPool.h>
+#include <trantor/net/EventLoopWatchdog.h>
+#include <trantor/net/LoopChannels.h>
+#include <trantor/net/Channel.h>
+#include <gtest/gtest.h>
+#include <future>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+using namespace trantor;
+#ifndef _WIN32
+TEST(EventLoopTest, CoalesceChannelUpdates)
+{
+    int fds[2];
+    ASSERT_EQ(0, pipe(fds));
+    EventLoopThread loopThread;
+    loopThread.run();
+    auto loop = loopThread.getLoop();
+    std::unique_ptr<Channel> channel;
+    std::promise<size_t> writable;
+    loop->runInLoop([&]() {
+        channel = std::make_unique<Channel>(loop, fds[1]);
+        channel->setWriteCallback([&]() {
+            auto saved = loop->savedChannelUpdates();
+            channel->disableAll();
+            channel->remove();
+            writable.set_value(loop->savedChannelUpdates() - saved);
+        });
+        auto saved = loop->savedChannelUpdates();
+        channel->enableReading();
+        channel->enableWriting();
+        channel->disableWriting();
+        channel->disableReading();
+        channel->enableWriting();
+        EXPECT_EQ(4, loop->savedChannelUpdates() - saved);
+    });
+    // The last state is applied before the next poll, so the write end of
+    // the pipe is reported as writable.
+    auto f = writable.get_future();
+    ASSERT_EQ(std::future_status::ready, f.wait_for(std::chrono::seconds(5)));
+    // The update of disableAll() is dropped by remove().
+    EXPECT_EQ(1, f.get());
+    loop->runInLoop([&]() { channel.reset(); });
+    loop->quit();
+    loopThread.wait();
+    close(fds[0]);
+    close(fds[1]);
+}
+TEST(EventLoopTest, DropCancelledChannelUpdates)
+{
+    int fds[2];
+    ASSERT_EQ(0, pipe(fds));
+    EventLoopThread loopThread;
+    loopThread.run();
+    auto loop = loopThread.getLoop();
+    std::promise<size_t> done;
+    loop->runInLoop([&]() {
+        auto saved = loop->savedChannelUpdates();
+        auto channel = std::make_shared<Channel>(loop, fds[1]);
+        channel->enableWriting();
+        channel->disableWriting();
+        loop->queueInLoop([&, channel, saved]() {
+            // The poller has never seen the channel.
+            channel->remove();
+            done.set_value(loop->savedChannelUpdates() - saved);
+        });
+    });
+    auto f = done.get_future();
+    ASSERT_EQ(std::future_status::ready, f.wait_for(std::chrono::seconds(5)));
+    EXPECT_EQ(2, f.get());
+    loop->quit();
+    loopThread.wait();
+    close(fds[0]);
+    close(fds[1]);
+}
+TEST(EventLoopTest, ChannelPriority)
+{
+    const ChannelPriority priorities[] = {ChannelPriority::kBulk,
+                                          ChannelPriority::kInteractive,
+                                          ChannelPriority::kControl};
+    const int kChannels = 3;
+    int fds[kChannels][2];
+    for (auto &pipeFds : fds)
+        ASSERT_EQ(0, pipe(pipeFds));
+    EventLoopThread loopThread;
+    loopThread.run();
+    auto loop = loopThread.getLoop();
+    std::vector<std::unique_ptr<Channel>> channels;
+    std::vector<ChannelPriority> handled;
+    std::promise<void> done;
+    loop->runInLoop([&]() {
+        for (int i = 0; i < kChannels; ++i)
+        {
+            channels.emplace_back(new Channel(loop, fds[i][0]));
+            auto channel = channels.back().get();
+            channel->setPriority(priorities[i]);
+            channel->setReadCallback([&, channel]() {
+                char c;
+                EXPECT_EQ(1, read(channel->fd(), &c, 1));
+                handled.push_back(channel->priority());
+                if (handled.size() == kChannels)
+                    done.set_value();
+            });
+            channel->enableReading();
+            // All the pipes are readable in the first poll.
+            EXPECT_EQ(1, write(fds[i][1], "x", 1));
+        }
+    });
+    auto f = done.get_future();
+    ASSERT_EQ(std::future_status::ready, f.wait_for(std::chrono::seconds(5)));
+    EXPECT_EQ(ChannelPriority::kControl, handled[0]);
+    EXPECT_EQ(ChannelPriority::kInteractive, handled[1]);
+    EXPECT_EQ(ChannelPriority::kBulk, handled[2]);
+    loop->runInLoop([&]() {
+        for (auto &channel : channels)
+        {
+            channel->disableAll();
+            channel->remove();
+        }
+        channels.clear();
+    });
+    loop->quit();
+    loopThread.wait();
+    for (auto &pipeFds : fds)
+    {
+        close(pipeFds[0]);
+        close(pipeFds[1]);
+    }
+}
+TEST(EventLoopTest, DeferBulkChannels)
+{
+    const int kChannels = 4;
+    int fds[kChannels][2];
+    for (auto &pipeFds : fds)
+        ASSERT_EQ(0, pipe(pipeFds));
+    EventLoopThread loopThread;
+    loopThread.run();
+    auto loop = loopThread.getLoop();
+    loop->setIterationBudget(std::chrono::microseconds(1));
+    std::vector<std::unique_ptr<Channel>> channels;
+    std::vector<int> handled;
+    std::promise<void> done;
+    loop->runInLoop([&]() {
+        for (int i = 0; i < kChannels; ++i)
+        {
+            channels.emplace_back(new Channel(loop, fds[i][0]));
+            auto channel = channels.back().get();
+            // The last channel is a control channel, the others are bulk
+            // ones which take longer than the budget.
+            channel->setPriority(i == kChannels - 1 ? ChannelPriority::kControl
+                                                    : ChannelPriority::kBulk);
+            channel->setReadCallback([&, channel, i]() {
+                char c;
+                EXPECT_EQ(1, read(channel->fd(), &c, 1));
+                if (channel->priority() == ChannelPriority::kBulk)
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                handled.push_back(i);
+                if (handled.size() == kChannels)
+                    done.set_value();
+            });
+            channel->enableReading();
+            EXPECT_EQ(1, write(fds[i][1], "x", 1));
+        }
+    });
+    auto f = done.get_future();
+    ASSERT_EQ(std::future_status::ready, f.wait_for(std::chrono::seconds(5)));
+    // One bulk channel is handled in each iteration.
+    EXPECT_EQ(kChannels - 1, handled[0]);
+    EXPECT_EQ(3, loop->deferredBulkChannels());
+    loop->runInLoop([&]() {
+        for (auto &channel : channels)
+        {
+            channel->disableAll();
+            channel->remove();
+        }
+        channels.clear();
+    });
+    loop->quit();
+    loopThread.wait();
+    for (auto &pipeFds : fds)
+    {
+        close(pipeFds[0]);
+        close(pipeFds[1]);
+    }
+}
+#endif
+TEST(EventLoopTest, BoundedQueue)
+{
+    const int kThreads = 4;
+    const int kFuncs = 10000;
+    EventLoopThread loopThread;
+    auto loop = loopThread.getLoop();
+    loop->enableBoundedQueue(16);
+    loopThread.run();
+    std::vector<int> next(kThreads + 1, 0);
+    std::atomic<int> count{0};
+    std::promise<void> done;
+    auto check = [&](int producer, int seq) {
+        // Functions of one producer run in order.
+        EXPECT_EQ(next[producer], seq);
+        next[producer] = seq + 1;
+        if (++count == (kThreads + 1) * kFuncs)
+            done.set_value();
+    };
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t)
+    {
+        threads.emplace_back([&, t]() {
+            for (int i = 0; i < kFuncs; ++i)
+                loop->queueInLoop([&check, t, i]() { check(t, i); });
+        });
+    }
+    // More functions than the capacity queued in the loop thread itself.
+    loop->runInLoop([&]() {
+        for (int i = 0; i < kFuncs; ++i)
+            loop->queueInLoop([&check, i]() { check(kThreads, i); });
+    });
+    auto f = done.get_future();
+    ASSERT_EQ(std::future_status::ready, f.wait_for(std::chrono::seconds(10)));
+    for (auto &t : threads)
+        t.join();
+    loop->quit();
+    loopThread.wait();
+}
+TEST(EventLoopTest, Histogram)
+{
+    EventLoopStats::Histogram histogram;
+    for (uint64_t i = 1; i <= 100; ++i)
+        histogram.record(i);
+    histogram.record(0);
+    auto snapshot = histogram.snapshot();
+    EXPECT_EQ(101, snapshot.count);
+    EXPECT_EQ(5050, snapshot.sum);
+    EXPECT_EQ(100, snapshot.max);
+    EXPECT_EQ(1, snapshot.buckets[0]);
+    // [64, 100] are in the bucket of [64, 128).
+    EXPECT_EQ(37, snapshot.buckets[7]);
+    EXPECT_EQ(0, snapshot.percentile(0));
+    EXPECT_EQ(63, snapshot.percentile(0.5));
+    EXPECT_EQ(100, snapshot.percentile(0.99));
+    auto sum = snapshot;
+    sum += snapshot;
+    EXPECT_EQ(202, sum.count);
+    EXPECT_EQ(74, sum.buckets[7]);
+}
+TEST(EventLoopTest, Stats)
+{
+    const size_t kFuncs = 100;
+    EventLoopThreadPool pool(2);
+    pool.start();
+    EXPECT_EQ(0, pool.getStats().iterations);
+    auto sync = [&pool]() {
+        // Wait for the loops to run the functions queued before.
+        std::promise<void> synced[2];
+        for (size_t i = 0; i < 2; ++i)
+        {
+            pool.getLoop(i)->queueInLoop(
+                [&synced, i]() { synced[i].set_value(); });
+        }
+        for (auto &p : synced)
+            p.get_future().wait();
+    };
+    pool.enableStats();
+    sync();
+    std::promise<void> done;
+    std::atomic<size_t> count{0};
+    for (size_t i = 0; i < kFuncs; ++i)
+    {
+        pool.getNextLoop()->queueInLoop([&]() {
+            if (++count == kFuncs + 1)
+                done.set_value();
+        });
+    }
+    pool.getLoop(0)->runAfter(0.01, [&]() {
+        if (++count == kFuncs + 1)
+            done.set_value();
+    });
+    auto f = done.get_future();
+    ASSERT_EQ(std::future_status::ready, f.wait_for(std::chrono::seconds(5)));
+    sync();
+    // Let the loops finish the iteration.
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    auto stats = pool.getStats();
+    EXPECT_GT(stats.iterations, 0);
+    EXPECT_GT(stats.wakeups, 0);
+    EXPECT_EQ(stats.iterations, stats.pollTime.count);
+    EXPECT_EQ(stats.iterations, stats.activeChannels.count);
+    EXPECT_GT(stats.funcsQueueDepth.sum, 0);
+    EXPECT_GT(stats.handleEventTime.count, 0);
+    EXPECT_EQ(1, stats.timersTime.count);
+    // The loops are idle, the pool returns the sum of their statistics.
+    auto sum = pool.getLoop(0)->getStats();
+    sum += pool.getLoop(1)->getStats();
+    EXPECT_EQ(sum.iterations, stats.iterations);
+    EXPECT_EQ(sum.funcsQueueDepth.sum, stats.funcsQueueDepth.sum);
+    for (auto loop : pool.getLoops())
+        loop->quit();
+    pool.wait();
+}
+
+TEST(EventLoopTest, QueueInLoopBatch)
+{
+    EventLoopThread loopThread;
+    loopThread.run();
+    auto loop = loopThread.getLoop();
+    std::promise<void> blocked;
+    std::promise<void> release;
+    auto releaseFuture = release.get_future().share();
+    // Block the loop so that the wakeups of the batches are counted alone.
+    loop->queueInLoop([&blocked, releaseFuture]() {
+        blocked.set_value();
+        releaseFuture.wait();
+    });
+    blocked.get_future().wait();
+    auto wakeups = loop->wakeupCount();
+    std::vector<int> results;
+    std::vector<Task> funcs;
+    for (int i = 0; i < 100; ++i)
+    {
+        auto value = std::unique_ptr<int>(new int(i));
+        funcs.emplace_back([&results, value = std::move(value)]() {
+            results.push_back(*value);
+        });
+    }
+    loop->queueInLoopBatch(std::move(funcs));
+    EXPECT_TRUE(funcs.empty());
+    std::promise<void> done;
+    loop->queueInLoopBatch({});
+    std::vector<Task> last;
+    last.emplace_back([&done]() { done.set_value(); });
+    loop->queueInLoopBatch(std::move(last));
+    release.set_value();
+    done.get_future().wait();
+    EXPECT_LE(loop->wakeupCount() - wakeups, 1);
+    ASSERT_EQ(100, results.size());
+    for (int i = 0; i < 100; ++i)
+        EXPECT_EQ(i, results[i]);
+    loop->quit();
+    loopThread.wait();
+}
+TEST(EventLoopTest, RunOnAllLoops)
+{
+    EventLoopThreadPool pool(3);
+    pool.start();
+    std::mutex mutex;
+    std::vector<EventLoop *> loops;
+    std::promise<size_t> done;
+    pool.runOnAllLoops(
+        [&]() {
+            std::lock_guard<std::mutex> guard(mutex);
+            loops.push_back(EventLoop::getEventLoopOfCurrentThread());
+        },
+        [&]() {
+            std::lock_guard<std::mutex> guard(mutex);
+            done.set_value(loops.size());
+        });
+    auto f = done.get_future();
+    ASSERT_EQ(std::future_status::ready, f.wait_for(std::chrono::seconds(5)));
+    EXPECT_EQ(3, f.get());
+    for (auto loop : pool.getLoops())
+    {
+        EXPECT_NE(loops.end(), std::find(loops.begin(), loops.end(), loop));
+        loop->quit();
+    }
+    pool.wait();
+    EventLoopThreadPool empty(0);
+    bool completed = false;
+    empty.runOnAllLoops([]() {}, [&completed]() { completed = true; });
+    EXPECT_TRUE(completed);
+}
+TEST(EventLoopTest, LoopChannels)
+{
+    const size_t kLoops = 3;
+    const size_t kMessages = 1000;
+    EventLoopThreadPool pool(kLoops);
+    pool.start();
+    auto loops = pool.getLoops();
+    // Only touched by the receiving loops.
+    size_t received[kLoops][kLoops] = {};
+    std::atomic<size_t> total{0};
+    std::atomic<bool> wrongThread{false};
+    std::promise<void> done;
+    std::unique_ptr<LoopChannels<std::unique_ptr<size_t>>> channels;
+    channels.reset(new LoopChannels<std::unique_ptr<size_t>>(
+        pool, 1024, [&](size_t from, std::unique_ptr<size_t> &&message) {
+            size_t to = channels->currentIndex();
+            if (!loops[to]->isInLoopThread())
+                wrongThread = true;
+            // The messages of each pair of loops are received in order.
+            EXPECT_EQ(received[from][to], *message);
+            ++received[from][to];
+            if (++total == kLoops * (kLoops - 1) * kMessages)
+                done.set_value();
+        }));
+    pool.runOnAllLoops([&]() {
+        size_t from = channels->currentIndex();
+        for (size_t to = 0; to < kLoops; ++to)
+        {
+            if (to == from)
+                continue;
+            // Half of the messages are sent one by one, the others at once.
+            for (size_t i = 0; i < kMessages / 2; ++i)
+            {
+                EXPECT_TRUE(channels->send(
+                    to, std::unique_ptr<size_t>(new size_t(i))));
+            }
+            std::vector<std::unique_ptr<size_t>> batch;
+            for (size_t i = kMessages / 2; i < kMessages; ++i)
+                batch.emplace_back(new size_t(i));
+            EXPECT_EQ(kMessages / 2, channels->send(to, batch));
+            EXPECT_TRUE(batch.empty());
+        }
+    });
+    auto f = done.get_future();
+    ASSERT_EQ(std::future_status::ready, f.wait_for(std::chrono::seconds(5)));
+    EXPECT_FALSE(wrongThread);
+    {
+        // The index cached in each thread follows the mesh it is asked for.
+        LoopChannels<std::unique_ptr<size_t>> reversed(
+            std::vector<EventLoop *>(loops.rbegin(), loops.rend()),
+            16,
+            [](size_t, std::unique_ptr<size_t> &&) {});
+        std::atomic<size_t> checked{0};
+        std::promise<void> indicesChecked;
+        pool.runOnAllLoops([&]() {
+            size_t index = channels->currentIndex();
+            EXPECT_EQ(loops[index], EventLoop::getEventLoopOfCurrentThread());
+            for (int i = 0; i < 2; ++i)
+            {
+                EXPECT_EQ(kLoops - 1 - index, reversed.currentIndex());
+                EXPECT_EQ(index, channels->currentIndex());
+            }
+            if (++checked == kLoops)
+                indicesChecked.set_value();
+        });
+        indicesChecked.get_future().wait();
+    }
+    channels.reset();
+    for (auto loop : loops)
+        loop->quit();
+    pool.wait();
+}
+TEST(EventLoopTest, LoopSelection)
+{
+    EventLoopThreadPool pool(3);
+    pool.start();
+    auto loops = pool.getLoops();
+    InetAddress peer("10.0.0.1", 1234);
+    // Round-robin from several threads.
+    std::mutex mutex;
+    std::map<EventLoop *, size_t> counts;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 3; ++t)
+    {
+        threads.emplace_back([&]() {
+            for (int i = 0; i < 300; ++i)
+            {
+                auto loop = pool.selectLoop(peer);
+                std::lock_guard<std::mutex> guard(mutex);
+                ++counts[loop];
+            }
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+    for (auto loop : loops)
+        EXPECT_EQ(300, counts[loop]);
+
+    pool.setLoopSelection(LoopSelection::kLeastConnections);
+    loops[0]->addConnectionCount(2);
+    loops[2]->addConnectionCount(1);
+    EXPECT_EQ(loops[1], pool.selectLoop(peer));
+    loops[1]->addConnectionCount(3);
+    EXPECT_EQ(loops[2], pool.selectLoop(peer));
+    for (auto loop : loops)
+        loop->addConnectionCount(-static_cast<long>(loop->connectionCount()));
+
+    pool.setLoopSelection(LoopSelection::kConsistentHash);
+    std::set<EventLoop *> hashed;
+    for (int i = 0; i < 100; ++i)
+    {
+        InetAddress client("192.168.1." + std::to_string(i), 80);
+        auto loop = pool.selectLoop(client);
+        // The port doesn't matter.
+        EXPECT_EQ(loop,
+                  pool.selectLoop(InetAddress(client.toIp(), 8080 + i)));
+        hashed.insert(loop);
+    }
+    EXPECT_EQ(3, hashed.size());
+
+    pool.setLoopSelection(LoopSelection::kLeastLoad);
+    // Keep the first and the last loops busy.
+    std::vector<TimerId> timers;
+    for (size_t i : {0, 2})
+    {
+        timers.push_back(loops[i]->runEvery(0.005, []() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    EXPECT_GT(loops[0]->recentLoad(), 0.5);
+    EXPECT_LT(loops[1]->recentLoad(), 0.5);
+    for (int i = 0; i < 3; ++i)
+        EXPECT_EQ(loops[1], pool.selectLoop(peer));
+    // A loop stuck in a callback is busy.
+    std::promise<void> stuck;
+    loops[1]->queueInLoop([&stuck]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        stuck.set_value();
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(250));
+    EXPECT_EQ(1.0, loops[1]->recentLoad());
+    stuck.get_future().wait();
+    loops[0]->invalidateTimer(timers[0]);
+    loops[2]->invalidateTimer(timers[1]);
+
+    pool.setLoopSelector([](const InetAddress &) { return 5; });
+    EXPECT_EQ(loops[2], pool.selectLoop(peer));
+    for (auto loop : loops)
+        loop->quit();
+    pool.wait();
+}
+TEST(EventLoopTest, TimerInvalidation)
+{
+    EventLoopThread loopThread;
+    loopThread.run();
+    auto loop = loopThread.getLoop();
+    std::vector<int> fired;
+    int repeats = 0;
+    std::promise<void> done;
+    loop->runInLoop([&]() {
+        // Every other timer is invalidated, the others fire by deadline. The
+        // deadlines are far enough apart to be ordered by their delays.
+        for (int i = 0; i < 400; ++i)
+        {
+            auto id = loop->runAfter(0.005 * (1 + (i * 7) % 10),
+                                     [&fired, i]() { fired.push_back(i); });
+            if (i % 2 == 1)
+                loop->invalidateTimer(id);
+        }
+        // A callback invalidates a later timer of the same batch, both
+        // expire while the loop sleeps below.
+        auto second = std::make_shared<TimerId>(0);
+        loop->runAfter(0.001, [loop, second]() {
+            loop->invalidateTimer(*second);
+        });
+        *second = loop->runAfter(0.002, [&fired]() { fired.push_back(-1); });
+        // A repeating timer invalidates itself.
+        auto repeating = std::make_shared<TimerId>(0);
+        *repeating = loop->runEvery(0.002, [&, repeating]() {
+            if (++repeats == 3)
+                loop->invalidateTimer(*repeating);
+        });
+        loop->runAfter(0.1, [&done]() { done.set_value(); });
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    });
+    // Invalidated from another thread.
+    auto id = loop->runAfter(0.02, [&fired]() { fired.push_back(-2); });
+    loop->invalidateTimer(id);
+    done.get_future().wait();
+    ASSERT_EQ(200, fired.size());
+    for (size_t i = 0; i < fired.size(); ++i)
+    {
+        EXPECT_EQ(0, fired[i] % 2);
+        if (i > 0)
+        {
+            // Ordered by deadline, then by creation.
+            int prev = fired[i - 1], cur = fired[i];
+            EXPECT_TRUE((prev * 7) % 10 < (cur * 7) % 10 ||
+                        ((prev * 7) % 10 == (cur * 7) % 10 && prev < cur));
+        }
+    }
+    EXPECT_EQ(3, repeats);
+    loop->quit();
+    loopThread.wait();
+}
+TEST(EventLoopTest, TimerInvalidationFromOtherThreads)
+{
+    EventLoopThread loopThread;
+    loopThread.run();
+    auto loop = loopThread.getLoop();
+    std::atomic<int> fired{0};
+    std::vector<TimerId> ids;
+    for (int i = 0; i < 1000; ++i)
+    {
+        ids.push_back(loop->runAfter(0.05 + 0.0001 * i, [&fired, i]() {
+            fired.fetch_add(i % 4 == 0 ? 1 : 1000);
+        }));
+    }
+    // Three quarters of the timers are invalidated from this thread, they
+    // are swept from the heap.
+    for (int i = 0; i < 1000; ++i)
+    {
+        if (i % 4 != 0)
+            loop->invalidateTimer(ids[i]);
+    }
+    // Neither the id of an expired timer nor an id never returned
+    // invalidates the timer reusing its slot.
+    std::promise<void> expired;
+    auto stale = loop->runAfter(0.001, [&expired]() { expired.set_value(); });
+    expired.get_future().wait();
+    std::promise<void> done;
+    loop->runAfter(0.01, [&done]() { done.set_value(); });
+    loop->invalidateTimer(stale);
+    loop->invalidateTimer(stale + 1);
+    done.get_future().wait();
+    std::promise<void> allDone;
+    loop->runAfter(0.2, [&allDone]() { allDone.set_value(); });
+    allDone.get_future().wait();
+    EXPECT_EQ(250, fired.load());
+    loop->quit();
+    loopThread.wait();
+}
+TEST(EventLoopTest, TimersFromManyThreads)
+{
+    const int kThreads = 4;
+    const int kTimers = 5000;
+    EventLoopThread loopThread;
+    loopThread.run();
+    auto loop = loopThread.getLoop();
+    // The timers of other threads come from the shared free list, to which
+    // the loop gives them back while it allocates its own timers too.
+    std::atomic<int> fired{0};
+    std::atomic<int> local{0};
+    std::function<void()> addLocal = [&]() {
+        if (++local < kThreads * kTimers)
+            loop->runAfter(0.0, addLocal);
+    };
+    loop->runInLoop([&]() { loop->runAfter(0.0, addLocal); });
+    std::vector<std::vector<TimerId>> ids(kThreads);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t)
+    {
+        threads.emplace_back([&, t]() {
+            for (int i = 0; i < kTimers; ++i)
+            {
+                ids[t].push_back(loop->runAfter(0.0, [&fired]() { ++fired; }));
+                // Leave the loop time to free some of them.
+                if (i % 100 == 0)
+                    std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+    for (int i = 0; i < 500 && (fired < kThreads * kTimers ||
+                                local < kThreads * kTimers);
+         ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    EXPECT_EQ(kThreads * kTimers, fired.load());
+    EXPECT_EQ(kThreads * kTimers, local.load());
+    std::set<TimerId> unique;
+    for (auto &threadIds : ids)
+        unique.insert(threadIds.begin(), threadIds.end());
+    EXPECT_EQ(static_cast<size_t>(kThreads * kTimers), unique.size());
+    loop->quit();
+    loopThread.wait();
+}
+TEST(EventLoopTest, TimerSlack)
+{
+    EventLoopThread loopThread;
+    loopThread.run();
+    auto loop = loopThread.getLoop();
+    loop->setTimerSlack(std::chrono::milliseconds(20));
+    std::vector<std::chrono::steady_clock::time_point> deadlines(50);
+    std::vector<std::chrono::steady_clock::time_point> fired(50);
+    std::promise<void> done;
+    std::atomic<int> remaining{50};
+    uint64_t arms = 0;
+    loop->runInLoop([&]() {
+        arms = loop->getStats().timerArms;
+        // Each timer is earlier than the previous ones.
+        for (int i = 0; i < 50; ++i)
+        {
+            double delay = 0.01 + 0.0001 * (49 - i);
+            deadlines[i] = std::chrono::steady_clock::now() +
+                           std::chrono::microseconds(
+                               static_cast<int64_t>(delay * 1000000));
+            loop->runAfter(delay, [&, i]() {
+                fired[i] = std::chrono::steady_clock::now();
+                if (--remaining == 0)
+                    done.set_value();
+            });
+        }
+    });
+    done.get_future().wait();
+    for (int i = 0; i < 50; ++i)
+    {
+        EXPECT_GE(fired[i], deadlines[i]);
+    }
+    std::promise<EventLoopStatsSnapshot> stats;
+    loop->runInLoop([&]() { stats.set_value(loop->getStats()); });
+    auto snapshot = stats.get_future().get();
+#ifdef __linux__
+    // The first timer armed the timerfd, the others waited for it, and all
+    // of them fired in one wakeup.
+    EXPECT_EQ(49, snapshot.timerArmsSaved);
+    EXPECT_EQ(arms + 1, snapshot.timerArms);
+#endif
+    loop->quit();
+    loopThread.wait();
+}
+TEST(EventLoopTest, TimersWithoutTimerfd)
+{
+    EventLoopThread loopThread;
+    loopThread.run();
+    auto loop = loopThread.getLoop();
+    loop->disableTimerfd();
+    // The loop waits in the poller with no timer, a timer from another
+    // thread shortens the wait.
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    std::vector<int> fired;
+    int repeats = 0;
+    std::promise<void> done;
+    auto start = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point firedAt;
+    loop->runAfter(0.0005, [&]() {
+        firedAt = std::chrono::steady_clock::now();
+        fired.push_back(0);
+    });
+    loop->runInLoop([&]() {
+        loop->runAfter(0.003, [&fired]() { fired.push_back(2); });
+        auto id = loop->runAfter(0.002, [&fired]() { fired.push_back(-1); });
+        loop->runAfter(0.001, [&fired]() { fired.push_back(1); });
+        loop->invalidateTimer(id);
+        auto repeating = std::make_shared<TimerId>(0);
+        *repeating = loop->runEvery(0.0002, [&, repeating]() {
+            if (++repeats == 5)
+            {
+                loop->invalidateTimer(*repeating);
+                loop->runAfter(0.01, [&done]() { done.set_value(); });
+            }
+        });
+    });
+    ASSERT_EQ(std::future_status::ready,
+              done.get_future().wait_for(std::chrono::seconds(5)));
+    EXPECT_GE(firedAt - start, std::chrono::microseconds(500));
+    EXPECT_LT(firedAt - start, std::chrono::seconds(1));
+    EXPECT_EQ((std::vector<int>{0, 1, 2}), fired);
+    EXPECT_EQ(5, repeats);
+    loop->quit();
+    loopThread.wait();
+}
+TEST(EventLoopTest, BusyPollingStopsAtTimer)
+{
+    EventLoopThread loopThread;
+    loopThread.run();
+    auto loop = loopThread.getLoop();
+    // The timers only run once the loop leaves the poller.
+    loop->disableTimerfd();
+    // Nothing wakes the loop up but the function below.
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    std::promise<std::chrono::steady_clock::duration> fired;
+    loop->runInLoop([&]() {
+        // The loop spins up to the maximum before the first poll that
+        // blocks, the timer is due well before.
+        loop->enableBusyPolling(std::chrono::milliseconds(500));
+        auto start = std::chrono::steady_clock::now();
+        loop->runAfter(0.002, [&fired, start]() {
+            fired.set_value(std::chrono::steady_clock::now() - start);
+        });
+    });
+    auto future = fired.get_future();
+    ASSERT_EQ(std::future_status::ready,
+              future.wait_for(std::chrono::seconds(5)));
+    auto delay = future.get();
+    EXPECT_GE(delay, std::chrono::milliseconds(2));
+    EXPECT_LT(delay, std::chrono::milliseconds(200));
+    loop->quit();
+    loopThread.wait();
+}
+TEST(EventLoopTest, FixedRateTimer)
+{
+    EventLoopThread loopThread;
+    loopThread.run();
+    auto loop = loopThread.getLoop();
+    const auto interval = std::chrono::milliseconds(2);
+    std::vector<std::chrono::steady_clock::time_point> fixedRate, repeating;
+    std::promise<void> done;
+    std::chrono::steady_clock::time_point start;
+    loop->runInLoop([&]() {
+        start = std::chrono::steady_clock::now();
+        // Each run takes half an interval, a timer rescheduled from the time
+        // it ran drifts by that much each time.
+        auto fixedId = std::make_shared<TimerId>(0);
+        *fixedId = loop->runAtFixedRate(
+            interval,
+            [&, fixedId]() {
+                fixedRate.push_back(std::chrono::steady_clock::now());
+                std::this_thread::sleep_for(interval / 2);
+                if (fixedRate.size() == 20)
+                {
+                    loop->invalidateTimer(*fixedId);
+                    done.set_value();
+                }
+            },
+            std::chrono::microseconds(50));
+        // An integer duration for a usual repeating timer.
+        auto repeatingId = std::make_shared<TimerId>(0);
+        *repeatingId = loop->runEvery(interval, [&, repeatingId]() {
+            repeating.push_back(std::chrono::steady_clock::now());
+            if (repeating.size() == 10)
+                loop->invalidateTimer(*repeatingId);
+        });
+    });
+    done.get_future().wait();
+    std::promise<void> flushed;
+    loop->runInLoop([&flushed]() { flushed.set_value(); });
+    flushed.get_future().wait();
+    ASSERT_EQ(20, fixedRate.size());
+    for (size_t i = 0; i < fixedRate.size(); ++i)
+    {
+        // Never early, on the grid of the first deadline unless a run was
+        // skipped.
+        auto offset = fixedRate[i] - start;
+        EXPECT_GE(offset, interval * static_cast<int>(i + 1));
+    }
+    // The last run is within a few intervals of its nominal time, the runs
+    // don't accumulate their delays.
+    EXPECT_LT(fixedRate.back() - start, interval * 20 + interval * 5);
+    ASSERT_EQ(10, repeating.size());
+    EXPECT_GE(repeating.back() - start, interval * 10);
+    loop->quit();
+    loopThread.wait();
+}
+TEST(EventLoopTest, Watchdog)
+{
+    EventLoopThread loopThread;
+    loopThread.run();
+    auto loop = loopThread.getLoop();
+    // The report gives the index of the loop, not the order of watch().
+    loop->setIndex(3);
+    EventLoopWatchdog watchdog(std::chrono::milliseconds(50));
+    std::mutex mutex;
+    std::vector<LoopStallReport> reports;
+    watchdog.setStallCallback([&](const LoopStallReport &report) {
+        std::lock_guard<std::mutex> guard(mutex);
+        reports.push_back(report);
+    });
+    watchdog.watch(loop);
+    // An idle loop is not stalled.
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    EXPECT_EQ(0, watchdog.stalls());
+    std::promise<void> done;
+    loop->queueInLoop([&done]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        done.set_value();
+    });
+    done.get_future().wait();
+    std::promise<void> timerDone;
+    int runs = 0;
+    auto start = std::chrono::steady_clock::now();
+    auto timerId = loop->runEvery(std::chrono::milliseconds(10), [&]() {
+        // The second run gets stuck.
+        if (++runs != 2)
+            return;
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        timerDone.set_value();
+    });
+    timerDone.get_future().wait();
+    loop->invalidateTimer(timerId);
+    // Let the watchdog see the loop back in the poller.
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    watchdog.unwatch(loop);
+    ASSERT_EQ(2, watchdog.stalls());
+    std::lock_guard<std::mutex> guard(mutex);
+    ASSERT_EQ(2, reports.size());
+    EXPECT_EQ(loop, reports[0].loop);
+    EXPECT_EQ(3, reports[0].loopIndex);
+    EXPECT_GE(reports[0].duration.count(), 50);
+    EXPECT_STREQ("calling queued functions", reports[0].activity);
+    EXPECT_EQ(-1, reports[0].fd);
+    EXPECT_STREQ("running timers", reports[1].activity);
+    EXPECT_EQ(timerId, reports[1].timerId);
+    EXPECT_GE(reports[1].timerDeadline,
+              start + std::chrono::milliseconds(20));
+    EXPECT_LT(reports[1].timerDeadline, start + std::chrono::milliseconds(300));
+    EXPECT_EQ(std::chrono::milliseconds(10), reports[1].timerInterval);
+    EXPECT_EQ(InvalidTimerId, reports[0].timerId);
+#if defined(__linux__) && defined(__GLIBC__)
+    EXPECT_GE(reports[1].fd, 0);
+    EXPECT_FALSE(reports[0].stackTrace.empty());
+#endif
+    loop->quit();
+    loopThread.wait();
+}
+
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,286 @@
+#include <trantor/net/EventLoopThread.h>
+#include <trantor/net/Channel.h>
+#include "poller/IoUringPoller.h"
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+using namespace trantor;
+
+// The library is built with USE_IO_URING, so every EventLoop in this test
+// polls with io_uring when the kernel supports it.
+#define SKIP_WITHOUT_IO_URING()                                     \
+    if (!IoUringPoller::isSupported())                              \
+    {                                                               \
+        GTEST_SKIP() << "io_uring is not supported by the kernel"; \
+    }
+
+static void makePipe(int fds[2])
+{
+    ASSERT_EQ(0, pipe2(fds, O_NONBLOCK | O_CLOEXEC));
+}
+
+// Run the function in the loop and wait for it to return.
+template <typename F>
+static void runAndWait(EventLoop *loop, F &&f)
+{
+    std::promise<void> done;
+    loop->runInLoop([&]() {
+        f();
+        done.set_value();
+    });
+    done.get_future().wait();
+}
+
+// Wait until the loop has gone through a few more iterations, so that the
+// completions of the previous ones have been handled.
+static void settle(EventLoop *loop)
+{
+    for (int i = 0; i < 3; ++i)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        runAndWait(loop, []() {});
+    }
+}
+
+TEST(IoUringPollerTest, RearmOneShotPoll)
+{
+    SKIP_WITHOUT_IO_URING();
+    int fds[2];
+    makePipe(fds);
+    EventLoopThread loopThread;
+    loopThread.run();
+    auto loop = loopThread.getLoop();
+    std::unique_ptr<Channel> channel;
+    std::atomic<int> reads{0};
+    runAndWait(loop, [&]() {
+        channel = std::make_unique<Channel>(loop, fds[0]);
+        channel->setReadCallback([&]() {
+            // Read one byte at a time, the re-armed poll completes again as
+            // long as the pipe is readable.
+            char c;
+            EXPECT_EQ(1, read(fds[0], &c, 1));
+            ++reads;
+        });
+        channel->enableReading();
+    });
+    ASSERT_EQ(5, write(fds[1], "12345", 5));
+    settle(loop);
+    EXPECT_EQ(5, reads);
+    runAndWait(loop, [&]() {
+        channel->disableAll();
+        channel->remove();
+        channel.reset();
+    });
+    loop->quit();
+    loopThread.wait();
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST(IoUringPollerTest, ChangeEventsOfArmedChannel)
+{
+    SKIP_WITHOUT_IO_URING();
+    int fds[2];
+    makePipe(fds);
+    EventLoopThread loopThread;
+    loopThread.run();
+    auto loop = loopThread.getLoop();
+    std::unique_ptr<Channel> channel;
+    std::atomic<int> writes{0};
+    runAndWait(loop, [&]() {
+        channel = std::make_unique<Channel>(loop, fds[1]);
+        channel->setWriteCallback([&]() {
+            ++writes;
+            channel->disableWriting();
+        });
+        channel->enableWriting();
+    });
+    settle(loop);
+    // Disabling writing cancelled the poll, or the writable pipe would have
+    // been reported again.
+    EXPECT_EQ(1, writes);
+    // The write end of a pipe never becomes readable, so the poll armed for
+    // reading doesn't complete until it is cancelled and armed again with
+    // writing enabled too.
+    runAndWait(loop, [&]() { channel->enableReading(); });
+    settle(loop);
+    EXPECT_EQ(1, writes);
+    runAndWait(loop, [&]() { channel->enableWriting(); });
+    settle(loop);
+    EXPECT_EQ(2, writes);
+    runAndWait(loop, [&]() {
+        channel->disableAll();
+        channel->remove();
+        channel.reset();
+    });
+    loop->quit();
+    loopThread.wait();
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST(IoUringPollerTest, DropCompletionsOfRemovedChannel)
+{
+    SKIP_WITHOUT_IO_URING();
+    int fds[2];
+    makePipe(fds);
+    EventLoopThread loopThread;
+    loopThread.run();
+    auto loop = loopThread.getLoop();
+    std::unique_ptr<Channel> channel;
+    std::atomic<int> reads{0};
+    runAndWait(loop, [&]() {
+        channel = std::make_unique<Channel>(loop, fds[0]);
+        channel->setReadCallback([&]() { ++reads; });
+        channel->enableReading();
+    });
+    settle(loop);
+    int newFds[2];
+    runAndWait(loop, [&]() {
+        // The poll completes while the loop runs this function and its
+        // completion is still in the ring when the channel goes away.
+        EXPECT_EQ(1, write(fds[1], "x", 1));
+        channel->disableAll();
+        channel->remove();
+        close(fds[0]);
+        close(fds[1]);
+        // The new pipe gets the same fd, which must not see the completion.
+        makePipe(newFds);
+        EXPECT_EQ(fds[0], newFds[0]);
+        channel = std::make_unique<Channel>(loop, newFds[0]);
+        channel->setReadCallback([&]() {
+            char c;
+            EXPECT_EQ(1, read(newFds[0], &c, 1));
+            ++reads;
+        });
+        channel->enableReading();
+    });
+    settle(loop);
+    EXPECT_EQ(0, reads);
+    ASSERT_EQ(1, write(newFds[1], "x", 1));
+    settle(loop);
+    EXPECT_EQ(1, reads);
+    runAndWait(loop, [&]() {
+        channel->disableAll();
+        channel->remove();
+        channel.reset();
+    });
+    loop->quit();
+    loopThread.wait();
+    close(newFds[0]);
+    close(newFds[1]);
+}
+
+TEST(IoUringPollerTest, SubmissionQueueExhaustion)
+{
+    SKIP_WITHOUT_IO_URING();
+    // Many more polls than the submission queue holds (256 entries), and
+    // more completions than the completion queue holds, in one batch.
+    size_t pipes = 1500;
+    struct rlimit limit;
+    ASSERT_EQ(0, getrlimit(RLIMIT_NOFILE, &limit));
+    if (limit.rlim_cur < 2 * pipes + 64)
+    {
+        limit.rlim_cur = std::min<rlim_t>(limit.rlim_max, 2 * pipes + 64);
+        setrlimit(RLIMIT_NOFILE, &limit);
+        ASSERT_EQ(0, getrlimit(RLIMIT_NOFILE, &limit));
+        pipes = std::min<size_t>(pipes, (limit.rlim_cur - 64) / 2);
+    }
+    std::vector<int> fds(2 * pipes);
+    for (size_t i = 0; i < pipes; ++i)
+    {
+        makePipe(&fds[2 * i]);
+        ASSERT_EQ(1, write(fds[2 * i + 1], "x", 1));
+    }
+    EventLoopThread loopThread;
+    loopThread.run();
+    auto loop = loopThread.getLoop();
+    std::vector<std::unique_ptr<Channel>> channels;
+    std::atomic<size_t> reads{0};
+    runAndWait(loop, [&]() {
+        for (size_t i = 0; i < pipes; ++i)
+        {
+            channels.emplace_back(new Channel(loop, fds[2 * i]));
+            auto channel = channels.back().get();
+            channel->setReadCallback([&, channel]() {
+                char c;
+                EXPECT_EQ(1, read(channel->fd(), &c, 1));
+                channel->disableAll();
+                ++reads;
+            });
+            channel->enableReading();
+        }
+    });
+    for (int i = 0; i < 250 && reads < pipes; ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    EXPECT_EQ(pipes, reads);
+    runAndWait(loop, [&]() {
+        for (auto &channel : channels)
+        {
+            channel->disableAll();
+            channel->remove();
+        }
+        channels.clear();
+    });
+    loop->quit();
+    loopThread.wait();
+    for (auto fd : fds)
+        close(fd);
+}
+
+TEST(IoUringPollerTest, MergeCompletionsOfMultishotPoll)
+{
+    SKIP_WITHOUT_IO_URING();
+    int fds[2];
+    makePipe(fds);
+    EventLoopThread loopThread;
+    loopThread.run();
+    auto loop = loopThread.getLoop();
+    std::unique_ptr<Channel> channel;
+    std::atomic<int> calls{0};
+    std::atomic<int> bytes{0};
+    runAndWait(loop, [&]() {
+        channel = std::make_unique<Channel>(loop, fds[0]);
+        channel->setEdgeTriggered(true);
+        channel->setReadCallback([&]() {
+            ++calls;
+            char buf[16];
+            ssize_t n;
+            while ((n = read(fds[0], buf, sizeof(buf))) > 0)
+                bytes += static_cast<int>(n);
+        });
+        channel->enableReading();
+    });
+    settle(loop);
+    runAndWait(loop, [&]() {
+        // Each write may complete the multishot poll once more before the
+        // loop polls again, the channel is handled once for all of them.
+        for (int i = 0; i < 3; ++i)
+            EXPECT_EQ(1, write(fds[1], "x", 1));
+    });
+    settle(loop);
+    EXPECT_EQ(3, bytes);
+    EXPECT_EQ(1, calls);
+    runAndWait(loop, [&]() {
+        channel->disableAll();
+        channel->remove();
+        channel.reset();
+    });
+    loop->quit();
+    loopThread.wait();
+    close(fds[0]);
+    close(fds[1]);
+}
+
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
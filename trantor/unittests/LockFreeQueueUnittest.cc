@@ -0,0 +1,132 @@
+#include <trantor/utils/LockFreeQueue.h>
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace trantor;
+TEST(MpscQueueTest, FifoTest)
+{
+    MpscQueue<std::string> queue;
+    EXPECT_TRUE(queue.empty());
+    for (int i = 0; i < 100; ++i)
+        queue.enqueue(std::to_string(i));
+    EXPECT_FALSE(queue.empty());
+    std::string str;
+    for (int i = 0; i < 50; ++i)
+    {
+        ASSERT_TRUE(queue.dequeue(str));
+        EXPECT_EQ(std::to_string(i), str);
+    }
+    int next = 50;
+    auto n = queue.dequeueAll([&next](std::string &&s) {
+        EXPECT_EQ(std::to_string(next), s);
+        ++next;
+    });
+    EXPECT_EQ(50, n);
+    EXPECT_TRUE(queue.empty());
+    EXPECT_FALSE(queue.dequeue(str));
+}
+TEST(MpscQueueTest, DestroyItemsTest)
+{
+    auto item = std::make_shared<int>(1);
+    {
+        MpscQueue<std::shared_ptr<int>> queue;
+        for (int i = 0; i < 10; ++i)
+            queue.enqueue(item);
+        std::shared_ptr<int> out;
+        ASSERT_TRUE(queue.dequeue(out));
+        out.reset();
+        EXPECT_EQ(10, item.use_count());
+    }
+    EXPECT_EQ(1, item.use_count());
+}
+TEST(MpscQueueTest, MultipleProducersTest)
+{
+    const int kThreads = 4;
+    const int kItems = 100000;
+    MpscQueue<std::pair<int, int>> queue;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t)
+    {
+        threads.emplace_back([&queue, t]() {
+            for (int i = 0; i < kItems; ++i)
+                queue.enqueue(std::make_pair(t, i));
+        });
+    }
+    std::vector<int> next(kThreads, 0);
+    int count = 0;
+    while (count < kThreads * kItems)
+    {
+        auto n = queue.dequeueAll([&next](std::pair<int, int> &&item) {
+            // Items of one producer come out in order.
+            EXPECT_EQ(next[item.first], item.second);
+            next[item.first] = item.second + 1;
+        });
+        if (n == 0)
+            std::this_thread::yield();
+        count += static_cast<int>(n);
+    }
+    for (auto &t : threads)
+        t.join();
+    EXPECT_TRUE(queue.empty());
+}
+TEST(BoundedMpscQueueTest, CapacityTest)
+{
+    BoundedMpscQueue<std::unique_ptr<int>> queue(5);
+    EXPECT_EQ(8, queue.capacity());
+    for (int i = 0; i < 8; ++i)
+        EXPECT_TRUE(queue.enqueue(std::unique_ptr<int>(new int(i))));
+    std::unique_ptr<int> item(new int(8));
+    EXPECT_FALSE(queue.enqueue(std::move(item)));
+    ASSERT_TRUE(item);
+    std::unique_ptr<int> out;
+    ASSERT_TRUE(queue.dequeue(out));
+    EXPECT_EQ(0, *out);
+    EXPECT_TRUE(queue.enqueue(std::move(item)));
+    int next = 1;
+    auto n = queue.dequeueAll([&next](std::unique_ptr<int> &&i) {
+        EXPECT_EQ(next, *i);
+        ++next;
+    });
+    EXPECT_EQ(8, n);
+    EXPECT_TRUE(queue.empty());
+}
+TEST(BoundedMpscQueueTest, MultipleProducersTest)
+{
+    const int kThreads = 4;
+    const int kItems = 100000;
+    BoundedMpscQueue<std::pair<int, int>> queue(64);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t)
+    {
+        threads.emplace_back([&queue, t]() {
+            for (int i = 0; i < kItems; ++i)
+            {
+                while (!queue.enqueue(std::make_pair(t, i)))
+                    std::this_thread::yield();
+            }
+        });
+    }
+    std::vector<int> next(kThreads, 0);
+    int count = 0;
+    while (count < kThreads * kItems)
+    {
+        auto n = queue.dequeueAll([&next](std::pair<int, int> &&item) {
+            EXPECT_EQ(next[item.first], item.second);
+            next[item.first] = item.second + 1;
+        });
+        if (n == 0)
+            std::this_thread::yield();
+        count += static_cast<int>(n);
+    }
+    for (auto &t : threads)
+        t.join();
+    EXPECT_TRUE(queue.empty());
+}
+
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
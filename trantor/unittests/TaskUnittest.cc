@@ -0,0 +1,99 @@
+#include <trantor/utils/Task.h>
+#include <trantor/net/EventLoopThread.h>
+#include <gtest/gtest.h>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+using namespace trantor;
+static int counter = 0;
+static void increase()
+{
+    ++counter;
+}
+TEST(TaskTest, EmptyTest)
+{
+    Task task;
+    EXPECT_FALSE(task);
+    EXPECT_THROW(task(), std::bad_function_call);
+    std::function<void()> func;
+    EXPECT_FALSE(Task(func));
+    void (*funcPtr)() = nullptr;
+    EXPECT_FALSE(Task(funcPtr));
+    task = nullptr;
+    EXPECT_FALSE(task);
+}
+TEST(TaskTest, CallableTest)
+{
+    counter = 0;
+    Task task(increase);
+    ASSERT_TRUE(task);
+    task();
+    std::function<void()> func(increase);
+    Task task1(func);
+    task1();
+    EXPECT_TRUE(func);
+    Task task2([]() { ++counter; });
+    EXPECT_TRUE(task2.isInline());
+    task2();
+    EXPECT_EQ(3, counter);
+}
+TEST(TaskTest, MoveOnlyTest)
+{
+    auto ptr = std::unique_ptr<int>(new int(0));
+    int *raw = ptr.get();
+    Task task([p = std::move(ptr)]() { ++*p; });
+    EXPECT_TRUE(task.isInline());
+    task();
+    Task task1(std::move(task));
+    EXPECT_FALSE(task);
+    task1();
+    task = std::move(task1);
+    task();
+    EXPECT_EQ(3, *raw);
+}
+TEST(TaskTest, StorageTest)
+{
+    auto item = std::make_shared<int>(0);
+    std::string str("a string which is longer than the small string buffer");
+    // A shared pointer and a string fit in the storage of a task.
+    Task task([item, str]() { *item += str.size(); });
+    EXPECT_TRUE(task.isInline());
+    EXPECT_EQ(2, item.use_count());
+    char large[Task::kInlineSize + 1] = {0};
+    Task task1([item, large]() { *item += sizeof(large); });
+    EXPECT_FALSE(task1.isInline());
+    EXPECT_EQ(3, item.use_count());
+    task = std::move(task1);
+    EXPECT_FALSE(task.isInline());
+    EXPECT_EQ(2, item.use_count());
+    task();
+    EXPECT_EQ(static_cast<int>(sizeof(large)), *item);
+    task = nullptr;
+    EXPECT_EQ(1, item.use_count());
+}
+TEST(TaskTest, EventLoopTest)
+{
+    EventLoopThread loopThread;
+    loopThread.run();
+    auto loop = loopThread.getLoop();
+    std::promise<int> prom;
+    auto value = std::unique_ptr<int>(new int(1));
+    loop->queueInLoop([&prom, v = std::move(value)]() { prom.set_value(*v); });
+    EXPECT_EQ(1, prom.get_future().get());
+    std::promise<int> prom1;
+    value.reset(new int(2));
+    loop->runAfter(0.01,
+                   [&prom1, v = std::move(value)]() { prom1.set_value(*v); });
+    EXPECT_EQ(2, prom1.get_future().get());
+    std::promise<int> prom2;
+    std::function<void()> func = [&prom2]() { prom2.set_value(3); };
+    loop->runInLoop(func);
+    EXPECT_EQ(3, prom2.get_future().get());
+    loop->quit();
+}
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,567 @@
+#include <trantor/net/TcpServer.h>
+#include <trantor/net/TcpClient.h>
+#include <trantor/net/EventLoopThread.h>
+#include <gtest/gtest.h>
+#include <atomic>
+#include <future>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+using namespace trantor;
+
+#ifdef __linux__
+// Connect to the port on the loopback address with a blocking socket.
+static int connectTo(uint16_t port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+TEST(TcpServerTest, AcceptorPerLoop)
+{
+    const size_t kLoops = 3;
+    const size_t kClients = 30;
+    EventLoopThread baseThread;
+    baseThread.run();
+    TcpServer server(baseThread.getLoop(), InetAddress(0), "reuseport");
+    server.setIoLoopNum(kLoops);
+    server.enableAcceptorPerLoop();
+    std::mutex mutex;
+    std::map<EventLoop *, size_t> connections;
+    std::atomic<size_t> connected{0};
+    std::atomic<bool> wrongThread{false};
+    std::promise<void> allConnected;
+    server.setConnectionCallback([&](const TcpConnectionPtr &conn) {
+        if (!conn->getLoop()->isInLoopThread())
+            wrongThread = true;
+        if (conn->connected())
+        {
+            {
+                std::lock_guard<std::mutex> guard(mutex);
+                ++connections[conn->getLoop()];
+            }
+            if (++connected == kClients)
+                allConnected.set_value();
+        }
+    });
+    server.setRecvMessageCallback(
+        [](const TcpConnectionPtr &conn, MsgBuffer *buf) {
+            conn->send(buf->peek(), buf->readableBytes());
+            buf->retrieveAll();
+        });
+    server.start();
+    std::promise<void> listening;
+    baseThread.getLoop()->queueInLoop([&]() { listening.set_value(); });
+    listening.get_future().wait();
+    auto port = server.address().toPort();
+    ASSERT_NE(0, port);
+
+    std::vector<int> fds;
+    for (size_t i = 0; i < kClients; ++i)
+    {
+        int fd = connectTo(port);
+        ASSERT_GE(fd, 0);
+        fds.push_back(fd);
+    }
+    auto f = allConnected.get_future();
+    ASSERT_EQ(std::future_status::ready, f.wait_for(std::chrono::seconds(5)));
+    // The connections are echoed by the loops which accepted them.
+    char buf[4];
+    EXPECT_EQ(4, write(fds[0], "ping", 4));
+    EXPECT_EQ(4, read(fds[0], buf, 4));
+    EXPECT_FALSE(wrongThread);
+    size_t counted = 0;
+    for (auto loop : server.getIoLoops())
+    {
+        EXPECT_EQ(connections[loop], loop->connectionCount());
+        counted += loop->connectionCount();
+    }
+    EXPECT_EQ(kClients, counted);
+    // The kernel spreads the connections over the sockets.
+    EXPECT_GT(connections.size(), 1);
+
+    server.stop();
+    for (auto fd : fds)
+    {
+        // The server closed the connection.
+        EXPECT_EQ(0, read(fd, buf, sizeof(buf)));
+        close(fd);
+    }
+    baseThread.getLoop()->quit();
+    baseThread.wait();
+}
+// The clients run on one CPU, to which only the first of two loops is
+// pinned, so all the connections are received on that CPU and placed on the
+// first loop, while the kernel would spread them over both otherwise.
+static void placeByIncomingCpu(bool acceptorPerLoop)
+{
+    const size_t kClients = 20;
+    auto cpus = CpuAffinity::allowedCpus();
+    ASSERT_FALSE(cpus.empty());
+    int cpu = cpus[0];
+    EventLoopThread baseThread;
+    baseThread.run();
+    TcpServer server(baseThread.getLoop(), InetAddress(0), "placement");
+    // Pin the second loop to another CPU when there is one.
+    int other = cpus.size() > 1 ? cpus[1] : cpu;
+    auto poolPtr = std::make_shared<EventLoopThreadPool>(2);
+    server.setIoLoopThreadPool(poolPtr);
+    poolPtr->setCpuAffinity(CpuAffinity::cpuList({cpu, other}));
+    if (acceptorPerLoop)
+        server.enableAcceptorPerLoop();
+    server.enableIncomingCpuPlacement();
+    std::atomic<size_t> connected{0};
+    std::promise<void> allConnected;
+    server.setConnectionCallback([&](const TcpConnectionPtr &conn) {
+        if (conn->connected() && ++connected == kClients)
+            allConnected.set_value();
+    });
+    server.start();
+    std::promise<void> listening;
+    baseThread.getLoop()->queueInLoop([&]() { listening.set_value(); });
+    listening.get_future().wait();
+
+    std::vector<int> fds;
+    std::thread clients([&]() {
+        CpuAffinity::cpuList({cpu}).apply(0);
+        for (size_t i = 0; i < kClients; ++i)
+            fds.push_back(connectTo(server.address().toPort()));
+    });
+    clients.join();
+    for (auto fd : fds)
+        ASSERT_GE(fd, 0);
+    auto f = allConnected.get_future();
+    ASSERT_EQ(std::future_status::ready, f.wait_for(std::chrono::seconds(5)));
+    EXPECT_EQ(kClients, poolPtr->getLoop(0)->connectionCount());
+    EXPECT_EQ(0, poolPtr->getLoop(1)->connectionCount());
+
+    server.stop();
+    for (auto fd : fds)
+        close(fd);
+    baseThread.getLoop()->quit();
+    baseThread.wait();
+}
+
+// The server stops in another thread while its connections are open, the
+// loops close their own connections and the idle timing wheels before the
+// pool owned by the server quits.
+TEST(TcpServerTest, StopWithOpenConnections)
+{
+    const size_t kClients = 10;
+    EventLoopThread baseThread;
+    baseThread.run();
+    TcpServer server(baseThread.getLoop(), InetAddress(0), "stop");
+    server.setIoLoopNum(2);
+    server.kickoffIdleConnections(10);
+    std::atomic<size_t> connected{0};
+    std::atomic<size_t> disconnected{0};
+    std::promise<void> allConnected;
+    server.setConnectionCallback([&](const TcpConnectionPtr &conn) {
+        if (conn->connected())
+        {
+            if (++connected == kClients)
+                allConnected.set_value();
+        }
+        else
+        {
+            ++disconnected;
+        }
+    });
+    server.start();
+    std::promise<void> listening;
+    baseThread.getLoop()->queueInLoop([&]() { listening.set_value(); });
+    listening.get_future().wait();
+
+    std::vector<int> fds;
+    for (size_t i = 0; i < kClients; ++i)
+    {
+        int fd = connectTo(server.address().toPort());
+        ASSERT_GE(fd, 0);
+        fds.push_back(fd);
+    }
+    auto f = allConnected.get_future();
+    ASSERT_EQ(std::future_status::ready, f.wait_for(std::chrono::seconds(5)));
+
+    server.stop();
+    EXPECT_EQ(kClients, disconnected);
+    char buf[4];
+    for (auto fd : fds)
+    {
+        EXPECT_EQ(0, read(fd, buf, sizeof(buf)));
+        close(fd);
+    }
+    baseThread.getLoop()->quit();
+    baseThread.wait();
+}
+
+// The client fills the socket buffers while the loop of the connection is
+// blocked, then stops writing, so the server sees a single edge for all the
+// data queued on the socket. Returns the sizes of the chunks handed to the
+// message callback.
+static void receiveQueuedData(size_t maxBytesPerEvent,
+                              std::vector<size_t> &chunks)
+{
+    EventLoopThread baseThread;
+    baseThread.run();
+    TcpServer server(baseThread.getLoop(), InetAddress(0), "queued");
+    server.enableEdgeTriggered(maxBytesPerEvent);
+    std::promise<TcpConnectionPtr> connected;
+    server.setConnectionCallback([&](const TcpConnectionPtr &conn) {
+        if (conn->connected())
+            connected.set_value(conn);
+    });
+    std::mutex mutex;
+    std::atomic<size_t> received{0};
+    server.setRecvMessageCallback(
+        [&](const TcpConnectionPtr &, MsgBuffer *buf) {
+            {
+                std::lock_guard<std::mutex> guard(mutex);
+                chunks.push_back(buf->readableBytes());
+            }
+            received += buf->readableBytes();
+            buf->retrieveAll();
+        });
+    server.start();
+    std::promise<void> listening;
+    baseThread.getLoop()->queueInLoop([&]() { listening.set_value(); });
+    listening.get_future().wait();
+
+    int fd = connectTo(server.address().toPort());
+    ASSERT_GE(fd, 0);
+    auto f = connected.get_future();
+    ASSERT_EQ(std::future_status::ready, f.wait_for(std::chrono::seconds(5)));
+    auto conn = f.get();
+    std::promise<void> blocked;
+    std::promise<void> release;
+    auto released = release.get_future();
+    conn->getLoop()->queueInLoop([&]() {
+        blocked.set_value();
+        released.wait();
+    });
+    blocked.get_future().wait();
+    ASSERT_EQ(0, fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK));
+    std::string data(16 * 1024, 'x');
+    size_t sent = 0;
+    while (true)
+    {
+        auto n = write(fd, data.data(), data.size());
+        if (n <= 0)
+            break;
+        sent += n;
+    }
+    // Much more than one read of the connection takes.
+    EXPECT_GT(sent, 256 * 1024);
+    release.set_value();
+    for (int i = 0; i < 500 && received < sent; ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    EXPECT_EQ(sent, received);
+
+    conn.reset();
+    server.stop();
+    close(fd);
+    baseThread.getLoop()->quit();
+    baseThread.wait();
+}
+
+TEST(TcpServerTest, EdgeTriggeredReadDrainsSocket)
+{
+    std::vector<size_t> chunks;
+    receiveQueuedData(64 * 1024 * 1024, chunks);
+    ASSERT_FALSE(chunks.empty());
+    // The first event reads all the data queued on the socket, while a
+    // level-triggered read takes one buffer (about 10 KB at first).
+    EXPECT_GT(chunks[0], 64 * 1024);
+}
+
+TEST(TcpServerTest, EdgeTriggeredReadBudget)
+{
+    const size_t kMaxBytesPerEvent = 4096;
+    std::vector<size_t> chunks;
+    // The deferred reads go on without new edges from the client.
+    receiveQueuedData(kMaxBytesPerEvent, chunks);
+    EXPECT_GT(chunks.size(), 1);
+    for (auto chunk : chunks)
+    {
+        // The read which reaches the limit may overshoot it by one read,
+        // i.e. the free space of the buffer and 8 KB more.
+        EXPECT_LT(chunk, kMaxBytesPerEvent + 32 * 1024);
+    }
+}
+
+// The FIN of the client is queued behind its data when the server reads, a
+// single edge reports both.
+TEST(TcpServerTest, EdgeTriggeredReadSeesPeerClose)
+{
+    EventLoopThread baseThread;
+    baseThread.run();
+    TcpServer server(baseThread.getLoop(), InetAddress(0), "close");
+    server.enableEdgeTriggered();
+    std::promise<TcpConnectionPtr> connected;
+    std::promise<void> disconnected;
+    server.setConnectionCallback([&](const TcpConnectionPtr &conn) {
+        if (conn->connected())
+            connected.set_value(conn);
+        else
+            disconnected.set_value();
+    });
+    std::atomic<size_t> received{0};
+    server.setRecvMessageCallback(
+        [&](const TcpConnectionPtr &, MsgBuffer *buf) {
+            received += buf->readableBytes();
+            buf->retrieveAll();
+        });
+    server.start();
+    std::promise<void> listening;
+    baseThread.getLoop()->queueInLoop([&]() { listening.set_value(); });
+    listening.get_future().wait();
+
+    int fd = connectTo(server.address().toPort());
+    ASSERT_GE(fd, 0);
+    auto f = connected.get_future();
+    ASSERT_EQ(std::future_status::ready, f.wait_for(std::chrono::seconds(5)));
+    auto conn = f.get();
+    std::promise<void> blocked;
+    std::promise<void> release;
+    auto released = release.get_future();
+    conn->getLoop()->queueInLoop([&]() {
+        blocked.set_value();
+        released.wait();
+    });
+    blocked.get_future().wait();
+    // Far less than the read buffer takes, so the first read is short.
+    ASSERT_EQ(5, write(fd, "hello", 5));
+    ASSERT_EQ(0, shutdown(fd, SHUT_WR));
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    release.set_value();
+    EXPECT_EQ(std::future_status::ready,
+              disconnected.get_future().wait_for(std::chrono::seconds(5)));
+    EXPECT_EQ(5, received);
+
+    conn.reset();
+    server.stop();
+    close(fd);
+    baseThread.getLoop()->quit();
+    baseThread.wait();
+}
+
+// The server sends a buffer, a file and another buffer, and the socket
+// buffers fill up in the middle of each of them.
+static void sendBuffersAndFile(bool edgeTriggered)
+{
+    const size_t kFileSize = 1024 * 1024;
+    const size_t kBufferSize = 256 * 1024;
+    char path[] = "/tmp/trantor_sendfile_XXXXXX";
+    int fileFd = mkstemp(path);
+    ASSERT_GE(fileFd, 0);
+    std::string fileData(kFileSize, '\0');
+    for (size_t i = 0; i < kFileSize; ++i)
+        fileData[i] = static_cast<char>('a' + i % 26);
+    ASSERT_EQ(static_cast<ssize_t>(kFileSize),
+              write(fileFd, fileData.data(), kFileSize));
+    close(fileFd);
+    std::string head(kBufferSize, 'h');
+    std::string tail(kBufferSize, 't');
+
+    EventLoopThread baseThread;
+    baseThread.run();
+    TcpServer server(baseThread.getLoop(), InetAddress(0), "mixed");
+    if (edgeTriggered)
+        server.enableEdgeTriggered(64 * 1024);
+    server.setConnectionCallback([&](const TcpConnectionPtr &conn) {
+        if (conn->connected())
+        {
+            conn->send(head);
+            conn->sendFile(path);
+            conn->send(tail);
+            conn->shutdown();
+        }
+    });
+    server.start();
+    std::promise<void> listening;
+    baseThread.getLoop()->queueInLoop([&]() { listening.set_value(); });
+    listening.get_future().wait();
+
+    int fd = connectTo(server.address().toPort());
+    ASSERT_GE(fd, 0);
+    std::string received;
+    char buf[16 * 1024];
+    while (true)
+    {
+        auto n = read(fd, buf, sizeof(buf));
+        if (n <= 0)
+            break;
+        received.append(buf, n);
+    }
+    EXPECT_EQ(head + fileData + tail, received);
+
+    server.stop();
+    close(fd);
+    unlink(path);
+    baseThread.getLoop()->quit();
+    baseThread.wait();
+}
+
+TEST(TcpServerTest, SendBuffersAndFileLevelTriggered)
+{
+    sendBuffersAndFile(false);
+}
+
+TEST(TcpServerTest, SendBuffersAndFileEdgeTriggered)
+{
+    sendBuffersAndFile(true);
+}
+
+// The client is destroyed in another thread than its loop while its
+// connection is closed by the server, so the loop may handle the close at
+// the same time.
+TEST(TcpServerTest, DestroyClientWhileClosing)
+{
+    EventLoopThread baseThread;
+    baseThread.run();
+    TcpServer server(baseThread.getLoop(), InetAddress(0), "closing");
+    std::mutex mutex;
+    TcpConnectionPtr serverConn;
+    server.setConnectionCallback([&](const TcpConnectionPtr &conn) {
+        if (conn->connected())
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            serverConn = conn;
+        }
+    });
+    server.start();
+    std::promise<void> listening;
+    baseThread.getLoop()->queueInLoop([&]() { listening.set_value(); });
+    listening.get_future().wait();
+
+    EventLoopThread clientThread;
+    clientThread.run();
+    for (int i = 0; i < 50; ++i)
+    {
+        auto client = std::make_shared<TcpClient>(
+            clientThread.getLoop(),
+            InetAddress("127.0.0.1", server.address().toPort()),
+            "closing-client");
+        std::promise<void> connected;
+        client->setConnectionCallback([&](const TcpConnectionPtr &conn) {
+            if (conn->connected())
+                connected.set_value();
+        });
+        client->connect();
+        auto f = connected.get_future();
+        ASSERT_EQ(std::future_status::ready,
+                  f.wait_for(std::chrono::seconds(5)));
+        TcpConnectionPtr conn;
+        for (int j = 0; j < 500 && !conn; ++j)
+        {
+            {
+                std::lock_guard<std::mutex> guard(mutex);
+                conn = std::move(serverConn);
+            }
+            if (!conn)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        ASSERT_TRUE(conn);
+        conn->forceClose();
+        client.reset();
+    }
+
+    server.stop();
+    clientThread.getLoop()->quit();
+    clientThread.wait();
+    baseThread.getLoop()->quit();
+    baseThread.wait();
+}
+
+#ifdef TEST_CERT_FILE
+// Upgrading a connection to TLS switches it back to the level-triggered
+// mode, which the TLS layer needs since it reads records in pieces.
+TEST(TcpServerTest, EncryptionDisablesEdgeTriggered)
+{
+    const size_t kMessageSize = 256 * 1024;
+    EventLoopThread baseThread;
+    baseThread.run();
+    TcpServer server(baseThread.getLoop(), InetAddress(0), "tls");
+    server.enableEdgeTriggered(4096);
+    auto ctx = newSSLServerContext(TEST_CERT_FILE, TEST_CERT_FILE);
+    server.setConnectionCallback([ctx](const TcpConnectionPtr &conn) {
+        if (conn->connected())
+            conn->startServerEncryption(ctx, []() {});
+    });
+    server.setRecvMessageCallback(
+        [](const TcpConnectionPtr &conn, MsgBuffer *buf) {
+            conn->send(buf->peek(), buf->readableBytes());
+            buf->retrieveAll();
+        });
+    server.start();
+    std::promise<void> listening;
+    baseThread.getLoop()->queueInLoop([&]() { listening.set_value(); });
+    listening.get_future().wait();
+
+    EventLoopThread clientThread;
+    clientThread.run();
+    auto client = std::make_shared<TcpClient>(
+        clientThread.getLoop(),
+        InetAddress("127.0.0.1", server.address().toPort()),
+        "tls-client");
+    client->enableSSL(false, false);
+    std::string message(kMessageSize, 'm');
+    size_t received = 0;
+    std::promise<void> echoed;
+    client->setConnectionCallback([&](const TcpConnectionPtr &conn) {
+        if (conn->connected())
+            conn->send(message);
+    });
+    client->setMessageCallback([&](const TcpConnectionPtr &, MsgBuffer *buf) {
+        received += buf->readableBytes();
+        buf->retrieveAll();
+        if (received == kMessageSize)
+            echoed.set_value();
+    });
+    client->connect();
+    auto f = echoed.get_future();
+    EXPECT_EQ(std::future_status::ready, f.wait_for(std::chrono::seconds(5)));
+
+    client.reset();
+    server.stop();
+    clientThread.getLoop()->quit();
+    clientThread.wait();
+    baseThread.getLoop()->quit();
+    baseThread.wait();
+}
+#endif
+
+TEST(TcpServerTest, IncomingCpuPlacement)
+{
+    placeByIncomingCpu(false);
+}
+
+TEST(TcpServerTest, IncomingCpuSteering)
+{
+    placeByIncomingCpu(true);
+}
+#endif
+
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -21,7 +21,16 @@
 using namespace trantor;
 ConcurrentTaskQueue::ConcurrentTaskQueue(size_t threadNum,
                                          const std::string &name)
-    : queueCount_(threadNum), queueName_(name), stop_(false)
+    : ConcurrentTaskQueue(threadNum, name, CpuAffinity())
+{
+}
+ConcurrentTaskQueue::ConcurrentTaskQueue(size_t threadNum,
+                                         const std::string &name,
+                                         const CpuAffinity &affinity)
+    : queueCount_(threadNum),
+      queueName_(name),
+      affinity_(affinity),
+      stop_(false)
 {
     assert(threadNum > 0);
     for (unsigned int i = 0; i < queueCount_; ++i)
@@ -33,13 +42,15 @@ ConcurrentTaskQueue::ConcurrentTaskQueue(size_t threadNum,
 void ConcurrentTaskQueue::runTaskInQueue(const std::function<void()> &task)
 {
     LOG_TRACE << "copy task into queue";
-    std::lock_guard<std::mutex> lock(taskMutex_);
-    taskQueue_.push(task);
-    taskCond_.notify_one();
+    pushTask(Task(task));
 }
 void ConcurrentTaskQueue::runTaskInQueue(std::function<void()> &&task)
 {
     LOG_TRACE << "move task into queue";
+    pushTask(Task(std::move(task)));
+}
+void ConcurrentTaskQueue::pushTask(Task &&task)
+{
     std::lock_guard<std::mutex> lock(taskMutex_);
     taskQueue_.push(std::move(task));
     taskCond_.notify_one();
@@ -51,9 +62,10 @@ void ConcurrentTaskQueue::queueFunc(int queueNum)
 #ifdef __linux__
     ::prctl(PR_SET_NAME, tmpName);
 #endif
+    affinity_.apply(queueNum);
     while (!stop_)
     {
-        std::function<void()> r;
+        Task r;
         {
             std::unique_lock<std::mutex> lock(taskMutex_);
             while (!stop_ && taskQueue_.size() == 0)
@@ -15,6 +15,8 @@
 #pragma once
 
 #include <trantor/utils/TaskQueue.h>
+#include <trantor/utils/Task.h>
+#include <trantor/utils/CpuAffinity.h>
 #include <trantor/exports.h>
 #include <list>
 #include <memory>
@@ -40,6 +42,18 @@ class TRANTOR_EXPORT ConcurrentTaskQueue : public TaskQueue
      */
     ConcurrentTaskQueue(size_t threadNum, const std::string &name);
 
+    /**
+     * @brief Construct a new concurrent task queue instance whose threads are
+     * pinned, the thread i of the queue is the thread i of the affinity.
+     *
+     * @param threadNum The number of threads in the queue.
+     * @param name The name of the queue.
+     * @param affinity
+     */
+    ConcurrentTaskQueue(size_t threadNum,
+                        const std::string &name,
+                        const CpuAffinity &affinity);
+
     /**
      * @brief Run a task in the queue.
      *
@@ -48,6 +62,22 @@ class TRANTOR_EXPORT ConcurrentTaskQueue : public TaskQueue
     virtual void runTaskInQueue(const std::function<void()> &task);
     virtual void runTaskInQueue(std::function<void()> &&task);
 
+    /**
+     * @brief Run a task in the queue. This overload accepts callable objects
+     * that can't be copied, such as lambdas capturing a std::unique_ptr, and
+     * doesn't wrap them in a std::function.
+     *
+     * @param task
+     */
+    template <typename F,
+              typename = typename std::enable_if<!std::is_same<
+                  typename std::decay<F>::type,
+                  std::function<void()>>::value>::type>
+    void runTaskInQueue(F &&task)
+    {
+        pushTask(Task(std::forward<F>(task)));
+    }
+
     /**
      * @brief Get the name of the queue.
      *
@@ -76,14 +106,16 @@ class TRANTOR_EXPORT ConcurrentTaskQueue : public TaskQueue
   private:
     size_t queueCount_;
     std::string queueName_;
+    CpuAffinity affinity_;
 
-    std::queue<std::function<void()>> taskQueue_;
+    std::queue<Task> taskQueue_;
     std::vector<std::thread> threads_;
 
     std::mutex taskMutex_;
     std::condition_variable taskCond_;
     std::atomic_bool stop_;
     void queueFunc(int queueNum);
+    void pushTask(Task &&task);
 };
 
 }  // namespace trantor
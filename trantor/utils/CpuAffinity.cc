@@ -0,0 +1,188 @@
+/**
+ *
+ *  CpuAffinity.cc
+ *  An Tao
+ *
+ *  Public header file in trantor lib.
+ *
+ *  Copyright 2018, An Tao.  All rights reserved.
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the License file.
+ *
+ *
+ */
+
+#include <trantor/utils/CpuAffinity.h>
+#include <trantor/utils/Logger.h>
+#include <algorithm>
+#include <fstream>
+#include <errno.h>
+#include <stdlib.h>
+#ifdef __linux__
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+using namespace trantor;
+
+CpuAffinity CpuAffinity::cpuList(const std::vector<int> &cpus)
+{
+    CpuAffinity affinity;
+    for (auto cpu : cpus)
+    {
+        affinity.sets_.push_back({cpu});
+        affinity.nodes_.push_back(-1);
+    }
+    return affinity;
+}
+
+CpuAffinity CpuAffinity::roundRobin()
+{
+    return cpuList(allowedCpus());
+}
+
+CpuAffinity CpuAffinity::numaNodes()
+{
+    CpuAffinity affinity;
+#ifdef __linux__
+    auto allowed = allowedCpus();
+    // Node ids may have holes, stop after a run of missing nodes.
+    for (int node = 0, missing = 0; missing < 64; ++node)
+    {
+        std::ifstream file("/sys/devices/system/node/node" +
+                           std::to_string(node) + "/cpulist");
+        std::string list;
+        if (!file || !std::getline(file, list))
+        {
+            ++missing;
+            continue;
+        }
+        missing = 0;
+        std::vector<int> cpus;
+        for (auto cpu : parseCpuList(list))
+        {
+            if (std::find(allowed.begin(), allowed.end(), cpu) !=
+                allowed.end())
+                cpus.push_back(cpu);
+        }
+        if (cpus.empty())
+            continue;
+        affinity.sets_.push_back(std::move(cpus));
+        affinity.nodes_.push_back(node);
+    }
+#endif
+    if (affinity.empty())
+        LOG_WARN << "No NUMA node is found, the threads are not pinned";
+    return affinity;
+}
+
+std::vector<int> CpuAffinity::cpusOf(size_t index) const
+{
+    if (sets_.empty())
+        return {};
+    return sets_[index % sets_.size()];
+}
+
+int CpuAffinity::nodeOf(size_t index) const
+{
+    if (nodes_.empty())
+        return -1;
+    return nodes_[index % nodes_.size()];
+}
+
+bool CpuAffinity::apply(size_t index) const
+{
+    if (sets_.empty())
+        return true;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto cpu : cpusOf(index))
+    {
+        if (cpu >= 0 && cpu < CPU_SETSIZE)
+            CPU_SET(cpu, &set);
+    }
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (err != 0)
+    {
+        errno = err;
+        LOG_SYSERR << "Failed to pin the thread " << index;
+        return false;
+    }
+#ifdef SYS_set_mempolicy
+    int node = nodeOf(index);
+    if (node >= 0)
+    {
+        // MPOL_PREFERRED, the kernel falls back to other nodes when the node
+        // is out of memory.
+        const int kPreferred = 1;
+        const size_t kBits = 8 * sizeof(unsigned long);
+        std::vector<unsigned long> mask(node / kBits + 1, 0);
+        mask[node / kBits] = 1UL << (node % kBits);
+        if (syscall(SYS_set_mempolicy,
+                    kPreferred,
+                    mask.data(),
+                    mask.size() * kBits + 1) < 0)
+        {
+            LOG_SYSERR << "Failed to set the memory policy of the thread "
+                       << index;
+            return false;
+        }
+    }
+#endif
+#endif
+    return true;
+}
+
+std::vector<int> CpuAffinity::allowedCpus()
+{
+    std::vector<int> cpus;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+    {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        {
+            if (CPU_ISSET(cpu, &set))
+                cpus.push_back(cpu);
+        }
+    }
+#endif
+    return cpus;
+}
+
+std::vector<int> CpuAffinity::parseCpuList(const std::string &list)
+{
+    std::vector<int> cpus;
+    size_t pos = 0;
+    while (pos < list.size() && list[pos] != '\n')
+    {
+        char *end;
+        long first = strtol(list.c_str() + pos, &end, 10);
+        if (end == list.c_str() + pos || first < 0)
+            return {};
+        long last = first;
+        pos = end - list.c_str();
+        if (pos < list.size() && list[pos] == '-')
+        {
+            ++pos;
+            last = strtol(list.c_str() + pos, &end, 10);
+            if (end == list.c_str() + pos || last < first)
+                return {};
+            pos = end - list.c_str();
+        }
+        // Linux supports at most 8192 CPUs.
+        if (last >= 8192)
+            return {};
+        for (long cpu = first; cpu <= last; ++cpu)
+            cpus.push_back(static_cast<int>(cpu));
+        if (pos < list.size() && list[pos] == ',')
+            ++pos;
+    }
+    std::sort(cpus.begin(), cpus.end());
+    cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+    return cpus;
+}
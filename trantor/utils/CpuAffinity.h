@@ -0,0 +1,119 @@
+/**
+ *
+ *  @file CpuAffinity.h
+ *  @author An Tao
+ *
+ *  Public header file in trantor lib.
+ *
+ *  Copyright 2018, An Tao.  All rights reserved.
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the License file.
+ *
+ *
+ */
+
+#pragma once
+
+#include <trantor/exports.h>
+#include <string>
+#include <vector>
+#include <stddef.h>
+
+namespace trantor
+{
+/**
+ * @brief This class describes where the threads of a pool run: the i-th thread
+ * is pinned to the i-th set of CPUs, cycling over the sets when there are more
+ * threads than sets. A default constructed object doesn't pin any thread.
+ *
+ * When a set is the CPUs of a NUMA node, the thread also prefers the memory of
+ * that node, so the buffers and other objects it allocates are local to it.
+ *
+ * @note Pinning is only supported on Linux, it is ignored elsewhere.
+ */
+class TRANTOR_EXPORT CpuAffinity
+{
+  public:
+    CpuAffinity() = default;
+
+    /**
+     * @brief Pin the i-th thread to the CPU cpus[i % cpus.size()].
+     *
+     * @param cpus The ids of the CPUs.
+     * @return CpuAffinity
+     */
+    static CpuAffinity cpuList(const std::vector<int> &cpus);
+
+    /**
+     * @brief Pin the threads to the CPUs the process is allowed to run on, one
+     * CPU per thread in a round-robin way.
+     *
+     * @return CpuAffinity
+     */
+    static CpuAffinity roundRobin();
+
+    /**
+     * @brief Pin the i-th thread to the CPUs of the NUMA node i % nodes, and
+     * make it allocate memory from that node. On machines without NUMA
+     * information, the result doesn't pin any thread.
+     *
+     * @return CpuAffinity
+     */
+    static CpuAffinity numaNodes();
+
+    /**
+     * @brief Return true if no thread is pinned.
+     */
+    bool empty() const
+    {
+        return sets_.empty();
+    }
+
+    /**
+     * @brief Return the CPUs of the thread of the given index.
+     *
+     * @param index
+     * @return std::vector<int> All the CPUs are allowed if it is empty.
+     */
+    std::vector<int> cpusOf(size_t index) const;
+
+    /**
+     * @brief Return the NUMA node whose memory the thread of the given index
+     * prefers, or -1.
+     *
+     * @param index
+     * @return int
+     */
+    int nodeOf(size_t index) const;
+
+    /**
+     * @brief Pin the current thread as the thread of the given index.
+     *
+     * @param index
+     * @return false if the thread could not be pinned, the error is logged.
+     */
+    bool apply(size_t index) const;
+
+    /**
+     * @brief Return the CPUs the current thread is allowed to run on.
+     *
+     * @return std::vector<int> It is empty if the information isn't available.
+     */
+    static std::vector<int> allowedCpus();
+
+    /**
+     * @brief Parse a list of CPUs in the format of Linux, e.g. "0-3,8,10-11".
+     *
+     * @param list
+     * @return std::vector<int> The CPUs in ascending order, empty if the list
+     * is malformed.
+     */
+    static std::vector<int> parseCpuList(const std::string &list);
+
+  private:
+    std::vector<std::vector<int>> sets_;
+    // The node of each set, or -1.
+    std::vector<int> nodes_;
+};
+
+}  // namespace trantor
@@ -17,7 +17,9 @@
 #include <atomic>
 #include <type_traits>
 #include <memory>
+#include <new>
 #include <assert.h>
+#include <stdint.h>
 namespace trantor
 {
 /**
@@ -25,6 +27,9 @@ namespace trantor
  * consumer queue
  *
  * @tparam T The type of the items in the queue.
+ * @note Items are stored in the nodes of the queue. The nodes released by the
+ * consumer are kept in a free list and reused by the producers, so the queue
+ * doesn't allocate memory once it has grown to its working size.
  */
 template <typename T>
 class MpscQueue : public NonCopyable
@@ -42,6 +47,14 @@ class MpscQueue : public NonCopyable
         }
         BufferNode *front = head_.load(std::memory_order_relaxed);
         delete front;
+        flushFreeNodes();
+        BufferNode *node = freeList_.load(std::memory_order_relaxed);
+        while (node)
+        {
+            BufferNode *next = node->next_.load(std::memory_order_relaxed);
+            delete node;
+            node = next;
+        }
     }
 
     /**
@@ -52,15 +65,15 @@ class MpscQueue : public NonCopyable
      */
     void enqueue(T &&input)
     {
-        BufferNode *node{new BufferNode(std::move(input))};
-        BufferNode *prevhead{head_.exchange(node, std::memory_order_acq_rel)};
-        prevhead->next_.store(node, std::memory_order_release);
+        BufferNode *node = allocNode();
+        new (&node->data_) T(std::move(input));
+        push(node);
     }
     void enqueue(const T &input)
     {
-        BufferNode *node{new BufferNode(input)};
-        BufferNode *prevhead{head_.exchange(node, std::memory_order_acq_rel)};
-        prevhead->next_.store(node, std::memory_order_release);
+        BufferNode *node = allocNode();
+        new (&node->data_) T(input);
+        push(node);
     }
 
     /**
@@ -79,13 +92,54 @@ class MpscQueue : public NonCopyable
         {
             return false;
         }
-        output = std::move(*(next->dataPtr_));
-        delete next->dataPtr_;
+        T *data = next->data();
+        output = std::move(*data);
+        data->~T();
         tail_.store(next, std::memory_order_release);
-        delete tail;
+        freeNode(tail);
         return true;
     }
 
+    /**
+     * @brief Get all items in the queue and pass them to the consumer in
+     * order. The end of the queue is read once, so items put into the queue
+     * by the consumer are left for the next call.
+     *
+     * @param consumer A callable object which is called with an rvalue
+     * reference to each item.
+     * @return The number of items consumed.
+     * @note This method must be called in a single thread.
+     */
+    template <typename Consumer>
+    size_t dequeueAll(Consumer &&consumer)
+    {
+        // Reading the head synchronizes with all the producers before it, so
+        // the items of the nodes up to it are visible.
+        BufferNode *last = head_.load(std::memory_order_acquire);
+        BufferNode *tail = tail_.load(std::memory_order_relaxed);
+        size_t count = 0;
+        while (tail != last)
+        {
+            BufferNode *next = tail->next_.load(std::memory_order_relaxed);
+            if (next == nullptr)
+            {
+                // A producer is between updating the head and linking its
+                // node, the rest is left for the next call.
+                break;
+            }
+            T *data = next->data();
+            T item(std::move(*data));
+            data->~T();
+            tail_.store(next, std::memory_order_release);
+            freeNode(tail);
+            tail = next;
+            ++count;
+            consumer(std::move(item));
+        }
+        flushFreeNodes();
+        return count;
+    }
+
     bool empty()
     {
         BufferNode *tail = tail_.load(std::memory_order_relaxed);
@@ -96,19 +150,440 @@ class MpscQueue : public NonCopyable
   private:
     struct BufferNode
     {
-        BufferNode() = default;
-        BufferNode(const T &data) : dataPtr_(new T(data))
-        {
-        }
-        BufferNode(T &&data) : dataPtr_(new T(std::move(data)))
+        T *data()
         {
+            return reinterpret_cast<T *>(&data_);
         }
-        T *dataPtr_;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type data_;
         std::atomic<BufferNode *> next_{nullptr};
     };
+    static const size_t kMaxFreeNodes = 1024;
+    static const size_t kFreeBatchSize = 32;
+
+    void push(BufferNode *node)
+    {
+        BufferNode *prevhead{head_.exchange(node, std::memory_order_acq_rel)};
+        prevhead->next_.store(node, std::memory_order_release);
+    }
+
+    BufferNode *allocNode()
+    {
+        // Only one producer at a time takes nodes from the free list, so a
+        // node can't be taken and given back between reading the top and the
+        // CAS below (the ABA problem). Other producers don't wait for it.
+        if (freeList_.load(std::memory_order_relaxed) != nullptr &&
+            !freeListLock_.test_and_set(std::memory_order_acquire))
+        {
+            BufferNode *node = freeList_.load(std::memory_order_acquire);
+            while (node &&
+                   !freeList_.compare_exchange_weak(
+                       node,
+                       node->next_.load(std::memory_order_relaxed),
+                       std::memory_order_acquire,
+                       std::memory_order_acquire))
+            {
+            }
+            if (node)
+            {
+                // Only the holder of the lock writes this counter.
+                takenNodes_.store(
+                    takenNodes_.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_relaxed);
+            }
+            freeListLock_.clear(std::memory_order_release);
+            if (node)
+            {
+                node->next_.store(nullptr, std::memory_order_relaxed);
+                return node;
+            }
+        }
+        return new BufferNode;
+    }
+
+    void freeNode(BufferNode *node)
+    {
+        // The nodes are given back in batches to save atomic operations.
+        if (givenNodes_ - takenNodes_.load(std::memory_order_relaxed) +
+                batchSize_ >=
+            kMaxFreeNodes)
+        {
+            delete node;
+            return;
+        }
+        node->next_.store(batchHead_, std::memory_order_relaxed);
+        if (!batchHead_)
+            batchTail_ = node;
+        batchHead_ = node;
+        if (++batchSize_ == kFreeBatchSize)
+            flushFreeNodes();
+    }
+
+    void flushFreeNodes()
+    {
+        if (!batchHead_)
+            return;
+        givenNodes_ += batchSize_;
+        BufferNode *top = freeList_.load(std::memory_order_relaxed);
+        do
+        {
+            batchTail_->next_.store(top, std::memory_order_relaxed);
+        } while (!freeList_.compare_exchange_weak(top,
+                                                  batchHead_,
+                                                  std::memory_order_release,
+                                                  std::memory_order_relaxed));
+        batchHead_ = nullptr;
+        batchTail_ = nullptr;
+        batchSize_ = 0;
+    }
 
     std::atomic<BufferNode *> head_;
     std::atomic<BufferNode *> tail_;
+    std::atomic<BufferNode *> freeList_{nullptr};
+    std::atomic_flag freeListLock_ = ATOMIC_FLAG_INIT;
+    std::atomic<size_t> takenNodes_{0};
+    // Only used by the consumer.
+    size_t givenNodes_{0};
+    BufferNode *batchHead_{nullptr};
+    BufferNode *batchTail_{nullptr};
+    size_t batchSize_{0};
+};
+
+/**
+ * @brief This class template represents a bounded lock-free multiple producers
+ * single consumer queue, based on a ring of cells with sequence numbers. It
+ * never allocates memory after construction.
+ *
+ * @tparam T The type of the items in the queue.
+ */
+template <typename T>
+class BoundedMpscQueue : public NonCopyable
+{
+  public:
+    /**
+     * @brief Construct a new queue.
+     *
+     * @param capacity The maximum number of items in the queue, it is rounded
+     * up to a power of 2.
+     */
+    explicit BoundedMpscQueue(size_t capacity)
+    {
+        size_t size = 2;
+        while (size < capacity)
+            size <<= 1;
+        mask_ = size - 1;
+        cells_.reset(new Cell[size]);
+        for (size_t i = 0; i < size; ++i)
+        {
+            cells_[i].sequence_.store(i, std::memory_order_relaxed);
+        }
+    }
+    ~BoundedMpscQueue()
+    {
+        T output;
+        while (this->dequeue(output))
+        {
+        }
+    }
+
+    /**
+     * @brief Put a item into the queue.
+     *
+     * @param input
+     * @return false if the queue is full, the input is left untouched then.
+     * @note This method can be called in multiple threads.
+     */
+    bool enqueue(T &&input)
+    {
+        Cell *cell = claimCell();
+        if (!cell)
+            return false;
+        new (&cell->data_) T(std::move(input));
+        cell->sequence_.store(cell->position_ + 1, std::memory_order_release);
+        return true;
+    }
+    bool enqueue(const T &input)
+    {
+        Cell *cell = claimCell();
+        if (!cell)
+            return false;
+        new (&cell->data_) T(input);
+        cell->sequence_.store(cell->position_ + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Get a item from the queue.
+     *
+     * @param output
+     * @return false if the queue is empty.
+     * @note This method must be called in a single thread.
+     */
+    bool dequeue(T &output)
+    {
+        Cell &cell = cells_[dequeuePos_ & mask_];
+        if (cell.sequence_.load(std::memory_order_acquire) != dequeuePos_ + 1)
+            return false;
+        T *data = cell.data();
+        output = std::move(*data);
+        data->~T();
+        cell.sequence_.store(dequeuePos_ + mask_ + 1,
+                             std::memory_order_release);
+        ++dequeuePos_;
+        return true;
+    }
+
+    /**
+     * @brief Get the items in the queue and pass them to the consumer in
+     * order, until the queue is empty or the given number of items are
+     * consumed.
+     *
+     * @param consumer A callable object which is called with an rvalue
+     * reference to each item.
+     * @param maxItems The maximum number of items to consume, the default is
+     * the capacity of the queue, so that items put into the queue by the
+     * consumer don't keep it busy forever.
+     * @return The number of items consumed.
+     * @note This method must be called in a single thread.
+     */
+    template <typename Consumer>
+    size_t dequeueAll(Consumer &&consumer, size_t maxItems = 0)
+    {
+        if (maxItems == 0)
+            maxItems = capacity();
+        size_t count = 0;
+        while (count < maxItems)
+        {
+            Cell &cell = cells_[dequeuePos_ & mask_];
+            if (cell.sequence_.load(std::memory_order_acquire) !=
+                dequeuePos_ + 1)
+                break;
+            T *data = cell.data();
+            T item(std::move(*data));
+            data->~T();
+            cell.sequence_.store(dequeuePos_ + mask_ + 1,
+                                 std::memory_order_release);
+            ++dequeuePos_;
+            ++count;
+            consumer(std::move(item));
+        }
+        return count;
+    }
+
+    bool empty() const
+    {
+        const Cell &cell = cells_[dequeuePos_ & mask_];
+        return cell.sequence_.load(std::memory_order_acquire) !=
+               dequeuePos_ + 1;
+    }
+
+    /**
+     * @brief Return the maximum number of items in the queue.
+     */
+    size_t capacity() const
+    {
+        return mask_ + 1;
+    }
+
+  private:
+    struct Cell
+    {
+        T *data()
+        {
+            return reinterpret_cast<T *>(&data_);
+        }
+        std::atomic<size_t> sequence_;
+        size_t position_;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type data_;
+    };
+
+    Cell *claimCell()
+    {
+        size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+        while (true)
+        {
+            Cell &cell = cells_[pos & mask_];
+            size_t seq = cell.sequence_.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) -
+                            static_cast<intptr_t>(pos);
+            if (diff == 0)
+            {
+                if (enqueuePos_.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed))
+                {
+                    cell.position_ = pos;
+                    return &cell;
+                }
+            }
+            else if (diff < 0)
+            {
+                // The consumer hasn't released this cell yet, the queue is
+                // full.
+                return nullptr;
+            }
+            else
+            {
+                pos = enqueuePos_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    std::unique_ptr<Cell[]> cells_;
+    size_t mask_{0};
+    // Keep the producers' and the consumer's positions on different cache
+    // lines.
+    char pad0_[64];
+    std::atomic<size_t> enqueuePos_{0};
+    char pad1_[64];
+    size_t dequeuePos_{0};
+};
+
+/**
+ * @brief This class template represents a bounded lock-free single producer
+ * single consumer queue, based on a ring of slots. It never allocates memory
+ * after construction, and each side only reads the position of the other side
+ * when its cached copy says the ring is full or empty.
+ *
+ * @tparam T The type of the items in the queue.
+ */
+template <typename T>
+class SpscQueue : public NonCopyable
+{
+  public:
+    /**
+     * @brief Construct a new queue.
+     *
+     * @param capacity The maximum number of items in the queue, it is rounded
+     * up to a power of 2.
+     */
+    explicit SpscQueue(size_t capacity)
+    {
+        size_t size = 2;
+        while (size < capacity)
+            size <<= 1;
+        mask_ = size - 1;
+        slots_.reset(new Slot[size]);
+    }
+    ~SpscQueue()
+    {
+        size_t tail = tail_.load(std::memory_order_acquire);
+        for (size_t pos = head_.load(std::memory_order_relaxed); pos != tail;
+             ++pos)
+        {
+            slot(pos)->~T();
+        }
+    }
+
+    /**
+     * @brief Put a item into the queue.
+     *
+     * @param input
+     * @return false if the queue is full, the input is left untouched then.
+     * @note This method must be called in a single thread.
+     */
+    bool enqueue(T &&input)
+    {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - headCache_ > mask_)
+        {
+            headCache_ = head_.load(std::memory_order_acquire);
+            if (tail - headCache_ > mask_)
+                return false;
+        }
+        new (slot(tail)) T(std::move(input));
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Return the number of items which can be put into the queue
+     * without failing. This method must be called by the producer.
+     */
+    size_t space()
+    {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        headCache_ = head_.load(std::memory_order_acquire);
+        return mask_ + 1 - (tail - headCache_);
+    }
+
+    /**
+     * @brief Get the items in the queue and pass them to the consumer in
+     * order, until the queue is empty or the given number of items are
+     * consumed.
+     *
+     * @param consumer A callable object which is called with an rvalue
+     * reference to each item.
+     * @param maxItems The maximum number of items to consume, zero means the
+     * capacity of the queue.
+     * @return The number of items consumed.
+     * @note This method must be called in a single thread.
+     */
+    template <typename Consumer>
+    size_t dequeueAll(Consumer &&consumer, size_t maxItems = 0)
+    {
+        if (maxItems == 0)
+            maxItems = capacity();
+        size_t head = head_.load(std::memory_order_relaxed);
+        size_t count = 0;
+        while (count < maxItems)
+        {
+            if (head == tailCache_)
+            {
+                tailCache_ = tail_.load(std::memory_order_acquire);
+                if (head == tailCache_)
+                    break;
+            }
+            T *data = slot(head);
+            T item(std::move(*data));
+            data->~T();
+            ++head;
+            ++count;
+            // Release the slot before the consumer runs, so that the producer
+            // can reuse it.
+            head_.store(head, std::memory_order_release);
+            consumer(std::move(item));
+        }
+        return count;
+    }
+
+    /**
+     * @brief Return true if the queue is empty. This method must be called by
+     * the consumer.
+     */
+    bool empty() const
+    {
+        return head_.load(std::memory_order_relaxed) ==
+               tail_.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief Return the maximum number of items in the queue.
+     */
+    size_t capacity() const
+    {
+        return mask_ + 1;
+    }
+
+  private:
+    struct Slot
+    {
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type data_;
+    };
+    T *slot(size_t pos)
+    {
+        return reinterpret_cast<T *>(&slots_[pos & mask_].data_);
+    }
+
+    std::unique_ptr<Slot[]> slots_;
+    size_t mask_{0};
+    // Keep the producer's and the consumer's positions on different cache
+    // lines.
+    char pad0_[64];
+    std::atomic<size_t> tail_{0};
+    size_t headCache_{0};
+    char pad1_[64];
+    std::atomic<size_t> head_{0};
+    size_t tailCache_{0};
+    char pad2_[64];
 };
 
 }  // namespace trantor
@@ -0,0 +1,246 @@
+/**
+ *
+ *  @file Task.h
+ *  @author An Tao
+ *
+ *  Public header file in trantor lib.
+ *
+ *  Copyright 2018, An Tao.  All rights reserved.
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the License file.
+ *
+ *
+ */
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <stddef.h>
+
+namespace trantor
+{
+/**
+ * @brief This class represents a move-only callable object which takes no
+ * arguments and returns nothing. It is used to queue functions in event loops
+ * and task queues.
+ *
+ * Unlike std::function, a Task can hold a callable object that can't be
+ * copied, such as a lambda capturing a std::unique_ptr, and it keeps larger
+ * callable objects (up to kInlineSize bytes) in its own storage instead of
+ * allocating memory for them. A lambda capturing a shared pointer and a string
+ * doesn't allocate.
+ *
+ * @note A Task is implicitly constructed from any callable object, so the
+ * methods taking a Task also accept std::function objects and lambdas.
+ */
+class Task
+{
+  public:
+    /**
+     * @brief The size of the storage for callable objects in a Task, a Task
+     * object takes one more pointer.
+     */
+    static constexpr size_t kInlineSize = 7 * sizeof(void *);
+
+    Task() noexcept = default;
+    Task(std::nullptr_t) noexcept
+    {
+    }
+
+    /**
+     * @brief Construct a task from a callable object.
+     *
+     * @param f The callable object, an empty std::function or a null function
+     * pointer makes an empty task.
+     */
+    template <typename F,
+              typename Callable = typename std::decay<F>::type,
+              typename = typename std::enable_if<
+                  !std::is_same<Callable, Task>::value>::type,
+              typename = decltype(std::declval<Callable &>()())>
+    Task(F &&f)
+    {
+        if (isNull(f))
+            return;
+        construct<Callable>(std::forward<F>(f), IsInline<Callable>());
+    }
+
+    Task(Task &&other) noexcept
+    {
+        moveFrom(other);
+    }
+    Task &operator=(Task &&other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            moveFrom(other);
+        }
+        return *this;
+    }
+    Task &operator=(std::nullptr_t) noexcept
+    {
+        reset();
+        return *this;
+    }
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+    ~Task()
+    {
+        reset();
+    }
+
+    /**
+     * @brief Call the callable object.
+     *
+     * @note Like std::function, calling an empty task throws
+     * std::bad_function_call.
+     */
+    void operator()() const
+    {
+        if (!ops_)
+            throw std::bad_function_call();
+        ops_->invoke(&storage_);
+    }
+
+    explicit operator bool() const noexcept
+    {
+        return ops_ != nullptr;
+    }
+
+    /**
+     * @brief Return true if the callable object is kept in the storage of the
+     * task, false if it is allocated on the heap or the task is empty.
+     */
+    bool isInline() const noexcept
+    {
+        return ops_ && ops_->isInline;
+    }
+
+  private:
+    struct Ops
+    {
+        void (*invoke)(void *storage);
+        // Move the object from src to the uninitialized dst and destroy the
+        // one in src.
+        void (*relocate)(void *dst, void *src);
+        void (*destroy)(void *storage);
+        bool isInline;
+    };
+
+    using Storage = typename std::aligned_storage<kInlineSize,
+                                                  alignof(void *)>::type;
+
+    template <typename F>
+    using IsInline = std::integral_constant<
+        bool,
+        sizeof(F) <= kInlineSize && alignof(Storage) % alignof(F) == 0 &&
+            std::is_nothrow_move_constructible<F>::value>;
+
+    template <typename F>
+    struct InlineOps
+    {
+        static void invoke(void *storage)
+        {
+            (*static_cast<F *>(storage))();
+        }
+        static void relocate(void *dst, void *src)
+        {
+            F *from = static_cast<F *>(src);
+            new (dst) F(std::move(*from));
+            from->~F();
+        }
+        static void destroy(void *storage)
+        {
+            static_cast<F *>(storage)->~F();
+        }
+        static const Ops ops;
+    };
+
+    template <typename F>
+    struct HeapOps
+    {
+        static void invoke(void *storage)
+        {
+            (**static_cast<F **>(storage))();
+        }
+        static void relocate(void *dst, void *src)
+        {
+            *static_cast<F **>(dst) = *static_cast<F **>(src);
+        }
+        static void destroy(void *storage)
+        {
+            delete *static_cast<F **>(storage);
+        }
+        static const Ops ops;
+    };
+
+    template <typename F>
+    static bool isNull(const F &)
+    {
+        return false;
+    }
+    template <typename F>
+    static bool isNull(F *f)
+    {
+        return f == nullptr;
+    }
+    template <typename S>
+    static bool isNull(const std::function<S> &f)
+    {
+        return !f;
+    }
+
+    template <typename Callable, typename F>
+    void construct(F &&f, std::true_type)
+    {
+        new (&storage_) Callable(std::forward<F>(f));
+        ops_ = &InlineOps<Callable>::ops;
+    }
+    template <typename Callable, typename F>
+    void construct(F &&f, std::false_type)
+    {
+        *reinterpret_cast<Callable **>(&storage_) =
+            new Callable(std::forward<F>(f));
+        ops_ = &HeapOps<Callable>::ops;
+    }
+
+    void moveFrom(Task &other) noexcept
+    {
+        if (other.ops_)
+        {
+            other.ops_->relocate(&storage_, &other.storage_);
+            ops_ = other.ops_;
+            other.ops_ = nullptr;
+        }
+    }
+    void reset() noexcept
+    {
+        if (ops_)
+        {
+            ops_->destroy(&storage_);
+            ops_ = nullptr;
+        }
+    }
+
+    mutable Storage storage_;
+    const Ops *ops_{nullptr};
+};
+
+template <typename F>
+const Task::Ops Task::InlineOps<F>::ops = {&Task::InlineOps<F>::invoke,
+                                           &Task::InlineOps<F>::relocate,
+                                           &Task::InlineOps<F>::destroy,
+                                           true};
+
+template <typename F>
+const Task::Ops Task::HeapOps<F>::ops = {&Task::HeapOps<F>::invoke,
+                                         &Task::HeapOps<F>::relocate,
+                                         &Task::HeapOps<F>::destroy,
+                                         false};
+
+}  // namespace trantor